@@ -22,6 +22,188 @@ port(const char* s) {
     return (unsigned short)sl;
 }
 
+static unsigned short
+workers(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 1 || sl > MAX_ARGS_WORKERS) {
+        fprintf(stderr, "Worker threads should be in the range of 1-%d: %s\n", MAX_ARGS_WORKERS, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned short)sl;
+}
+
+static unsigned
+resolverThreads(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 1 || sl > MAX_ARGS_RESOLVER_THREADS) {
+        fprintf(stderr, "Resolver threads should be in the range of 1-%d: %s\n", MAX_ARGS_RESOLVER_THREADS, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+resolverQueue(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 1 || sl > MAX_ARGS_RESOLVER_QUEUE) {
+        fprintf(stderr, "Resolver queue should be in the range of 1-%d: %s\n", MAX_ARGS_RESOLVER_QUEUE, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+dnsCache(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 0 || sl > MAX_ARGS_DNS_CACHE) {
+        fprintf(stderr, "DNS cache entries should be in the range of 0-%d: %s\n", MAX_ARGS_DNS_CACHE, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+timeout(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 0 || sl > MAX_ARGS_TIMEOUT) {
+        fprintf(stderr, "Timeouts should be in the range of 0-%d seconds: %s\n", MAX_ARGS_TIMEOUT, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+zerocopy(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 0 || sl > MAX_ARGS_RELAY_BUDGET) {
+        fprintf(stderr, "Zero-copy threshold should be in the range of 0-%d bytes: %s\n", MAX_ARGS_RELAY_BUDGET, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+relayBuffer(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < MIN_ARGS_RELAY_BUFFER || sl > MAX_ARGS_RELAY_BUFFER || (sl & (sl - 1)) != 0) {
+        fprintf(stderr, "Relay buffer sizes should be a power of two in the range of %d-%d bytes: %s\n", MIN_ARGS_RELAY_BUFFER, MAX_ARGS_RELAY_BUFFER, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+budget(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < MIN_ARGS_RELAY_BUDGET || sl > MAX_ARGS_RELAY_BUDGET) {
+        fprintf(stderr, "Relay budget should be in the range of %d-%d bytes: %s\n", MIN_ARGS_RELAY_BUDGET, MAX_ARGS_RELAY_BUDGET, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+rate(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 0 || sl > MAX_ARGS_RELAY_BUDGET) {
+        fprintf(stderr, "Rate limit should be in the range of 0-%d bytes per second: %s\n", MAX_ARGS_RELAY_BUDGET, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+watermark(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 0 || sl > MAX_ARGS_RELAY_BUDGET) {
+        fprintf(stderr, "Watermarks should be in the range of 0-%d bytes: %s\n", MAX_ARGS_RELAY_BUDGET, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+slabBytes(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < MIN_ARGS_SLAB || sl > MAX_ARGS_SLAB) {
+        fprintf(stderr, "Session slab size should be in the range of %d-%d bytes: %s\n", MIN_ARGS_SLAB, MAX_ARGS_SLAB, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+userTimeout(const char* s) {
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 0 || sl > MAX_ARGS_TIMEOUT * 1000L) {
+        fprintf(stderr, "TCP user timeout should be in the range of 0-%ld milliseconds: %s\n", MAX_ARGS_TIMEOUT * 1000L, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+/** <idle>:<interval>:<count>, o 0 para deshabilitarlo */
+static void
+keepalive(const char* s, struct socks5args* args) {
+    char* end = 0;
+    const long idle = strtol(s, &end, 10);
+    long interval = 0, count = 0;
+    bool ok = end != s && idle >= 0 && idle <= MAX_ARGS_KEEPALIVE;
+
+    if (ok && idle != 0) {
+        const char* p = end + 1;
+        ok = *end == ':';
+        interval = strtol(p, &end, 10);
+        ok = ok && end != p && interval >= 1 && interval <= MAX_ARGS_KEEPALIVE && *end == ':';
+        p = end + 1;
+        count = strtol(p, &end, 10);
+        ok = ok && end != p && count >= 1 && count <= MAX_ARGS_KEEPALIVE_PROBES;
+    }
+    if (!ok || '\0' != *end) {
+        fprintf(stderr, "Keepalive should be 0 or <idle>:<interval>:<count>, with up to %d seconds and %d probes: %s\n", MAX_ARGS_KEEPALIVE, MAX_ARGS_KEEPALIVE_PROBES, s);
+        exit(1);
+    }
+    args->keepaliveIdle = (unsigned)idle;
+    args->keepaliveInterval = (unsigned)interval;
+    args->keepaliveCount = (unsigned)count;
+}
+
 static void
 user(char* s, struct users* user) {
     char* p = strchr(s, ':');
@@ -47,14 +229,35 @@ usage(const char* progname) {
     fprintf(stderr,
             "Usage: %s [OPTION]...\n"
             "\n"
+            "   -b <bytes>       Maximum bytes each relay handler moves per wakeup in edge-triggered mode. Defaults to 262144.\n"
+            "   -c <seconds>     Timeout for each connection attempt to the origin server. 0 disables it. Defaults to 10.\n"
+            "   -C <entries>     DNS cache entries of each worker, evicting the least recently used. 0 disables it. Defaults to 4096.\n"
+            "   -e               Relays with edge-triggered notifications, draining each socket until EAGAIN.\n"
+            "   -G               Resolves domain names with getaddrinfo on the resolver threads instead of the built-in DNS client.\n"
             "   -h               Prints this help menu and then exits.\n"
+            "   -H <bytes>       Stops reading from a side once this many relayed bytes wait to be sent. 0 disables it. Defaults to 0.\n"
+            "   -i <seconds>     Closes relayed connections without traffic for this long. 0 disables it. Defaults to 600.\n"
+            "   -k <i>:<n>:<c>   TCP keepalive: idle seconds, seconds between probes and probes before giving up. 0 disables it. Defaults to 60:10:5.\n"
             "   -l <SOCKS addr>  Specifies the source address for the socks5 server. This may be an IPv4 or IPv6 address.\n"
             "   -N               Deshabilita el passwords dissectors.\n"
+            "   -m <bytes>       Initial (and minimum) size of each relay buffer, a power of two. Defaults to 4096.\n"
+            "   -M <bytes>       Size up to which relay buffers grow for fast transfers, a power of two. Defaults to 262144.\n"
             "   -L <conf addr>   Specifies the source address for the management server. This may be an IPv4 or IPv6 address.\n"
+            "   -o <bytes>       TCP_NOTSENT_LOWAT of the client and origin sockets. 0 disables it. Defaults to 0.\n"
             "   -p <SOCKS port>  Specifies the source port for the socks5 server.\n"
             "   -P <conf port>   Specifies the source port for the management server.\n"
+            "   -q <requests>    getaddrinfo resolutions that may wait for a resolver thread; beyond it requests fail. Defaults to 1024.\n"
+            "   -R <threads>     Amount of threads resolving domain names with getaddrinfo, shared by all workers. Defaults to 16.\n"
+            "   -r <bytes/s>     Bandwidth limit shared by all sessions that don't authenticate, counting both directions together. 0 disables it. Defaults to 0.\n"
+            "   -s <bytes>       Memory cap of each worker's session slab; beyond it new clients are rejected. Defaults to 67108864.\n"
+            "   -S               Relays with splice(2) through kernel pipes, except when a password dissector applies.\n"
+            "   -t <seconds>     Timeout for clients to complete the socks5 handshake. 0 disables it. Defaults to 10.\n"
+            "   -T <ms>          TCP_USER_TIMEOUT of the client and origin sockets. 0 keeps the system default. Defaults to 0.\n"
+            "   -U               Uses io_uring for accepting and relaying connections, when available.\n"
             "   -u <user>:<pass> Specifies a username and password to register into the system. This param may be specified up to 10 times.\n"
             "   -v               Display this server's version information and exit.\n"
+            "   -Z <bytes>       Sends relay writes of at least this many bytes with MSG_ZEROCOPY. 0 disables it. Defaults to 0.\n"
+            "   -w <threads>     Amount of threads serving socks5 connections, each with its own event loop. Defaults to 1.\n"
             "\n",
             progname);
     exit(1);
@@ -70,33 +273,113 @@ void parse_args(const int argc, char** argv, struct socks5args* args) {
     args->mngPort = 8080;
 
     args->disectorsEnabled = true;
+    args->uringEnabled = false;
+    args->workers = 1;
+    args->dnsEnabled = true;
+    args->dnsCacheEntries = 4096;
+    args->resolverThreads = 16;
+    args->resolverQueue = 1024;
+    args->sessionSlabBytes = 64 * 1024 * 1024;
+    args->edgeTriggered = false;
+    args->relayBudget = 262144;
+    args->spliceEnabled = false;
+    args->zerocopyThreshold = 0;
+    args->relayBufferMin = 4096;
+    args->relayBufferMax = 262144;
+    args->rateLimit = 0;
+    args->notsentLowat = 0;
+    args->highWatermark = 0;
+    args->handshakeTimeout = 10;
+    args->connectTimeout = 10;
+    args->idleTimeout = 600;
+    args->keepaliveIdle = 60;
+    args->keepaliveInterval = 10;
+    args->keepaliveCount = 5;
+    args->userTimeout = 0;
     args->nusers = 0;
 
     while (true) {
-        int c = getopt(argc, argv, "hl:L:Np:P:U:u:v");
+        int c = getopt(argc, argv, "b:c:C:eGhH:i:k:l:L:m:M:No:p:P:q:r:R:s:St:T:Uu:vw:Z:");
 
         if (c == -1)
             break;
 
         switch (c) {
+            case 'b':
+                args->relayBudget = budget(optarg);
+                break;
+            case 'c':
+                args->connectTimeout = timeout(optarg);
+                break;
+            case 'C':
+                args->dnsCacheEntries = dnsCache(optarg);
+                break;
+            case 'e':
+                args->edgeTriggered = true;
+                break;
+            case 'G':
+                args->dnsEnabled = false;
+                break;
             case 'h':
                 usage(argv[0]);
                 break;
+            case 'H':
+                args->highWatermark = watermark(optarg);
+                break;
+            case 'i':
+                args->idleTimeout = timeout(optarg);
+                break;
+            case 'k':
+                keepalive(optarg, args);
+                break;
             case 'l':
                 args->socksAddr = optarg;
                 break;
             case 'L':
                 args->mngAddr = optarg;
                 break;
+            case 'm':
+                args->relayBufferMin = relayBuffer(optarg);
+                break;
+            case 'M':
+                args->relayBufferMax = relayBuffer(optarg);
+                break;
             case 'N':
                 args->disectorsEnabled = false;
                 break;
+            case 'o':
+                args->notsentLowat = watermark(optarg);
+                break;
             case 'p':
                 args->socksPort = port(optarg);
                 break;
             case 'P':
                 args->mngPort = port(optarg);
                 break;
+            case 'q':
+                args->resolverQueue = resolverQueue(optarg);
+                break;
+            case 'r':
+                args->rateLimit = rate(optarg);
+                break;
+            case 'R':
+                args->resolverThreads = resolverThreads(optarg);
+                break;
+            case 's':
+                args->sessionSlabBytes = slabBytes(optarg);
+                break;
+            case 'S':
+                args->spliceEnabled = true;
+                break;
+            case 't':
+                args->handshakeTimeout = timeout(optarg);
+                break;
+            case 'T':
+                args->userTimeout = userTimeout(optarg);
+                break;
+            case 'U':
+                args->uringEnabled = true;
+                break;
             case 'u':
                 if (args->nusers >= MAX_ARGS_USERS) {
                     fprintf(stderr, "Maximun number of command line users reached: %d.\n", MAX_ARGS_USERS);
@@ -110,6 +393,12 @@ void parse_args(const int argc, char** argv, struct socks5args* args) {
                 version();
                 exit(0);
                 break;
+            case 'w':
+                args->workers = workers(optarg);
+                break;
+            case 'Z':
+                args->zerocopyThreshold = zerocopy(optarg);
+                break;
             default:
                 fprintf(stderr, "Unknown argument %d.\n", c);
                 exit(1);
@@ -123,4 +412,8 @@ void parse_args(const int argc, char** argv, struct socks5args* args) {
         fprintf(stderr, "\n");
         exit(1);
     }
+    if (args->relayBufferMin > args->relayBufferMax) {
+        fprintf(stderr, "Initial relay buffer size (%u) should not exceed the maximum (%u).\n", args->relayBufferMin, args->relayBufferMax);
+        exit(1);
+    }
 }
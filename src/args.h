@@ -4,6 +4,26 @@
 #include <stdbool.h>
 
 #define MAX_ARGS_USERS 10
+#define MAX_ARGS_WORKERS 64
+/** límites del presupuesto por despertar del relay edge-triggered */
+#define MIN_ARGS_RELAY_BUDGET 4096
+#define MAX_ARGS_RELAY_BUDGET (64 * 1024 * 1024)
+/** límites de los buffers del relay, potencias de 2 */
+#define MIN_ARGS_RELAY_BUFFER 4096
+#define MAX_ARGS_RELAY_BUFFER (1024 * 1024)
+/** límites de la memoria del slab de sesiones de cada worker */
+#define MIN_ARGS_SLAB (64 * 1024)
+#define MAX_ARGS_SLAB (1024 * 1024 * 1024)
+/** límites del pool de hilos que resuelve nombres y de su cola */
+#define MAX_ARGS_RESOLVER_THREADS 256
+#define MAX_ARGS_RESOLVER_QUEUE 65536
+/** máximo de entradas del cache DNS de cada worker */
+#define MAX_ARGS_DNS_CACHE (1024 * 1024)
+/** máximo para los timeouts, en segundos (24 días) */
+#define MAX_ARGS_TIMEOUT 2073600
+/** límites de TCP_KEEPIDLE / TCP_KEEPINTVL en segundos y de TCP_KEEPCNT */
+#define MAX_ARGS_KEEPALIVE 32767
+#define MAX_ARGS_KEEPALIVE_PROBES 127
 
 struct users {
     char* name;
@@ -19,6 +39,55 @@ struct socks5args {
 
     bool disectorsEnabled;
 
+    bool uringEnabled;
+
+    /** relay con notificaciones edge-triggered y su presupuesto en bytes */
+    bool edgeTriggered;
+    unsigned relayBudget;
+
+    /** relay con splice(2), sin copiar los datos a espacio de usuario */
+    bool spliceEnabled;
+
+    /** tamaño mínimo de los envíos del relay con MSG_ZEROCOPY, 0 no los usa */
+    unsigned zerocopyThreshold;
+
+    /** tamaño inicial (y mínimo) y máximo de los buffers del relay */
+    unsigned relayBufferMin;
+    unsigned relayBufferMax;
+
+    /** límite en bytes por segundo de las sesiones sin autenticar, 0 sin límite */
+    unsigned rateLimit;
+
+    /** TCP_NOTSENT_LOWAT del relay y bytes pendientes a partir de los que se deja de leer, 0 sin límite */
+    unsigned notsentLowat;
+    unsigned highWatermark;
+
+    /** memoria máxima del slab de sesiones de cada worker, en bytes */
+    unsigned sessionSlabBytes;
+
+    /** cantidad de hilos, cada uno con su propio selector, que atienden socks */
+    unsigned short workers;
+
+    /** resolver los nombres con el cliente DNS de cada worker, en vez de getaddrinfo */
+    bool dnsEnabled;
+    /** entradas del cache de ese cliente, 0 lo deshabilita */
+    unsigned dnsCacheEntries;
+
+    /** hilos que resuelven nombres con getaddrinfo, y resoluciones que pueden esperar uno libre */
+    unsigned resolverThreads;
+    unsigned resolverQueue;
+
+    /** timeouts de las sesiones socks en segundos, 0 los deshabilita */
+    unsigned handshakeTimeout;
+    unsigned connectTimeout;
+    unsigned idleTimeout;
+
+    /** keepalive de los sockets socks en segundos (idle 0 lo deshabilita) y TCP_USER_TIMEOUT en ms */
+    unsigned keepaliveIdle;
+    unsigned keepaliveInterval;
+    unsigned keepaliveCount;
+    unsigned userTimeout;
+
     unsigned short nusers;
     struct users users[MAX_ARGS_USERS];
 };
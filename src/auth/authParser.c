@@ -29,6 +29,8 @@ void initAuthParser(TAuthParser* p, TUserPrivilegeLevel minLevel) {
     p->state = AUTH_VERSION;
     p->readBytes = 0;
     p->verification = AUTH_ACCESS_DENIED;
+    p->uname[0] = '\0';
+    p->passwd[0] = '\0';
 }
 TAuthState authParse(TAuthParser* p, struct buffer* buffer) {
     while (buffer_can_read(buffer) && p->state != AUTH_END) {
@@ -75,6 +77,7 @@ static TAuthState parseUNameByteCount(TAuthParser* p, uint8_t c) {
 static TAuthState parseUsername(TAuthParser* p, uint8_t c) {
     p->uname[p->readBytes++] = c;
     if (p->totalBytes == p->readBytes) {
+        p->uname[p->readBytes] = '\0';
         p->readBytes = 0;
         return AUTH_PLEN;
     }
@@ -91,6 +94,7 @@ static TAuthState parsePasswdByteCount(TAuthParser* p, uint8_t c) {
 static TAuthState parsePassword(TAuthParser* p, uint8_t c) {
     p->passwd[p->readBytes++] = c;
     if (p->totalBytes == p->readBytes) {
+        p->passwd[p->readBytes] = '\0';
         p->readBytes = 0;
         return AUTH_END;
     }
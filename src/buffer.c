@@ -14,21 +14,38 @@ inline void
 buffer_reset(buffer* b) {
     b->read = b->data;
     b->write = b->data;
+    b->count = 0;
 }
 
 void buffer_init(buffer* b, const size_t n, uint8_t* data) {
     b->data = data;
+    b->ring = false;
     buffer_reset(b);
     b->limit = b->data + n;
 }
 
+/** avanza `p' `bytes' posiciones dando la vuelta al llegar a limit */
+static inline uint8_t* ring_adv(const buffer* b, uint8_t* p, const size_t bytes) {
+    const size_t size = b->limit - b->data;
+    return b->data + ((size_t)(p - b->data) + bytes) % size;
+}
+
 inline bool
 buffer_can_write(buffer* b) {
+    if (b->ring) {
+        return b->count < (size_t)(b->limit - b->data);
+    }
     return b->limit - b->write > 0;
 }
 
 inline uint8_t*
 buffer_write_ptr(buffer* b, size_t* nbyte) {
+    if (b->ring) {
+        const size_t free = (b->limit - b->data) - b->count;
+        const size_t contiguous = b->limit - b->write;
+        *nbyte = free < contiguous ? free : contiguous;
+        return b->write;
+    }
     assert(b->write <= b->limit);
     *nbyte = b->limit - b->write;
     return b->write;
@@ -36,11 +53,19 @@ buffer_write_ptr(buffer* b, size_t* nbyte) {
 
 inline bool
 buffer_can_read(buffer* b) {
+    if (b->ring) {
+        return b->count > 0;
+    }
     return b->write - b->read > 0;
 }
 
 inline uint8_t*
 buffer_read_ptr(buffer* b, size_t* nbyte) {
+    if (b->ring) {
+        const size_t contiguous = b->limit - b->read;
+        *nbyte = b->count < contiguous ? b->count : contiguous;
+        return b->read;
+    }
     assert(b->read <= b->write);
     *nbyte = b->write - b->read;
     return b->read;
@@ -49,6 +74,12 @@ buffer_read_ptr(buffer* b, size_t* nbyte) {
 inline void
 buffer_write_adv(buffer* b, const ssize_t bytes) {
     if (bytes > -1) {
+        if (b->ring) {
+            b->count += (size_t)bytes;
+            assert(b->count <= (size_t)(b->limit - b->data));
+            b->write = ring_adv(b, b->write, bytes);
+            return;
+        }
         b->write += (size_t)bytes;
         assert(b->write <= b->limit);
     }
@@ -57,6 +88,14 @@ buffer_write_adv(buffer* b, const ssize_t bytes) {
 inline void
 buffer_read_adv(buffer* b, const ssize_t bytes) {
     if (bytes > -1) {
+        if (b->ring) {
+            buffer_read_adv_nocompact(b, bytes);
+            if (b->count == 0) {
+                // vacío: volver al principio deja todo el espacio contiguo
+                buffer_reset(b);
+            }
+            return;
+        }
         b->read += (size_t)bytes;
         assert(b->read <= b->write);
 
@@ -67,6 +106,65 @@ buffer_read_adv(buffer* b, const ssize_t bytes) {
     }
 }
 
+void buffer_read_adv_nocompact(buffer* b, const ssize_t bytes) {
+    if (bytes > -1) {
+        if (b->ring) {
+            assert((size_t)bytes <= b->count);
+            b->count -= (size_t)bytes;
+            b->read = ring_adv(b, b->read, bytes);
+            return;
+        }
+        b->read += (size_t)bytes;
+        assert(b->read <= b->write);
+    }
+}
+
+int buffer_write_iov(buffer* b, struct iovec iov[2]) {
+    size_t n;
+    iov[0].iov_base = buffer_write_ptr(b, &n);
+    iov[0].iov_len = n;
+    if (n == 0) {
+        return 0;
+    }
+    if (!b->ring || b->write < b->read) {
+        return 1;
+    }
+    // el espacio libre sigue desde el principio hasta R
+    iov[1].iov_base = b->data;
+    iov[1].iov_len = b->read - b->data;
+    return iov[1].iov_len == 0 ? 1 : 2;
+}
+
+int buffer_read_iov(buffer* b, struct iovec iov[2]) {
+    size_t n;
+    iov[0].iov_base = buffer_read_ptr(b, &n);
+    iov[0].iov_len = n;
+    if (n == 0) {
+        return 0;
+    }
+    if (!b->ring || n == b->count) {
+        return 1;
+    }
+    // los datos siguen desde el principio hasta W
+    iov[1].iov_base = b->data;
+    iov[1].iov_len = b->count - n;
+    return 2;
+}
+
+void buffer_set_ring(buffer* b) {
+    if (b->ring) {
+        return;
+    }
+    b->count = b->write - b->read;
+    if (b->count == 0) {
+        b->read = b->data;
+        b->write = b->data;
+    } else if (b->write == b->limit) {
+        b->write = b->data;
+    }
+    b->ring = true;
+}
+
 inline uint8_t
 buffer_read(buffer* b) {
     uint8_t ret;
@@ -88,7 +186,12 @@ buffer_write(buffer* b, uint8_t c) {
 }
 
 void buffer_compact(buffer* b) {
-    if (b->data == b->read) {
+    if (b->ring) {
+        // en modo circular no hace falta mover nada
+        if (b->count == 0) {
+            buffer_reset(b);
+        }
+    } else if (b->data == b->read) {
         // nada por hacer
     } else if (b->read == b->write) {
         b->read = b->data;
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stdint.h> // uint8_t
+#include <sys/uio.h> // struct iovec
 #include <unistd.h> // size_t, ssize_t
 /**
  * buffer.c - buffer con acceso directo (útil para I/O) que mantiene
@@ -80,6 +81,23 @@
  * +---+---+---+---+---+---+
  * ↑                       ↑
  * W=0                     limit=6
+ *
+ * Modo circular (`buffer_set_ring'): R y W dan la vuelta al llegar a limit,
+ * por lo que nunca hace falta compactar. Los datos (y el espacio libre)
+ * pueden quedar partidos en dos segmentos, que se obtienen con
+ * `buffer_read_iov' / `buffer_write_iov' para usar con readv(2) / writev(2).
+ * `buffer_read_ptr' y `buffer_write_ptr' retornan solo el primero.
+ *
+ *        W=2     R=4
+ *         ↓       ↓
+ * +---+---+---+---+---+---+
+ * | L | A |   |   | H | O |
+ * +---+---+---+---+---+---+
+ *                         ↑
+ *                         limit=6
+ *
+ * Invariantes: data <= R, W < limit; count es la cantidad de bytes
+ * (distingue lleno de vacío cuando R == W).
  */
 typedef struct buffer buffer;
 struct buffer {
@@ -93,6 +111,12 @@ struct buffer {
 
     /** puntero de escritura */
     uint8_t* write;
+
+    /** modo circular, ver arriba */
+    bool ring;
+
+    /** bytes para leer, solo en modo circular */
+    size_t count;
 };
 
 /**
@@ -112,6 +136,34 @@ uint8_t*
 buffer_read_ptr(buffer* b, size_t* nbyte);
 void buffer_read_adv(buffer* b, const ssize_t bytes);
 
+/**
+ * igual que `buffer_read_adv' pero nunca compacta. Útil cuando hay una
+ * escritura asincrónica en curso sobre la zona [write, limit) del buffer.
+ */
+void buffer_read_adv_nocompact(buffer* b, const ssize_t bytes);
+
+/**
+ * pasa el buffer a modo circular, conservando los datos que tenga.
+ * No hay vuelta atrás hasta `buffer_init'.
+ */
+void buffer_set_ring(buffer* b);
+
+/**
+ * completa `iov' con los segmentos (a lo sumo dos) donde se puede escribir.
+ * Se debe notificar lo escrito mediante `buffer_write_adv'.
+ *
+ * @return la cantidad de segmentos
+ */
+int buffer_write_iov(buffer* b, struct iovec iov[2]);
+
+/**
+ * completa `iov' con los segmentos (a lo sumo dos) que hay para leer.
+ * Se debe notificar lo leído mediante `buffer_read_adv'.
+ *
+ * @return la cantidad de segmentos
+ */
+int buffer_read_iov(buffer* b, struct iovec iov[2]);
+
 /**
  * obtiene un byte
  */
@@ -20,6 +20,8 @@ static const char* commandsFormat[] = {
     "GET-AUTHENTICATION-STATUS",
     "SET-AUTHENTICATION-STATUS",
     "STATISTICS",
+    "SET-RATE-LIMIT",
+    "CONNECTIONS",
     NULL};
 
 int tcpClientSocket(const char* host, const char* service) {
@@ -150,6 +152,10 @@ bool argsQuantityOk(int command, int argc) {
             return argc >= 3; // Usage: SET-AUTHENTICATION-STATUS <STATUS>
         case CMD_STATS:
             return true; // Usage: STATISTICS
+        case CMD_SET_RATE_LIMIT:
+            return argc >= 6; // Usage: SET-RATE-LIMIT <USER> <BYTES PER SECOND>
+        case CMD_CONNECTIONS:
+            return true; // Usage: CONNECTIONS
         default:
             return false;
     }
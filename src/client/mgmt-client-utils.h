@@ -24,7 +24,9 @@ typedef enum {
     CMD_SET_DISSECTOR_STATUS,
     CMD_GET_AUTHENTICATION_STATUS,
     CMD_SET_AUTHENTICATION_STATUS,
-    CMD_STATS
+    CMD_STATS,
+    CMD_SET_RATE_LIMIT,
+    CMD_CONNECTIONS
 } TCommands;
 
 /**
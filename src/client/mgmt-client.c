@@ -26,6 +26,8 @@ int main(int argc, char* argv[]) {
                 "   GET-AUTHENTICATION-STATUS                 Sends a request to get the status of the sock's authentication level.\n"
                 "   SET-AUTHENTICATION-STATUS [ON/OFF]        Sends a request to set the state of the sock's authentication level.\n"
                 "   STATISTICS                                Sends a request to get specific metrics from the server.\n"
+                "   SET-RATE-LIMIT <username|*> <bytes/s>     Sends a request to limit the bandwidth all of the user's sessions share, both directions together (* for unauthenticated ones, 0 for no limit).\n"
+                "   CONNECTIONS                               Sends a request to list the live socks sessions with their traffic.\n"
                 "\n",
                 argv[0]);
         return 0;
@@ -133,6 +135,12 @@ int main(int argc, char* argv[]) {
         case CMD_STATS:
             status = cmdStats(sock, commandReference);
             break;
+        case CMD_SET_RATE_LIMIT:
+            status = cmdSetRateLimit(sock, commandReference, argv[4], argv[5]);
+            break;
+        case CMD_CONNECTIONS:
+            status = cmdConnections(sock, commandReference);
+            break;
         default:
             return -1;
     }
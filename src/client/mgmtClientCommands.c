@@ -108,6 +108,15 @@ int cmdChangeRole(int sock, int cmdValue, char* username, char* role) {
     return sendUserInfoCmd(sock, cmdValue, username, NULL, role);
 }
 
+int cmdSetRateLimit(int sock, int cmdValue, char* username, char* rate) {
+    // the limit goes as a string, just like a password
+    return sendUserInfoCmd(sock, cmdValue, username, rate, NULL);
+}
+
+int cmdConnections(int sock, int cmdValue) {
+    return sendByte(sock, cmdValue);
+}
+
 int cmdGetDissectorStatus(int sock, int cmdValue) {
     return sendByte(sock, cmdValue);
 }
@@ -103,4 +103,24 @@ int cmdSetAuthenticationStatus(int sock, int cmdValue, char* status);
  */
 int cmdStats(int sock, int cmdValue);
 
+/**
+ * @brief Sends the SET-RATE-LIMIT command to the server
+ *
+ * @param sock the established connection socket
+ * @param cmdValue the value that represents the command in the protocol
+ * @param username the user to limit, or "*" for the sessions that don't authenticate
+ * @param rate the string with the limit in bytes per second, 0 meaning no limit
+ * @return 0 if there are no errors. -1 otherwise.
+ */
+int cmdSetRateLimit(int sock, int cmdValue, char* username, char* rate);
+
+/**
+ * @brief Sends the CONNECTIONS command to the server
+ *
+ * @param sock the established connection socket
+ * @param cmdValue the value that represents the command in the protocol
+ * @return 0 if there are no errors. -1 otherwise.
+ */
+int cmdConnections(int sock, int cmdValue);
+
 #endif
@@ -1,11 +1,20 @@
 // This is a personal academic project. Dear PVS-Studio, please check it.
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // splice(2), pipe2(2), F_GETPIPE_SZ
+#endif
 #include "copy.h"
 #include "logging/logger.h"
 #include "logging/metrics.h"
 #include "socks5.h"
 #include "request/requestParser.h"
+#include "users.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,14 +23,362 @@
 #define CLIENT_NAME "client"
 #define ORIGIN_NAME "origin"
 
+/** capacidad de un pipe si no se puede consultar con F_GETPIPE_SZ */
+#define PIPE_DEFAULT_CAPACITY 65536
+
+/** cantidad máxima de bloques del relay libres que guarda cada hilo */
+#define RELAY_POOL_MAX 64
+
+/** bytes máximos de buffers del relay libres que guarda cada hilo, por tamaño */
+#define RELAY_BUFFER_POOL_BYTES (1024 * 1024)
+
+/** lecturas seguidas que llenan el buffer para duplicarlo */
+#define RELAY_BUFFER_GROW_READS 2
+/** lecturas de menos de un cuarto del buffer para reducirlo a la mitad */
+#define RELAY_BUFFER_SHRINK_READS 32
+
+/** con límite de tasa, no se lee con menos tokens que esto (o que `rate') */
+#define RATE_LIMIT_MIN_READ 4096
+
+/**
+ * motor io_uring del relay, o NULL si se usan notificaciones del selector.
+ * Cada hilo worker tiene su propio selector y por lo tanto su propio motor.
+ */
+static _Thread_local TUring ring = NULL;
+
+/**
+ * modo edge-triggered: cada notificación se consume hasta EAGAIN, sin pasar
+ * de `relayBudget' bytes por despertar. Se configura antes de lanzar los
+ * workers, luego es de solo lectura.
+ */
+static bool edgeTriggered = false;
+static size_t relayBudget = 0;
+
+/**
+ * si es true, el relay mueve los datos con splice(2) a través de un pipe por
+ * sentido, sin copiarlos a espacio de usuario. Solo de lectura una vez lanzados
+ * los workers.
+ */
+static bool spliceEnabled = false;
+
+/**
+ * tamaño mínimo de un envío del relay para hacerlo con MSG_ZEROCOPY, o 0 si
+ * no se usa. Solo de lectura una vez lanzados los workers.
+ */
+static size_t zerocopyThreshold = 0;
+
+/**
+ * bloques del relay libres. Cada hilo worker tiene su propio pool, ya que las
+ * conexiones se crean y se liberan siempre en el hilo de su selector.
+ */
+static _Thread_local TRelay* relayPool = NULL;
+static _Thread_local unsigned relayPoolSize = 0;
+
+/**
+ * tamaño inicial (y mínimo) y máximo de los buffers del relay, potencias de 2.
+ * Solo de lectura una vez lanzados los workers.
+ */
+static size_t relayBufferMin = METRICS_RELAY_BUFFER_MIN;
+static size_t relayBufferMax = 256 * 1024;
+
+/**
+ * control de la latencia de envío: `notsentLowat' es el TCP_NOTSENT_LOWAT de
+ * ambos sockets, y `highWatermark' los bytes pendientes de enviar a partir de
+ * los cuales cada sentido deja de leer. 0 los deshabilita. Solo de lectura una
+ * vez lanzados los workers.
+ */
+static size_t notsentLowat = 0;
+static size_t highWatermark = 0;
+
+/**
+ * buffers del relay libres, uno por tamaño: la clase i tiene los de
+ * METRICS_RELAY_BUFFER_MIN << i bytes. Cada buffer libre guarda al principio
+ * el puntero al siguiente.
+ */
+static _Thread_local uint8_t* relayBufferPool[METRICS_RELAY_BUFFER_CLASSES];
+static _Thread_local unsigned relayBufferPoolSize[METRICS_RELAY_BUFFER_CLASSES];
+
+static void copyUringRecvDone(TUringOp* op, int res);
+static void copyUringSendDone(TUringOp* op, int res);
+static bool copyCanRecv(const TCopy* copy);
+static size_t copyRecvRoom(const TCopy* copy);
+static bool copyCanSend(const TCopy* copy);
+
+void copyUseUring(TUring r) {
+    ring = r;
+}
+
+void copyUseSplice(bool enabled) {
+    spliceEnabled = enabled;
+}
+
+void copyUseZerocopy(size_t threshold) {
+    zerocopyThreshold = threshold;
+}
+
+void copyUseEdgeTriggered(bool enabled, size_t budget) {
+    edgeTriggered = enabled;
+    relayBudget = budget;
+}
+
+void copyUseBufferSizes(size_t min, size_t max) {
+    relayBufferMin = min;
+    relayBufferMax = max;
+}
+
+void copyUseWatermarks(size_t low, size_t high) {
+    notsentLowat = low;
+    highWatermark = high;
+}
+
+static unsigned relayBufferClass(size_t size) {
+    unsigned c = 0;
+    while (((size_t)METRICS_RELAY_BUFFER_MIN << c) < size) {
+        c++;
+    }
+    return c;
+}
+
+/** toma del pool un buffer del relay de `size' bytes, o lo aloca */
+static uint8_t* relayBufferAlloc(size_t size) {
+    unsigned c = relayBufferClass(size);
+    uint8_t* data = relayBufferPool[c];
+    if (data == NULL) {
+        return malloc(size);
+    }
+    memcpy(&relayBufferPool[c], data, sizeof(data));
+    relayBufferPoolSize[c]--;
+    return data;
+}
+
+/** devuelve al pool un buffer del relay de `size' bytes */
+static void relayBufferFree(uint8_t* data, size_t size) {
+    unsigned c = relayBufferClass(size);
+    if ((relayBufferPoolSize[c] + 1) * size > RELAY_BUFFER_POOL_BYTES) {
+        free(data);
+        return;
+    }
+    memcpy(data, &relayBufferPool[c], sizeof(data));
+    relayBufferPool[c] = data;
+    relayBufferPoolSize[c]++;
+}
+
+static size_t bufferSize(const buffer* b) {
+    return b->limit - b->data;
+}
+
+/**
+ * cambia el tamaño de `otherBuffer', donde lee `copy', conservando su
+ * contenido, que debe entrar en `size'. No se puede si el kernel tiene
+ * referencias al buffer: operaciones de io_uring o envíos con MSG_ZEROCOPY.
+ */
+static void copyResize(TCopy* copy, size_t size) {
+    buffer* b = copy->otherBuffer;
+    const TCopy* writer = copy->otherCopy;
+    if (copy->recvOp.callback != NULL || writer->zcNext != writer->zcDone) {
+        return;
+    }
+
+    uint8_t* data = relayBufferAlloc(size);
+    if (data == NULL) {
+        return; // se sigue con el que tiene
+    }
+    // lo pendiente queda al principio del nuevo
+    struct iovec iov[2];
+    int segments = buffer_read_iov(b, iov);
+    size_t n = 0;
+    for (int i = 0; i < segments; i++) {
+        memcpy(data + n, iov[i].iov_base, iov[i].iov_len);
+        n += iov[i].iov_len;
+    }
+
+    size_t oldSize = bufferSize(b);
+    bool ring = b->ring;
+    relayBufferFree(b->data, oldSize);
+    buffer_init(b, size, data);
+    buffer_write_adv(b, n);
+    if (ring) {
+        buffer_set_ring(b);
+    }
+    metricsRegisterRelayBuffer(oldSize, size);
+    logf(LOG_DEBUG, "copyResize: %s %d buffer from %lu to %lu bytes", copy->name, *copy->targetFd, oldSize, size);
+}
+
+/**
+ * luego de leer `readBytes' en `otherBuffer', lo duplica si las lecturas lo
+ * vienen llenando: del otro lado del socket hay más de lo que entra.
+ */
+static void copyGrow(TCopy* copy, size_t readBytes) {
+    size_t size = bufferSize(copy->otherBuffer);
+    if (buffer_can_write(copy->otherBuffer)) {
+        copy->fullReads = 0;
+        if (readBytes < size / 4 && copy->smallReads < RELAY_BUFFER_SHRINK_READS) {
+            copy->smallReads++;
+        }
+        return;
+    }
+    copy->smallReads = 0;
+    if (++copy->fullReads >= RELAY_BUFFER_GROW_READS && size < relayBufferMax) {
+        copy->fullReads = 0;
+        copyResize(copy, size * 2);
+    }
+}
+
+/**
+ * cuando `otherBuffer' queda vacío, lo reduce a la mitad si las últimas
+ * lecturas usaron poco de él: el flujo se calmó.
+ */
+static void copyShrink(TCopy* copy) {
+    size_t size = bufferSize(copy->otherBuffer);
+    if (copy->smallReads < RELAY_BUFFER_SHRINK_READS || size <= relayBufferMin || buffer_can_read(copy->otherBuffer)) {
+        return;
+    }
+    copy->smallReads = 0;
+    copyResize(copy, size / 2);
+}
+
+/** toma el bucket del usuario de la sesión, o el de las anónimas */
+static void copyRateLimitInit(TClientData* data) {
+    TRateLimit* r = &data->relay->connections.rateLimit;
+    r->bucket = usersAcquireRateBucket(data->isAuth ? data->username : NULL);
+    r->throttled = false;
+}
+
+static uint64_t copyRateLimitNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/** con pocos tokens conviene esperar a juntar más que leer de a migajas */
+static size_t copyRateLimitMinRead(size_t rate) {
+    return rate < RATE_LIMIT_MIN_READ ? rate : RATE_LIMIT_MIN_READ;
+}
+
+/**
+ * retorna cuántos bytes se pueden leer: SIZE_MAX si no hay límite, 0 si hay
+ * que esperar. El bucket no guarda tokens sino cuándo va a estar lleno, así
+ * que reponerlos es solo mirar el reloj.
+ */
+static size_t copyRateLimitAvailable(TClientData* data) {
+    TRateBucket* b = data->relay->connections.rateLimit.bucket;
+    size_t rate = b == NULL ? 0 : atomic_load_explicit(&b->rate, memory_order_relaxed);
+    if (rate == 0) {
+        return SIZE_MAX;
+    }
+
+    uint64_t now = copyRateLimitNow();
+    uint64_t full = atomic_load_explicit(&b->full, memory_order_relaxed);
+    double tokens = rate;
+    if (full > now) {
+        tokens = full - now >= 1000000000 ? 0 : (1000000000 - (full - now)) / 1e9 * rate;
+    }
+    return tokens >= copyRateLimitMinRead(rate) ? (size_t)tokens : 0;
+}
+
+/**
+ * deja de leer de ambos fds hasta que se repongan los tokens. El timer del
+ * origen, que no se usa para otra cosa en COPY, avisa cuándo.
+ */
+static void copyRateLimitWait(TCopy* copy) {
+    TRateLimit* r = &copy->clientData->relay->connections.rateLimit;
+    if (r->throttled) {
+        return;
+    }
+    // hay minRead tokens cuando faltan a lo sumo 1s - minRead/rate para
+    // llenarlo. Si recién sacaron el límite desde management, se reintenta ya
+    size_t rate = atomic_load_explicit(&r->bucket->rate, memory_order_relaxed);
+    unsigned ms = 1;
+    if (rate != 0) {
+        uint64_t now = copyRateLimitNow();
+        uint64_t ready = atomic_load_explicit(&r->bucket->full, memory_order_relaxed) + (uint64_t)(copyRateLimitMinRead(rate) * 1e9 / rate);
+        if (ready > now + 1000000000) {
+            ms = (unsigned)((ready - now - 1000000000) / 1000000) + 1;
+        }
+    }
+    r->throttled = true;
+    selector_add_timer(copy->s, copy->clientData->originFd, ms);
+    logf(LOG_DEBUG, "copyRateLimitWait: client %d throttled for %u ms", copy->clientData->clientFd, ms);
+}
+
+/**
+ * saca los bytes leídos del bucket. Otras sesiones pueden haber leído a la
+ * vez con los mismos tokens: la deuda corre `full' más allá de un segundo y
+ * las demora a todas hasta pagarla.
+ */
+static void copyRateLimitConsume(TClientData* data, size_t bytes) {
+    TRateBucket* b = data->relay->connections.rateLimit.bucket;
+    size_t rate = b == NULL ? 0 : atomic_load_explicit(&b->rate, memory_order_relaxed);
+    if (rate == 0) {
+        return;
+    }
+    uint64_t now = copyRateLimitNow();
+    uint64_t cost = (uint64_t)(bytes * 1e9 / rate);
+    uint64_t full = atomic_load_explicit(&b->full, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&b->full, &full, (full > now ? full : now) + cost, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+/**
+ * Prepara en io_uring las operaciones que la copia puede hacer. Los fds quedan
+ * sin intereses en el selector.
+ */
+static TFdInterests armUringOps(TCopy* copy) {
+    TFdInterests ret = OP_NOOP;
+    size_t capacity;
+    int targetFd = *copy->targetFd;
+    bool queued = true;
+
+    if ((copy->duplex & OP_READ) && copyCanRecv(copy)) {
+        ret |= OP_READ;
+        if (!copy->recvOp.pending) {
+            size_t available = copyRateLimitAvailable(copy->clientData);
+            if (available == 0) {
+                copyRateLimitWait(copy);
+            } else {
+                size_t room = copyRecvRoom(copy);
+                if (room < available) {
+                    available = room;
+                }
+                uint8_t* writePtr = buffer_write_ptr(copy->otherBuffer, &capacity);
+                queued = uring_recv(ring, &copy->recvOp, targetFd, writePtr, capacity < available ? capacity : available, copy->uringBuffer);
+            }
+        }
+    }
+    if (queued && (copy->duplex & OP_WRITE) && buffer_can_read(copy->targetBUffer)) {
+        ret |= OP_WRITE;
+        if (!copy->sendOp.pending) {
+            uint8_t* readPtr = buffer_read_ptr(copy->targetBUffer, &capacity);
+            queued = uring_send(ring, &copy->sendOp, targetFd, readPtr, capacity);
+        }
+    }
+
+    if (!queued) {
+        // sin lugar en la submission queue no hay forma de avanzar: cortamos
+        logf(LOG_ERROR, "io_uring submission queue full, closing %s %d", copy->name, targetFd);
+        copy->duplex = OP_NOOP;
+        *copy->otherDuplex = OP_NOOP;
+        return OP_NOOP;
+    }
+    return ret;
+}
+
 static TFdInterests getInterests(TSelector s, TCopy* copy) {
+    if (copy->recvOp.callback != NULL) {
+        return armUringOps(copy);
+    }
+
     TFdInterests ret = OP_NOOP;
-    if ((copy->duplex & OP_READ) && buffer_can_write(copy->otherBuffer)) {
+    if ((copy->duplex & OP_READ) && copyCanRecv(copy)) {
         ret |= OP_READ;
     }
-    if ((copy->duplex & OP_WRITE) && buffer_can_read(copy->targetBUffer)) {
+    if ((copy->duplex & OP_WRITE) && copyCanSend(copy)) {
         ret |= OP_WRITE;
     }
+    if (copy->zcNext != copy->zcDone) {
+        // hasta que lleguen las notificaciones no se puede reutilizar el buffer
+        ret |= OP_ERROR;
+    }
     if (SELECTOR_SUCCESS != selector_set_interest(s, *copy->targetFd, ret)) {
         logf(LOG_DEBUG, "Selector returned error when setting interests on fd %d", *copy->targetFd);
         abort();
@@ -29,41 +386,234 @@ static TFdInterests getInterests(TSelector s, TCopy* copy) {
     return ret;
 }
 
-static unsigned copyReadHandler(TClientData* clientData, TCopy* copy) {
-    int targetFd = *copy->targetFd;
-    int otherFd = *copy->otherFd;
-    TSelector s = copy->s;
-    buffer* otherBuffer = copy->otherBuffer;
+/** actualiza los intereses de ambas copias y calcula el estado resultante */
+static unsigned copyUpdate(TCopy* copy) {
+    getInterests(copy->s, copy);
+    getInterests(copy->s, copy->otherCopy);
+    // al cerrar el socket el kernel puede seguir retransmitiendo desde los
+    // buffers enviados con MSG_ZEROCOPY: se espera a que los libere
+    if (copy->duplex == OP_NOOP && copy->zcNext == copy->zcDone && copy->otherCopy->zcNext == copy->otherCopy->zcDone) {
+        return DONE;
+    }
+    return COPY;
+}
 
-    logf(LOG_DEBUG, "copyReadHandler: Reading from fd %s %d", copy->name, targetFd);
+/** bytes leídos de `targetFd' que todavía no se enviaron al otro fd */
+static size_t copyQueued(const TCopy* copy) {
+    if (copy->pipe[0] != -1) {
+        return copy->pipeBytes;
+    }
+    struct iovec iov[2];
+    int segments = buffer_read_iov(copy->otherBuffer, iov);
+    size_t n = 0;
+    for (int i = 0; i < segments; i++) {
+        n += iov[i].iov_len;
+    }
+    return n;
+}
+
+/**
+ * cuántos bytes se pueden leer de `targetFd' sin pasar el high watermark, o
+ * SIZE_MAX si no hay.
+ */
+static size_t copyRecvRoom(const TCopy* copy) {
+    if (highWatermark == 0) {
+        return SIZE_MAX;
+    }
+    size_t queued = copyQueued(copy);
+    return queued < highWatermark ? highWatermark - queued : 0;
+}
+
+/**
+ * hay lugar para leer de `targetFd', tokens si la sesión tiene límite, y lo
+ * pendiente de enviar no llega al high watermark: si el otro extremo es lento
+ * se deja de leer antes de llenar el buffer, para no encolar detrás de
+ * megabytes lo que se lea después.
+ */
+static bool copyCanRecv(const TCopy* copy) {
+    if (copy->clientData->relay->connections.rateLimit.throttled) {
+        return false;
+    }
+    if (copyRecvRoom(copy) == 0) {
+        return false;
+    }
+    if (copy->pipe[0] != -1) {
+        return !copy->pipeFull && copy->pipeBytes < copy->pipeCapacity;
+    }
+    return buffer_can_write(copy->otherBuffer);
+}
+
+/** hay datos para escribir en `targetFd' */
+static bool copyCanSend(const TCopy* copy) {
+    const TCopy* source = copy->otherCopy;
+    if (source->pipe[0] != -1) {
+        return source->pipeBytes > 0;
+    }
+    return buffer_can_read(copy->targetBUffer);
+}
+
+/** recorta los `n' segmentos de `iov' para que sumen a lo sumo `limit' bytes */
+static size_t iovClip(struct iovec* iov, int n, size_t limit) {
+    for (int i = 0; i < n; i++) {
+        if (iov[i].iov_len >= limit) {
+            iov[i].iov_len = limit;
+            return i + 1;
+        }
+        limit -= iov[i].iov_len;
+    }
+    return n;
+}
+
+/**
+ * lee de `targetFd' a lo sumo `limit' bytes, hacia `otherBuffer' o, si la
+ * copia usa splice(2), hacia su pipe sin pasar por espacio de usuario.
+ */
+static ssize_t copyRecv(TCopy* copy, size_t limit) {
     size_t capacity;
-    size_t remaining;
+    if (copy->pipe[0] != -1) {
+        capacity = copy->pipeCapacity - copy->pipeBytes;
+        ssize_t n = splice(*copy->targetFd, NULL, copy->pipe[1], NULL, capacity < limit ? capacity : limit, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        // el pipe se llena por páginas, no por bytes: puede no aceptar más
+        // antes de `pipeCapacity'. Como no se sabe si el EAGAIN es del pipe
+        // o del socket, se deja de leer hasta que la otra copia lo vacíe
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && copy->pipeBytes > 0) {
+            copy->pipeFull = true;
+        }
+        return n;
+    }
+    struct iovec iov[2];
+    struct msghdr msg = {.msg_iov = iov};
+    msg.msg_iovlen = iovClip(iov, buffer_write_iov(copy->otherBuffer, iov), limit);
+    return recvmsg(*copy->targetFd, &msg, 0);
+}
 
-    if (!buffer_can_write(otherBuffer)) {
-        return COPY;
+/**
+ * escribe en `targetFd' a lo sumo `limit' bytes, desde `targetBuffer' o
+ * desde el pipe de la otra copia. En `pending' deja cuánto había para enviar.
+ */
+static ssize_t copySend(TCopy* copy, size_t limit, size_t* pending) {
+    const TCopy* source = copy->otherCopy;
+    if (source->pipe[0] != -1) {
+        *pending = source->pipeBytes;
+        return splice(source->pipe[0], NULL, *copy->targetFd, NULL, *pending < limit ? *pending : limit, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    }
+    // sendmsg(2) en lugar de writev(2) para poder pasar MSG_NOSIGNAL
+    struct iovec iov[2];
+    struct msghdr msg = {.msg_iov = iov};
+    int segments = buffer_read_iov(copy->targetBUffer, iov);
+    *pending = 0;
+    for (int i = 0; i < segments; i++) {
+        *pending += iov[i].iov_len;
+    }
+    msg.msg_iovlen = iovClip(iov, segments, limit);
+    size_t len = *pending < limit ? *pending : limit;
+    bool zerocopy = copy->zerocopy && len >= zerocopyThreshold && copy->zcNext - copy->zcDone < COPY_ZEROCOPY_INFLIGHT;
+    ssize_t n = sendmsg(*copy->targetFd, &msg, zerocopy ? MSG_NOSIGNAL | MSG_ZEROCOPY : MSG_NOSIGNAL);
+    if (n < 0 && zerocopy && errno == ENOBUFS) {
+        // no se pudieron fijar las páginas (ej: límite de optmem): se copian
+        zerocopy = false;
+        n = sendmsg(*copy->targetFd, &msg, MSG_NOSIGNAL);
+    }
+    if (n > 0 && zerocopy) {
+        copy->zcBytes[copy->zcNext % COPY_ZEROCOPY_INFLIGHT] = (uint32_t)n;
+        copy->zcNext++;
+    }
+    return n;
+}
+
+/**
+ * procesa las notificaciones de MSG_ZEROCOPY de `targetFd'. Cuando el kernel
+ * liberó todos los envíos, `targetBuffer' se puede volver a compactar.
+ */
+static void copyZerocopyReap(TCopy* copy) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + CMSG_SPACE(sizeof(struct sockaddr_in6))];
+
+    while (true) {
+        struct msghdr msg = {
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        if (recvmsg(*copy->targetFd, &msg, MSG_ERRQUEUE) == -1) {
+            break; // EAGAIN: no hay más
+        }
+
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            const struct sock_extended_err* err = (const struct sock_extended_err*)CMSG_DATA(cm);
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            // cada notificación cubre el rango de envíos [ee_info, ee_data]
+            size_t bytes = 0;
+            for (uint32_t i = err->ee_info; i != err->ee_data + 1; i++) {
+                bytes += copy->zcBytes[i % COPY_ZEROCOPY_INFLIGHT];
+                copy->zcDone++;
+            }
+            metricsRegisterZerocopy(bytes, err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+            logf(LOG_DEBUG, "copyZerocopyReap: %s %d released %lu bytes [%u in flight]", copy->name, *copy->targetFd, bytes, copy->zcNext - copy->zcDone);
+        }
     }
 
-    u_int8_t* writePtr = buffer_write_ptr(otherBuffer, &(capacity));
+    if (copy->zcNext == copy->zcDone) {
+        buffer_compact(copy->targetBUffer);
+    }
+}
 
-    ssize_t readBytes = recv(targetFd, writePtr, capacity, 0);
+/**
+ * el kernel declaró muerto al peer de `targetFd' (keepalive o TCP_USER_TIMEOUT
+ * sin respuesta): el otro sentido ya no tiene a quién entregarle los datos, así
+ * que se cierra toda la sesión.
+ */
+static void copyPeerDead(TCopy* copy) {
+    logf(LOG_INFO, "copy: %s %d of client %d timed out, reclaiming the session", copy->name, *copy->targetFd, copy->clientData->clientFd);
+    copy->duplex = OP_NOOP;
+    *copy->otherDuplex = OP_NOOP;
+    metricsRegisterSessionReclaimed();
+}
+
+/** procesa el resultado de un recv() de `targetFd' sobre `otherBuffer' */
+static void copyReadDone(TClientData* clientData, TCopy* copy, ssize_t readBytes) {
+    int targetFd = *copy->targetFd;
+    int otherFd = *copy->otherFd;
+    buffer* otherBuffer = copy->otherBuffer;
+    size_t remaining;
 
     if (readBytes > 0) {
+        copyRateLimitConsume(clientData, readBytes);
+    }
+
+    if (readBytes > 0 && copy->pipe[0] != -1) {
+        socksv5ArmTimeout(copy->s, clientData, SOCKS_TIMEOUT_IDLE);
+        copy->pipeBytes += readBytes;
+        logf(LOG_DEBUG, "copyReadHandler: splice() %ld bytes from %s %d (%lu bytes in pipe)", readBytes, copy->name, targetFd, copy->pipeBytes);
+    }
+
+    else if (readBytes > 0) {
+        socksv5ArmTimeout(copy->s, clientData, SOCKS_TIMEOUT_IDLE);
         buffer_write_adv(otherBuffer, readBytes);
         buffer_write_ptr(otherBuffer, &(remaining));
         logf(LOG_DEBUG, "copyReadHandler: recv() %ld bytes from %s %d (remaining buffer capacity %lu)", readBytes, copy->name, targetFd, remaining);
 
-        if (clientData->pDissector.isOn) {
-            TPDStatus r = parseUserData(&clientData->pDissector, otherBuffer, targetFd);
-            TPDissector p = clientData->pDissector;
+        TPDissector* p = clientData->relay->pDissector;
+        if (p != NULL && p->isOn) {
+            TPDStatus r = parseUserData(p, otherBuffer, targetFd);
             if(r==PDS_END){
                 if(clientData->isAuth){
-                    logf(LOG_OUTPUT, "%s\tP\tPOP3\t%s\t%s\t%s\t", clientData->username, reqParserToString(&clientData->client.reqParser), p.username, p.password);
+                    logf(LOG_OUTPUT, "%s\tP\tPOP3\t%s\t%s\t%s\t", clientData->username, reqParserToString(&clientData->client.reqParser), p->username, p->password);
                 }else{
-                    logf(LOG_OUTPUT, "(fd %d)\tP\tPOP3\t%s\t%s\t%s\t", targetFd, reqParserToString(&clientData->client.reqParser), p.username, p.password);
+                    logf(LOG_OUTPUT, "(fd %d)\tP\tPOP3\t%s\t%s\t%s\t", targetFd, reqParserToString(&clientData->client.reqParser), p->username, p->password);
                 }
                 
             }
         }
+        copyGrow(copy, readBytes);
+    }
+
+    else if (readBytes < 0 && errno == ETIMEDOUT) {
+        copyPeerDead(copy);
     }
 
     else { // EOF or err
@@ -75,30 +625,16 @@ static unsigned copyReadHandler(TClientData* clientData, TCopy* copy) {
             *(copy->otherDuplex) &= ~OP_WRITE;
         }
     }
-
-    getInterests(s, copy);
-    getInterests(s, copy->otherCopy);
-    if (copy->duplex == OP_NOOP) {
-        return DONE;
-    }
-    return COPY;
 }
 
-static unsigned copyWriteHandler(TCopy* copy, bool isClientCopy) {
+/** procesa el resultado de un send() de `targetBuffer' a `targetFd' */
+static void copyWriteDone(TCopy* copy, bool isClientCopy, ssize_t sent, size_t capacity) {
     int targetFd = *copy->targetFd;
-    TSelector s = copy->s;
     buffer* targetBuffer = copy->targetBUffer;
 
-    logf(LOG_DEBUG, "copyWriteHandler: Writing to fd %s %d", copy->name, targetFd);
-
-    size_t capacity;
-    ssize_t sent;
-    if (!buffer_can_read(targetBuffer)) {
-        return COPY;
-    }
-    uint8_t* readPtr = buffer_read_ptr(targetBuffer, &(capacity));
-    sent = send(targetFd, readPtr, capacity, MSG_NOSIGNAL);
-    if (sent <= 0) {
+    if (sent < 0 && errno == ETIMEDOUT) {
+        copyPeerDead(copy);
+    } else if (sent <= 0) {
         logf(LOG_DEBUG, "copyWriteHandler: send() returned %ld, closing %s %d", sent, copy->name, targetFd);
         shutdown(*(copy->targetFd), SHUT_WR);
         copy->duplex &= ~OP_WRITE;
@@ -107,8 +643,22 @@ static unsigned copyWriteHandler(TCopy* copy, bool isClientCopy) {
             *(copy->otherDuplex) &= ~OP_READ;
         }
     } else {
-        buffer_read_adv(targetBuffer, sent);
+        socksv5ArmTimeout(copy->s, copy->clientData, SOCKS_TIMEOUT_IDLE);
+        if (copy->otherCopy->pipe[0] != -1) {
+            copy->otherCopy->pipeBytes -= sent;
+            copy->otherCopy->pipeFull = false;
+        } else if (copy->otherCopy->recvOp.pending || copy->zcNext != copy->zcDone) {
+            // el kernel está escribiendo al final de este buffer, o todavía
+            // lee de lo ya enviado: no se puede mover
+            buffer_read_adv_nocompact(targetBuffer, sent);
+        } else {
+            buffer_read_adv(targetBuffer, sent);
+            copyShrink(copy->otherCopy);
+        }
 
+        // un único hilo escribe cada contador: alcanza con load y store
+        atomic_size_t* counter = isClientCopy ? &copy->clientData->bytesToClient : &copy->clientData->bytesToOrigin;
+        atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + sent, memory_order_relaxed);
         if (isClientCopy)
             metricsRegisterBytesTransfered(0, sent);
         else
@@ -116,17 +666,371 @@ static unsigned copyWriteHandler(TCopy* copy, bool isClientCopy) {
     }
 
     logf(LOG_DEBUG, "copyWriteHandler: send() %ld bytes to %s %d [%lu remaining]", sent, copy->name, targetFd, capacity - sent);
-    getInterests(s, copy);
-    getInterests(s, copy->otherCopy);
-    if (copy->duplex == OP_NOOP) {
-        return DONE;
+}
+
+/**
+ * escribe en `targetFd' lo que haya en `targetBuffer', sin actualizar los
+ * intereses: si queda algo pendiente lo hace `copyUpdate'.
+ */
+static void copyWrite(TCopy* copy, bool isClientCopy) {
+    int targetFd = *copy->targetFd;
+
+    logf(LOG_DEBUG, "copyWriteHandler: Writing to fd %s %d", copy->name, targetFd);
+
+    size_t capacity;
+    ssize_t sent;
+    if (!(copy->duplex & OP_WRITE) || !copyCanSend(copy)) {
+        return;
+    }
+    if (!edgeTriggered) {
+        sent = copySend(copy, SIZE_MAX, &capacity);
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        copyWriteDone(copy, isClientCopy, sent, capacity);
+        return;
+    }
+
+    // hasta EAGAIN o vaciar el buffer
+    size_t budget = relayBudget;
+    while ((copy->duplex & OP_WRITE) && copyCanSend(copy)) {
+        if (budget == 0) {
+            selector_yield(copy->s, targetFd);
+            break;
+        }
+
+        sent = copySend(copy, budget, &capacity);
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+
+        copyWriteDone(copy, isClientCopy, sent, capacity);
+        if (sent <= 0) {
+            break;
+        }
+        budget -= sent;
+    }
+}
+
+/**
+ * reenvía en el momento lo recién leído por `copy', en lugar de esperar a que
+ * el selector informe que el otro fd se puede escribir: OP_WRITE solo queda
+ * pedido si el envío no salió completo.
+ */
+static void copyWriteThrough(TClientData* clientData, TCopy* copy) {
+    TCopy* other = copy->otherCopy;
+    copyWrite(other, other == &clientData->relay->connections.clientCopy);
+}
+
+static unsigned copyReadHandler(TClientData* clientData, TCopy* copy) {
+    int targetFd = *copy->targetFd;
+
+    logf(LOG_DEBUG, "copyReadHandler: Reading from fd %s %d", copy->name, targetFd);
+
+    if (!copyCanRecv(copy)) {
+        return COPY;
+    }
+
+    size_t available = copyRateLimitAvailable(clientData);
+    if (available == 0) {
+        copyRateLimitWait(copy);
+        return copyUpdate(copy);
+    }
+
+    if (!edgeTriggered) {
+        size_t room = copyRecvRoom(copy);
+        ssize_t readBytes = copyRecv(copy, room < available ? room : available);
+        if (readBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return COPY;
+        }
+
+        copyReadDone(clientData, copy, readBytes);
+        if (readBytes > 0) {
+            copyWriteThrough(clientData, copy);
+        }
+        return copyUpdate(copy);
+    }
+
+    // hasta EAGAIN o llenar el buffer; en ambos casos va a haber una nueva
+    // notificación (al llegar datos o al volver a pedir OP_READ)
+    size_t budget = relayBudget;
+    while ((copy->duplex & OP_READ) && copyCanRecv(copy)) {
+        if (budget == 0) {
+            selector_yield(copy->s, targetFd);
+            break;
+        }
+        if (available == 0) {
+            // se vuelve a leer al vencer el timer, que despacha ambos fds
+            copyRateLimitWait(copy);
+            break;
+        }
+
+        size_t limit = copyRecvRoom(copy);
+        if (available < limit) {
+            limit = available;
+        }
+        if (budget < limit) {
+            limit = budget;
+        }
+        ssize_t readBytes = copyRecv(copy, limit);
+        if (readBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (readBytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        copyReadDone(clientData, copy, readBytes);
+        if (readBytes <= 0) {
+            break;
+        }
+        // además de la latencia, libera lugar para seguir leyendo
+        copyWriteThrough(clientData, copy);
+        budget -= readBytes;
+        available = copyRateLimitAvailable(clientData);
+    }
+    return copyUpdate(copy);
+}
+
+static unsigned copyWriteHandler(TCopy* copy, bool isClientCopy) {
+    copyWrite(copy, isClientCopy);
+    return copyUpdate(copy);
+}
+
+static bool copyUringPending(const TClientData* clientData) {
+    if (clientData->relay == NULL) {
+        return false;
+    }
+    const TConnection* c = &clientData->relay->connections;
+    return c->clientCopy.recvOp.pending || c->clientCopy.sendOp.pending || c->originCopy.recvOp.pending || c->originCopy.sendOp.pending;
+}
+
+/**
+ * Continúa una copia luego de una completion. Si la conexión ya fue cerrada,
+ * la última completion en llegar libera los recursos.
+ */
+static void copyUringContinue(TCopy* copy) {
+    TClientData* clientData = copy->clientData;
+    if (clientData->closed) {
+        if (!copyUringPending(clientData)) {
+            releaseClientData(clientData);
+        }
+        return;
+    }
+
+    if (copyUpdate(copy) == DONE) {
+        TSelectorKey key = {
+            .s = copy->s,
+            .fd = clientData->clientFd,
+            .data = clientData,
+        };
+        closeConnection(&key);
+    }
+}
+
+static void copyUringRecvDone(TUringOp* op, int res) {
+    TCopy* copy = op->data;
+    if (!copy->clientData->closed) {
+        if (res == -EAGAIN || res == -EINTR) {
+            // nada leído, se vuelve a preparar
+            logf(LOG_DEBUG, "copyReadHandler: recv() from %s %d interrupted, retrying", copy->name, *copy->targetFd);
+        } else {
+            if (res < 0) {
+                errno = -res;
+            }
+            copyReadDone(copy->clientData, copy, res);
+        }
+    }
+    copyUringContinue(copy);
+}
+
+static void copyUringSendDone(TUringOp* op, int res) {
+    TCopy* copy = op->data;
+    if (!copy->clientData->closed) {
+        if (res == -EAGAIN || res == -EINTR) {
+            logf(LOG_DEBUG, "copyWriteHandler: send() to %s %d interrupted, retrying", copy->name, *copy->targetFd);
+        } else {
+            size_t capacity;
+            buffer_read_ptr(copy->targetBUffer, &capacity);
+            if (res < 0) {
+                errno = -res;
+            }
+            copyWriteDone(copy, copy == &copy->clientData->relay->connections.clientCopy, res, capacity);
+        }
+    }
+    copyUringContinue(copy);
+}
+
+bool copyUringRelease(TClientData* clientData) {
+    if (clientData->relay != NULL) {
+        TConnection* connections = &clientData->relay->connections;
+        TCopy* copies[] = {&connections->clientCopy, &connections->originCopy};
+        for (size_t i = 0; i < N(copies); i++) {
+            if (copies[i]->uringBuffer >= 0) {
+                uring_unregister_buffer(ring, copies[i]->uringBuffer);
+                copies[i]->uringBuffer = -1;
+            }
+        }
+    }
+    if (ring == NULL || !copyUringPending(clientData)) {
+        return false;
+    }
+
+    // cerrar el fd no cancela las operaciones en vuelo, el shutdown sí las despierta
+    shutdown(clientData->clientFd, SHUT_RDWR);
+    if (clientData->originFd != -1) {
+        shutdown(clientData->originFd, SHUT_RDWR);
+    }
+    return true;
+}
+
+/** pasa los sockets de la conexión al motor io_uring */
+static void copyUringInit(TClientData* data) {
+    TConnection* connections = &data->relay->connections;
+    TCopy* copies[] = {&connections->clientCopy, &connections->originCopy};
+
+    for (size_t i = 0; i < N(copies); i++) {
+        TCopy* copy = copies[i];
+        // cada copia recibe en su `otherBuffer'
+        copy->uringBuffer = uring_register_buffer(ring, copy->otherBuffer->data, bufferSize(copy->otherBuffer));
+        copy->recvOp = (TUringOp){.callback = copyUringRecvDone, .data = copy};
+        copy->sendOp = (TUringOp){.callback = copyUringSendDone, .data = copy};
+
+        // io_uring espera por los sockets sin bloquear el hilo; en modo
+        // O_NONBLOCK las lecturas sobre buffers registrados fallarían con EAGAIN
+        int flags = fcntl(*copy->targetFd, F_GETFL, 0);
+        if (flags != -1) {
+            fcntl(*copy->targetFd, F_SETFL, flags & ~O_NONBLOCK);
+        }
+        selector_set_interest(copy->s, *copy->targetFd, OP_NOOP);
+    }
+
+    copyUpdate(&connections->clientCopy);
+}
+
+/** pasa el contenido de `b' a `data', de `size' bytes, y lo usa desde ahora */
+static void copyMoveBuffer(buffer* b, uint8_t* data, size_t size) {
+    size_t n;
+    uint8_t* ptr = buffer_read_ptr(b, &n);
+    memcpy(data, ptr, n);
+    buffer_init(b, size, data);
+    buffer_write_adv(b, n);
+    metricsRegisterRelayBuffer(0, size);
+}
+
+bool copyRelayAcquire(TClientData* clientData) {
+    // io_uring no puede cambiar de buffer con una lectura en vuelo
+    size_t size = ring != NULL ? BUFFER_SIZE : relayBufferMin;
+    uint8_t* clientBuffer = relayBufferAlloc(size);
+    uint8_t* originBuffer = relayBufferAlloc(size);
+    TRelay* relay = relayPool;
+    if (relay != NULL) {
+        relayPool = relay->next;
+        relayPoolSize--;
+    } else {
+        relay = malloc(sizeof(*relay));
+    }
+    if (relay == NULL || clientBuffer == NULL || originBuffer == NULL) {
+        logf(LOG_ERROR, "copyRelayAcquire: no memory for the relay of client %d", clientData->clientFd);
+        free(relay);
+        free(clientBuffer);
+        free(originBuffer);
+        return false;
+    }
+    memset(&relay->connections, 0, sizeof(relay->connections));
+    relay->pDissector = NULL;
+    relay->connections.clientCopy.uringBuffer = -1;
+    relay->connections.originCopy.uringBuffer = -1;
+    clientData->relay = relay;
+
+    copyMoveBuffer(&clientData->clientBuffer, clientBuffer, size);
+    copyMoveBuffer(&clientData->originBuffer, originBuffer, size);
+    return true;
+}
+
+void copyRelayRelease(TClientData* clientData) {
+    TRelay* relay = clientData->relay;
+    if (relay == NULL) {
+        return;
+    }
+    clientData->relay = NULL;
+    free(relay->pDissector);
+    if (relay->connections.rateLimit.bucket != NULL) {
+        usersReleaseRateBucket(relay->connections.rateLimit.bucket);
+    }
+    relay->pDissector = NULL;
+
+    buffer* buffers[] = {&clientData->clientBuffer, &clientData->originBuffer};
+    for (size_t i = 0; i < N(buffers); i++) {
+        metricsRegisterRelayBuffer(bufferSize(buffers[i]), 0);
+        relayBufferFree(buffers[i]->data, bufferSize(buffers[i]));
+    }
+
+    if (relayPoolSize >= RELAY_POOL_MAX) {
+        free(relay);
+        return;
+    }
+    relay->next = relayPool;
+    relayPool = relay;
+    relayPoolSize++;
+}
+
+void copyRelayPoolDestroy(void) {
+    while (relayPool != NULL) {
+        TRelay* next = relayPool->next;
+        free(relayPool);
+        relayPool = next;
+    }
+    relayPoolSize = 0;
+
+    for (unsigned c = 0; c < METRICS_RELAY_BUFFER_CLASSES; c++) {
+        while (relayBufferPool[c] != NULL) {
+            uint8_t* data = relayBufferPool[c];
+            memcpy(&relayBufferPool[c], data, sizeof(data));
+            free(data);
+        }
+        relayBufferPoolSize[c] = 0;
+    }
+}
+
+/** habilita MSG_ZEROCOPY en `targetFd' */
+static bool copyZerocopyInit(TCopy* copy) {
+    int one = 1;
+    if (setsockopt(*copy->targetFd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == -1) {
+        logf(LOG_DEBUG, "copyZerocopyInit: SO_ZEROCOPY not supported on %s %d, copying", copy->name, *copy->targetFd);
+        return false;
+    }
+    return true;
+}
+
+/** crea el pipe por el que `copy' mueve lo que lee de `targetFd' */
+static bool copyPipeInit(TCopy* copy) {
+    if (pipe2(copy->pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        copy->pipe[0] = copy->pipe[1] = -1;
+        return false;
+    }
+    int size = fcntl(copy->pipe[0], F_GETPIPE_SZ);
+    copy->pipeCapacity = size > 0 ? (size_t)size : PIPE_DEFAULT_CAPACITY;
+    copy->pipeBytes = 0;
+    copy->pipeFull = false;
+    return true;
+}
+
+static void copyPipeClose(TCopy* copy) {
+    for (int i = 0; i < 2; i++) {
+        if (copy->pipe[i] != -1) {
+            close(copy->pipe[i]);
+            copy->pipe[i] = -1;
+        }
     }
-    return COPY;
 }
 
 void socksv5HandleInit(const unsigned int st, TSelectorKey* key) {
     TClientData* data = ATTACHMENT(key);
-    TConnection* connections = &(data->connections);
+    TConnection* connections = &(data->relay->connections);
     int* clientFd = &data->clientFd;
     int* originFd = &data->originFd;
     TCopy* clientCopy = &(connections->clientCopy);
@@ -151,15 +1055,72 @@ void socksv5HandleInit(const unsigned int st, TSelectorKey* key) {
 
     clientCopy->otherDuplex = &(originCopy->duplex);
     clientCopy->otherCopy = &(connections->originCopy);
+    clientCopy->clientData = data;
     originCopy->otherDuplex = &(clientCopy->duplex);
     originCopy->otherCopy = &(connections->clientCopy);
+    originCopy->clientData = data;
+
+    socksv5ArmTimeout(key->s, data, SOCKS_TIMEOUT_IDLE);
+    copyRateLimitInit(data);
+    if (notsentLowat > 0) {
+        // el kernel solo avisa que se puede escribir cuando queda menos que
+        // esto sin enviar, y lo demás espera en los buffers del relay
+        int lowat = (int)notsentLowat;
+        if (setsockopt(*clientFd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) < 0 || setsockopt(*originFd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) < 0) {
+            logf(LOG_DEBUG, "socksv5HandleInit: could not set TCP_NOTSENT_LOWAT for client %d", *clientFd);
+        }
+    }
+    // el estado del disector solo se reserva para las sesiones a las que aplica
+    if (data->client.reqParser.port == POP3_DEFAULT_PORT && isPDissectorOn()) {
+        data->relay->pDissector = malloc(sizeof(TPDissector));
+        if (data->relay->pDissector == NULL) {
+            logf(LOG_ERROR, "socksv5HandleInit: no memory for the password dissector of client %d", *clientFd);
+        }
+        initPDissector(data->relay->pDissector, data->client.reqParser.port, data->clientFd, data->originFd);
+    }
+
+    clientCopy->pipe[0] = clientCopy->pipe[1] = -1;
+    originCopy->pipe[0] = originCopy->pipe[1] = -1;
+    clientCopy->zerocopy = originCopy->zerocopy = false;
+    clientCopy->zcNext = clientCopy->zcDone = 0;
+    originCopy->zcNext = originCopy->zcDone = 0;
 
-    initPDissector(&data->pDissector, data->client.reqParser.port, data->clientFd, data->originFd);
+    if (ring != NULL) {
+        copyUringInit(data);
+        return;
+    }
+    // el disector necesita ver los datos, y lo que haya quedado en los buffers
+    // de los estados anteriores se tiene que enviar desde ahí
+    if (spliceEnabled && data->relay->pDissector == NULL && !buffer_can_read(&data->clientBuffer) && !buffer_can_read(&data->originBuffer)) {
+        if (!copyPipeInit(clientCopy) || !copyPipeInit(originCopy)) {
+            logf(LOG_ERROR, "socksv5HandleInit: could not create splice pipes for client %d, relaying through userspace", *clientFd);
+            copyPipeClose(clientCopy);
+            copyPipeClose(originCopy);
+        }
+    }
+    if (zerocopyThreshold > 0 && clientCopy->pipe[0] == -1) {
+        clientCopy->zerocopy = copyZerocopyInit(clientCopy);
+        originCopy->zerocopy = copyZerocopyInit(originCopy);
+    }
+    if (clientCopy->pipe[0] == -1) {
+        // los que se envían con MSG_ZEROCOPY no pueden reutilizar lo enviado
+        // hasta que llegue la notificación, y la vuelta lo haría
+        if (!clientCopy->zerocopy) {
+            buffer_set_ring(clientCopy->targetBUffer);
+        }
+        if (!originCopy->zerocopy) {
+            buffer_set_ring(originCopy->targetBUffer);
+        }
+    }
+    if (edgeTriggered) {
+        selector_set_edge_triggered(key->s, *clientFd, true);
+        selector_set_edge_triggered(key->s, *originFd, true);
+    }
 }
 unsigned socksv5HandleRead(TSelectorKey* key) {
     logf(LOG_DEBUG, "socksv5HandleRead: Reading from fd %d", key->fd);
     TClientData* clientData = key->data;
-    TConnection* connections = &(clientData->connections);
+    TConnection* connections = &(clientData->relay->connections);
     TCopy* copy;
     if (clientData->clientFd == key->fd) {
         copy = &(connections->clientCopy);
@@ -169,10 +1130,18 @@ unsigned socksv5HandleRead(TSelectorKey* key) {
     return copyReadHandler(clientData, copy);
 }
 
+unsigned socksv5HandleError(TSelectorKey* key) {
+    TClientData* clientData = key->data;
+    TConnection* connections = &(clientData->relay->connections);
+    TCopy* copy = clientData->clientFd == key->fd ? &(connections->clientCopy) : &(connections->originCopy);
+    copyZerocopyReap(copy);
+    return copyUpdate(copy);
+}
+
 unsigned socksv5HandleWrite(TSelectorKey* key) {
     logf(LOG_DEBUG, "socksv5HandleWrite: Writing to fd %d", key->fd);
     TClientData* clientData = key->data;
-    TConnection* connections = &(clientData->connections);
+    TConnection* connections = &(clientData->relay->connections);
     TCopy* copy;
     bool isClientCopy;
     if (clientData->clientFd == key->fd) {
@@ -185,6 +1154,26 @@ unsigned socksv5HandleWrite(TSelectorKey* key) {
     return copyWriteHandler(copy, isClientCopy);
 }
 
+unsigned socksv5HandleTimeout(TSelectorKey* key) {
+    TClientData* clientData = key->data;
+    TConnection* connections = &(clientData->relay->connections);
+    if (key->fd == clientData->originFd) {
+        // se repusieron los tokens: se vuelve a leer de ambos lados
+        connections->rateLimit.throttled = false;
+        if (edgeTriggered) {
+            // sin datos nuevos no habría otra notificación
+            selector_yield(key->s, clientData->clientFd);
+            selector_yield(key->s, clientData->originFd);
+        }
+        return copyUpdate(&connections->clientCopy);
+    }
+    logf(LOG_INFO, "Socks5 client %d idle timeout, closing", key->fd);
+    return DONE;
+}
+
 void socksv5HandleClose(const unsigned int state, TSelectorKey* key) {
     logf(LOG_DEBUG, "socksv5HandleClose: Client closed: %d", key->fd);
+    TConnection* connections = &ATTACHMENT(key)->relay->connections;
+    copyPipeClose(&connections->clientCopy);
+    copyPipeClose(&connections->originCopy);
 }
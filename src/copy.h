@@ -3,6 +3,15 @@
 #define COPY_H
 #include "buffer.h"
 #include "selector.h"
+#include "uring.h"
+#include "users.h"
+#include <stdbool.h>
+#include <time.h>
+
+struct TClientData;
+
+/** cantidad máxima de envíos con MSG_ZEROCOPY sin confirmar por copia */
+#define COPY_ZEROCOPY_INFLIGHT 16
 
 typedef struct TCopy {
     buffer* otherBuffer;
@@ -14,11 +23,52 @@ typedef struct TCopy {
     size_t duplex;
     size_t* otherDuplex;
     struct TCopy* otherCopy;
+    struct TClientData* clientData;
+
+    // pipe por el que se mueve lo leído de `targetFd' cuando el relay usa
+    // splice(2), o {-1, -1}. `pipeBytes' es lo que hay adentro y `pipeFull'
+    // indica que el pipe rechazó datos antes de llegar a `pipeCapacity'
+    int pipe[2];
+    size_t pipeBytes;
+    size_t pipeCapacity;
+    bool pipeFull;
+
+    // lecturas seguidas que llenaron `otherBuffer', y lecturas que usaron
+    // menos de un cuarto: deciden cuándo agrandarlo o achicarlo
+    unsigned fullReads;
+    unsigned smallReads;
+
+    // envíos de `targetBuffer' con MSG_ZEROCOPY que el kernel todavía no
+    // liberó, numerados como los numera el kernel: [zcDone, zcNext).
+    // `zcBytes[i % COPY_ZEROCOPY_INFLIGHT]' es lo que envió el i-ésimo
+    bool zerocopy;
+    uint32_t zcNext;
+    uint32_t zcDone;
+    uint32_t zcBytes[COPY_ZEROCOPY_INFLIGHT];
+
+    // operaciones en vuelo cuando el relay corre sobre io_uring, y el índice
+    // con el que está registrado `otherBuffer', o -1
+    TUringOp recvOp;
+    TUringOp sendOp;
+    int uringBuffer;
 } TCopy;
 
+/**
+ * límite de tasa de la sesión: el token bucket de su usuario, o el de las
+ * anónimas, que comparte con sus otras sesiones de todos los workers
+ */
+typedef struct TRateLimit {
+    // NULL si el usuario ya no existe
+    TRateBucket* bucket;
+
+    // sin tokens: no se lee hasta que venza el timer del fd del origen
+    bool throttled;
+} TRateLimit;
+
 typedef struct TConnection {
     TCopy clientCopy;
     TCopy originCopy;
+    TRateLimit rateLimit;
 } TConnection;
 
 /**
@@ -43,6 +93,22 @@ unsigned socksv5HandleRead(TSelectorKey* key);
  */
 unsigned socksv5HandleWrite(TSelectorKey* key);
 
+/**
+ * @brief Handler for the timers of the COPY state: the idle timeout on the client fd, and the
+ * end of a rate limit wait on the origin fd
+ * @param key Selector key of the fd whose timer expired
+ * @returns resulting state machine state
+ */
+unsigned socksv5HandleTimeout(TSelectorKey* key);
+
+/**
+ * @brief Handler for pending errors on the COPY state fds: reaps the MSG_ZEROCOPY
+ * completion notifications from the socket error queue
+ * @param key Selector key that holds information regarding the ready fd
+ * @returns resulting state machine state
+ */
+unsigned socksv5HandleError(TSelectorKey* key);
+
 /**
  * @brief Handler to close resources when leaving COPY state
  * @param key Selector key that holds information regarding the ready fd
@@ -50,4 +116,94 @@ unsigned socksv5HandleWrite(TSelectorKey* key);
  */
 void socksv5HandleClose(const unsigned int state, TSelectorKey* key);
 
+/**
+ * @brief Makes the COPY state of the calling thread run its relay through the
+ * given io_uring engine instead of readiness notifications. Connections that already are in COPY
+ * keep their current mode. Passing NULL goes back to the selector and means
+ * the in-flight operations will never complete (e.g. the engine was destroyed).
+ * @param ring the io_uring engine, or NULL
+ */
+void copyUseUring(TUring ring);
+
+/**
+ * @brief Makes the COPY state relay in edge-triggered mode: every notification is
+ * consumed with recv()/send() until EAGAIN, a full/empty buffer or `budget` bytes,
+ * whatever comes first. Connections that use io_uring are not affected. Must be
+ * called before serving clients.
+ * @param enabled whether to use edge-triggered notifications
+ * @param budget maximum amount of bytes moved by each handler per wakeup
+ */
+void copyUseEdgeTriggered(bool enabled, size_t budget);
+
+/**
+ * @brief Makes the COPY state move the data with splice(2) through a pipe per
+ * direction, so it never gets copied to userspace. Connections whose password
+ * dissector is on, or that use io_uring, keep relaying through their buffers.
+ * Must be called before serving clients.
+ * @param enabled whether to use splice(2)
+ */
+void copyUseSplice(bool enabled);
+
+/**
+ * @brief Makes the COPY state send with MSG_ZEROCOPY the relay writes of at least
+ * `threshold` bytes, so the kernel transmits straight from the relay buffers. A
+ * buffer region is not reused until the kernel notifies that it released it.
+ * Connections that use io_uring or splice(2) are not affected. Must be called
+ * before serving clients.
+ * @param threshold minimum size of a zero-copy write, or 0 to disable them
+ */
+void copyUseZerocopy(size_t threshold);
+
+/**
+ * @brief Sets the sizes of the relay buffers. Each direction of a connection starts
+ * with `min` bytes and doubles its buffer, up to `max`, while its reads keep filling
+ * it; when the reads become small it halves it back. Both must be powers of two
+ * between METRICS_RELAY_BUFFER_MIN and the largest class. Connections that use
+ * io_uring keep fixed size buffers. Must be called before serving clients.
+ * @param min initial and minimum size of each relay buffer
+ * @param max maximum size of each relay buffer
+ */
+void copyUseBufferSizes(size_t min, size_t max);
+
+/**
+ * @brief Bounds the queueing delay of relayed connections. `low` is set as
+ * TCP_NOTSENT_LOWAT on both sockets, so the kernel keeps at most that many unsent
+ * bytes queued; `high` makes each direction stop reading once that many bytes wait
+ * in the relay to be sent. 0 disables either. Must be called before serving clients.
+ * @param low TCP_NOTSENT_LOWAT of the client and origin sockets, in bytes
+ * @param high bytes pending to be sent at which a direction stops reading
+ */
+void copyUseWatermarks(size_t low, size_t high);
+
+/**
+ * @brief Takes the relay state and buffers for a connection that is about to enter the
+ * COPY state, from the calling thread's pool. Whatever the handshake buffers hold is
+ * moved to the relay buffers.
+ * @param clientData the connection
+ * @returns false if there is no memory for it
+ */
+bool copyRelayAcquire(struct TClientData* clientData);
+
+/**
+ * @brief Gives back to the calling thread's pool the relay state of a connection
+ * that is being released, if it had one.
+ * @param clientData the connection
+ */
+void copyRelayRelease(struct TClientData* clientData);
+
+/**
+ * @brief Frees the relay blocks kept in the calling thread's pool.
+ */
+void copyRelayPoolDestroy(void);
+
+/**
+ * @brief Releases the io_uring resources of a connection that is being closed.
+ * In-flight operations are woken up by shutting down both sockets, so this must
+ * be called before closing them.
+ * @param clientData the connection being closed
+ * @returns true if there are operations in flight, in which case the last
+ * completion will release the client data instead of the caller
+ */
+bool copyUringRelease(struct TClientData* clientData);
+
 #endif
@@ -0,0 +1,923 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+/**
+ * dns.c - cliente DNS no bloqueante (stub resolver)
+ */
+#include "dns.h"
+#include "logging/logger.h"
+#include "logging/metrics.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+/** como MAXNS de resolv.h */
+#define DNS_MAX_NAMESERVERS 3
+#define DNS_PORT 53
+
+/** tamaño máximo de un mensaje por UDP sin EDNS (RFC 1035 4.2.1) */
+#define DNS_PACKET_SIZE 512
+#define DNS_HEADER_SIZE 12
+/** largo máximo de un nombre, codificado como en los mensajes */
+#define DNS_MAX_NAME 255
+#define DNS_MAX_LABEL 63
+
+/** valores por defecto y máximos de las opciones de resolv.conf(5) */
+#define DNS_DEFAULT_TIMEOUT 5
+#define DNS_MAX_TIMEOUT 30
+#define DNS_DEFAULT_ATTEMPTS 2
+#define DNS_MAX_ATTEMPTS 5
+
+/** direcciones que se toman de cada respuesta como mucho */
+#define DNS_MAX_ADDRESSES 16
+
+/**
+ * TTL, en segundos, con la que se guardan en el cache: como mucho DNS_MAX_TTL
+ * las respuestas con direcciones, DNS_NEGATIVE_TTL los nombres que no existen
+ * o no tienen direcciones (RFC 2308), y DNS_FAILURE_TTL los que fallaron, para
+ * no repetir enseguida una resolución que tardó todos los timeouts.
+ */
+#define DNS_MAX_TTL 3600
+#define DNS_NEGATIVE_TTL 30
+#define DNS_FAILURE_TTL 5
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+#define DNS_RCODE_NXDOMAIN 3
+
+/** bits del tercer byte del encabezado */
+#define DNS_FLAG_QR 0x80
+#define DNS_OPCODE_MASK 0x78
+#define DNS_FLAG_TC 0x02
+#define DNS_FLAG_RD 0x01
+
+/** consultas de cada resolución, en el orden en que se entregan sus direcciones */
+enum { DNS_QUERY_A = 0, DNS_QUERY_AAAA, DNS_QUERIES };
+
+static const uint16_t query_types[DNS_QUERIES] = {DNS_TYPE_A, DNS_TYPE_AAAA};
+static const int query_families[DNS_QUERIES] = {AF_INET, AF_INET6};
+
+/** una dirección de una entrada del cache, sin el puerto */
+struct dns_address {
+    int family;
+    uint8_t addr[sizeof(struct in6_addr)];
+};
+
+/** entrada del cache, en un único bloque con sus direcciones y su nombre codificado */
+struct dns_entry {
+    uint32_t hash;
+    size_t name_len;
+    uint8_t* name;
+    /** en milisegundos de CLOCK_MONOTONIC */
+    uint64_t expires;
+
+    /** siguiente del bucket */
+    struct dns_entry* next;
+    /** lista LRU, de la usada más recientemente a la menos */
+    struct dns_entry* lru_prev;
+    struct dns_entry* lru_next;
+
+    /** 0 para los nombres sin direcciones */
+    size_t count;
+    struct dns_address addresses[];
+};
+
+/** una línea de hosts(5), con un nombre por entrada */
+struct dns_host {
+    char* name;
+    int family;
+    uint8_t addr[sizeof(struct in6_addr)];
+};
+
+struct dns {
+    TSelector s;
+
+    struct sockaddr_storage nameservers[DNS_MAX_NAMESERVERS];
+    socklen_t nameservers_len[DNS_MAX_NAMESERVERS];
+    unsigned nameservers_count;
+    unsigned timeout_ms;
+    unsigned attempts;
+
+    struct dns_host* hosts;
+    size_t hosts_count;
+
+    /** estado del generador de IDs */
+    uint64_t random;
+
+    /** resoluciones en curso, para descartarlas al destruir el resolver */
+    TDnsQuery* queries;
+
+    /** cache: tabla de hash encadenada, con tantos buckets como entradas */
+    struct dns_entry** buckets;
+    size_t buckets_mask;
+    size_t cache_capacity;
+    size_t cache_count;
+    struct dns_entry* lru_head;
+    struct dns_entry* lru_tail;
+};
+
+struct dns_query {
+    TDns dns;
+    /** socket conectado al nameserver del intento actual, o -1 */
+    int fd;
+    int family;
+
+    uint8_t name[DNS_MAX_NAME];
+    size_t name_len;
+    uint16_t port;
+
+    uint16_t ids[DNS_QUERIES];
+    bool answered[DNS_QUERIES];
+    struct addrinfo* results[DNS_QUERIES];
+
+    /** intentos hechos; el i-ésimo va al nameserver i % nameservers_count */
+    unsigned tries;
+
+    /** menor TTL de los registros de las respuestas, y si alguna fue un error */
+    uint32_t ttl;
+    bool failed;
+
+    TDnsCallback callback;
+    void* data;
+
+    TDnsQuery* prev;
+    TDnsQuery* next;
+};
+
+/** un nodo de una lista de direcciones y su dirección, en un único bloque */
+struct dns_addrinfo {
+    struct addrinfo ai;
+    struct sockaddr_storage addr;
+};
+
+static void dns_read(TSelectorKey* key);
+static void dns_timeout(TSelectorKey* key);
+
+static const TFdHandler dns_handler = {
+    .handle_read = dns_read,
+    .handle_timeout = dns_timeout,
+};
+
+struct addrinfo* dns_addrinfo_new(const struct sockaddr* addr, socklen_t addrlen) {
+    if (addrlen > sizeof(struct sockaddr_storage))
+        return NULL;
+
+    struct dns_addrinfo* node = calloc(1, sizeof(*node));
+    if (node == NULL)
+        return NULL;
+
+    memcpy(&node->addr, addr, addrlen);
+    node->ai.ai_family = addr->sa_family;
+    node->ai.ai_socktype = SOCK_STREAM;
+    node->ai.ai_protocol = IPPROTO_TCP;
+    node->ai.ai_addr = (struct sockaddr*)&node->addr;
+    node->ai.ai_addrlen = addrlen;
+    return &node->ai;
+}
+
+void dns_freeaddrinfo(struct addrinfo* ai) {
+    while (ai != NULL) {
+        struct addrinfo* next = ai->ai_next;
+        // `ai' es el primer campo del bloque
+        free(ai);
+        ai = next;
+    }
+}
+
+/** agrega al final de la lista un nodo con la dirección `bytes' de la familia `family' */
+static bool dns_append(struct addrinfo*** tail, int family, const uint8_t* bytes, uint16_t port) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    memset(&addr, 0, sizeof(addr));
+
+    if (family == AF_INET) {
+        struct sockaddr_in* in = (struct sockaddr_in*)&addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        memcpy(&in->sin_addr, bytes, sizeof(in->sin_addr));
+        addrlen = sizeof(*in);
+    } else {
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)&addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        memcpy(&in6->sin6_addr, bytes, sizeof(in6->sin6_addr));
+        addrlen = sizeof(*in6);
+    }
+
+    struct addrinfo* ai = dns_addrinfo_new((struct sockaddr*)&addr, addrlen);
+    if (ai == NULL)
+        return false;
+    **tail = ai;
+    *tail = &ai->ai_next;
+    return true;
+}
+
+/** interpreta una dirección numérica. Retorna su familia, o AF_UNSPEC si no lo es */
+static int dns_parse_address(const char* text, uint8_t* bytes) {
+    if (inet_pton(AF_INET, text, bytes) == 1)
+        return AF_INET;
+    if (inet_pton(AF_INET6, text, bytes) == 1)
+        return AF_INET6;
+    return AF_UNSPEC;
+}
+
+/* ----------------------------------------------------------------------------
+ * Configuración
+ */
+
+static unsigned dns_option(const char* value, unsigned max) {
+    int n = atoi(value);
+    return n < 1 ? 1 : (unsigned)n > max ? max : (unsigned)n;
+}
+
+static void dns_add_nameserver(TDns d, char* text) {
+    // las direcciones link-local pueden traer su interfaz, que se ignora
+    char* scope = strchr(text, '%');
+    if (scope != NULL)
+        *scope = '\0';
+
+    uint8_t bytes[sizeof(struct in6_addr)];
+    int family = dns_parse_address(text, bytes);
+    if (family == AF_UNSPEC) {
+        logf(LOG_WARNING, "Ignoring invalid nameserver %s", text);
+        return;
+    }
+
+    struct sockaddr_storage* addr = &d->nameservers[d->nameservers_count];
+    memset(addr, 0, sizeof(*addr));
+    if (family == AF_INET) {
+        struct sockaddr_in* in = (struct sockaddr_in*)addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(DNS_PORT);
+        memcpy(&in->sin_addr, bytes, sizeof(in->sin_addr));
+        d->nameservers_len[d->nameservers_count] = sizeof(*in);
+    } else {
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(DNS_PORT);
+        memcpy(&in6->sin6_addr, bytes, sizeof(in6->sin6_addr));
+        d->nameservers_len[d->nameservers_count] = sizeof(*in6);
+    }
+    d->nameservers_count++;
+}
+
+static void dns_read_resolv_conf(TDns d, const char* path) {
+    FILE* file = path == NULL ? NULL : fopen(path, "r");
+    if (file != NULL) {
+        char line[512];
+        while (fgets(line, sizeof(line), file) != NULL) {
+            char* save;
+            char* key = strtok_r(line, " \t\r\n", &save);
+            if (key == NULL || key[0] == '#' || key[0] == ';')
+                continue;
+
+            if (strcmp(key, "nameserver") == 0) {
+                char* value = strtok_r(NULL, " \t\r\n", &save);
+                if (value != NULL && d->nameservers_count < DNS_MAX_NAMESERVERS)
+                    dns_add_nameserver(d, value);
+            } else if (strcmp(key, "options") == 0) {
+                char* option;
+                while ((option = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+                    if (strncmp(option, "timeout:", 8) == 0)
+                        d->timeout_ms = dns_option(option + 8, DNS_MAX_TIMEOUT) * 1000;
+                    else if (strncmp(option, "attempts:", 9) == 0)
+                        d->attempts = dns_option(option + 9, DNS_MAX_ATTEMPTS);
+                }
+            }
+        }
+        fclose(file);
+    }
+
+    if (d->nameservers_count == 0) {
+        char localhost[] = "127.0.0.1";
+        dns_add_nameserver(d, localhost);
+    }
+}
+
+static void dns_read_hosts(TDns d, const char* path) {
+    FILE* file = path == NULL ? NULL : fopen(path, "r");
+    if (file == NULL)
+        return;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char* comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        char* save;
+        char* text = strtok_r(line, " \t\r\n", &save);
+        if (text == NULL)
+            continue;
+
+        uint8_t bytes[sizeof(struct in6_addr)];
+        int family = dns_parse_address(text, bytes);
+        if (family == AF_UNSPEC)
+            continue;
+
+        char* name;
+        while ((name = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            struct dns_host* hosts = realloc(d->hosts, (d->hosts_count + 1) * sizeof(*hosts));
+            if (hosts == NULL)
+                break;
+            d->hosts = hosts;
+
+            struct dns_host* host = &hosts[d->hosts_count];
+            size_t len = strlen(name) + 1;
+            host->name = malloc(len);
+            if (host->name == NULL)
+                break;
+            memcpy(host->name, name, len);
+            host->family = family;
+            memcpy(host->addr, bytes, sizeof(host->addr));
+            d->hosts_count++;
+        }
+    }
+    fclose(file);
+}
+
+/** busca `name' en hosts(5). Retorna si se encontró, aunque no haya memoria para el resultado */
+static bool dns_hosts_lookup(TDns d, const char* name, uint16_t port, struct addrinfo** result) {
+    struct addrinfo** tail = result;
+    bool found = false;
+
+    for (int i = 0; i < DNS_QUERIES; i++) {
+        for (size_t j = 0; j < d->hosts_count; j++) {
+            const struct dns_host* host = &d->hosts[j];
+            if (host->family == query_families[i] && strcasecmp(host->name, name) == 0) {
+                found = true;
+                dns_append(&tail, host->family, host->addr, port);
+            }
+        }
+    }
+    return found;
+}
+
+static uint64_t dns_seed(TDns d) {
+    uint64_t seed = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd != -1) {
+        if (read(fd, &seed, sizeof(seed)) != sizeof(seed))
+            seed = 0;
+        close(fd);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    seed ^= (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    seed ^= (uint64_t)getpid() << 32 ^ (uint64_t)(uintptr_t)d;
+    return seed == 0 ? 1 : seed;
+}
+
+/** xorshift64: alcanza para que los IDs no sean predecibles a simple vista */
+static uint16_t dns_next_id(TDns d) {
+    d->random ^= d->random << 13;
+    d->random ^= d->random >> 7;
+    d->random ^= d->random << 17;
+    return (uint16_t)(d->random >> 32);
+}
+
+TDns dns_new(TSelector s, const char* resolv_conf, const char* hosts, size_t cache_entries) {
+    TDns d = calloc(1, sizeof(*d));
+    if (d == NULL)
+        return NULL;
+
+    if (cache_entries > 0) {
+        size_t buckets = 1;
+        while (buckets < cache_entries)
+            buckets <<= 1;
+        d->buckets = calloc(buckets, sizeof(*d->buckets));
+        if (d->buckets == NULL) {
+            free(d);
+            return NULL;
+        }
+        d->buckets_mask = buckets - 1;
+        d->cache_capacity = cache_entries;
+    }
+
+    d->s = s;
+    d->timeout_ms = DNS_DEFAULT_TIMEOUT * 1000;
+    d->attempts = DNS_DEFAULT_ATTEMPTS;
+    d->random = dns_seed(d);
+    dns_read_resolv_conf(d, resolv_conf);
+    dns_read_hosts(d, hosts);
+
+    logf(LOG_DEBUG, "DNS resolver with %u nameservers, timeout %ums, %u attempts, %zu hosts entries, %zu cache entries", d->nameservers_count,
+         d->timeout_ms, d->attempts, d->hosts_count, d->cache_capacity);
+    return d;
+}
+
+/* ----------------------------------------------------------------------------
+ * Mensajes
+ */
+
+static uint16_t dns_get16(const uint8_t* p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static void dns_put16(uint8_t* p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+/** codifica `name' como una secuencia de etiquetas. Retorna su largo, o 0 si es inválido */
+static size_t dns_encode_name(const char* name, uint8_t* out) {
+    size_t len = 0;
+    const char* label = name;
+
+    while (*label != '\0') {
+        const char* end = strchr(label, '.');
+        size_t n = end == NULL ? strlen(label) : (size_t)(end - label);
+        // el largo de la etiqueta, ella y la etiqueta vacía del final
+        if (n == 0 || n > DNS_MAX_LABEL || len + 1 + n + 1 > DNS_MAX_NAME)
+            return 0;
+
+        out[len++] = (uint8_t)n;
+        memcpy(out + len, label, n);
+        len += n;
+
+        if (end == NULL)
+            break;
+        label = end + 1;
+    }
+
+    if (len == 0)
+        return 0;
+    out[len++] = 0;
+    return len;
+}
+
+/** compara nombres codificados; los largos de las etiquetas no cambian con tolower */
+static bool dns_same_name(const uint8_t* a, const uint8_t* b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (tolower(a[i]) != tolower(b[i]))
+            return false;
+    }
+    return true;
+}
+
+/** avanza `*offset' hasta después del nombre, sin seguir los punteros de la compresión */
+static bool dns_skip_name(const uint8_t* msg, size_t len, size_t* offset) {
+    size_t i = *offset;
+    while (i < len) {
+        uint8_t n = msg[i];
+        if ((n & 0xC0) == 0xC0) {
+            *offset = i + 2;
+            return *offset <= len;
+        }
+        if (n == 0) {
+            *offset = i + 1;
+            return true;
+        }
+        i += 1 + n;
+    }
+    return false;
+}
+
+/** envía una consulta. Los errores de un envío anterior, como un ECONNREFUSED, se reportan acá */
+static bool dns_send(TDnsQuery* q, int which) {
+    uint8_t msg[DNS_HEADER_SIZE + DNS_MAX_NAME + 4];
+    memset(msg, 0, DNS_HEADER_SIZE);
+    dns_put16(msg, q->ids[which]);
+    msg[2] = DNS_FLAG_RD;
+    dns_put16(msg + 4, 1);
+
+    size_t len = DNS_HEADER_SIZE;
+    memcpy(msg + len, q->name, q->name_len);
+    len += q->name_len;
+    dns_put16(msg + len, query_types[which]);
+    dns_put16(msg + len + 2, DNS_CLASS_IN);
+    len += 4;
+
+    if (send(q->fd, msg, len, 0) == -1) {
+        logf(LOG_DEBUG, "Failed to send DNS query on fd %d: %s", q->fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/** procesa una respuesta. Las que no corresponden a una consulta sin responder se ignoran */
+static void dns_answer(TDnsQuery* q, const uint8_t* msg, size_t len) {
+    if (len < DNS_HEADER_SIZE || (msg[2] & DNS_FLAG_QR) == 0 || (msg[2] & DNS_OPCODE_MASK) != 0)
+        return;
+
+    uint16_t id = dns_get16(msg);
+    int which = -1;
+    for (int i = 0; i < DNS_QUERIES; i++) {
+        if (!q->answered[i] && q->ids[i] == id)
+            which = i;
+    }
+    if (which == -1)
+        return;
+
+    // la pregunta tiene que ser la enviada
+    size_t offset = DNS_HEADER_SIZE;
+    if (dns_get16(msg + 4) != 1 || len < offset + q->name_len + 4 || !dns_same_name(msg + offset, q->name, q->name_len) ||
+        dns_get16(msg + offset + q->name_len) != query_types[which] || dns_get16(msg + offset + q->name_len + 2) != DNS_CLASS_IN)
+        return;
+    offset += q->name_len + 4;
+
+    // un error (NXDOMAIN, SERVFAIL...) también es una respuesta: no hay direcciones
+    q->answered[which] = true;
+    uint8_t rcode = msg[3] & 0x0F;
+    if (rcode != 0) {
+        logf(LOG_DEBUG, "DNS query on fd %d answered with rcode %u", q->fd, rcode);
+        q->failed |= rcode != DNS_RCODE_NXDOMAIN;
+        return;
+    }
+    if (msg[2] & DNS_FLAG_TC)
+        logf(LOG_DEBUG, "DNS answer on fd %d truncated, using the addresses received", q->fd);
+
+    struct addrinfo** tail = &q->results[which];
+    uint16_t answers = dns_get16(msg + 6);
+    unsigned count = 0;
+    for (uint16_t i = 0; i < answers && count < DNS_MAX_ADDRESSES; i++) {
+        if (!dns_skip_name(msg, len, &offset) || offset + 10 > len)
+            return;
+
+        uint16_t type = dns_get16(msg + offset);
+        uint16_t class = dns_get16(msg + offset + 2);
+        uint32_t ttl = (uint32_t)dns_get16(msg + offset + 4) << 16 | dns_get16(msg + offset + 6);
+        uint16_t rdlen = dns_get16(msg + offset + 8);
+        offset += 10;
+        if (offset + rdlen > len)
+            return;
+
+        // el resultado vale lo que el registro que menos dura, incluidos los CNAME
+        if (class == DNS_CLASS_IN && ttl < q->ttl)
+            q->ttl = ttl;
+
+        // se saltean los CNAME: la respuesta ya trae las direcciones del nombre canónico
+        bool address = which == DNS_QUERY_A ? type == DNS_TYPE_A && rdlen == sizeof(struct in_addr)
+                                            : type == DNS_TYPE_AAAA && rdlen == sizeof(struct in6_addr);
+        if (class == DNS_CLASS_IN && address) {
+            if (!dns_append(&tail, query_families[which], msg + offset, q->port))
+                return;
+            count++;
+        }
+        offset += rdlen;
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Cache
+ */
+
+static uint64_t dns_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/** FNV-1a, sin distinguir mayúsculas como `dns_same_name' */
+static uint32_t dns_hash(const uint8_t* name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)tolower(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void dns_lru_unlink(TDns d, struct dns_entry* e) {
+    if (e->lru_prev != NULL)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        d->lru_head = e->lru_next;
+    if (e->lru_next != NULL)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        d->lru_tail = e->lru_prev;
+}
+
+static void dns_lru_push(TDns d, struct dns_entry* e) {
+    e->lru_prev = NULL;
+    e->lru_next = d->lru_head;
+    if (d->lru_head != NULL)
+        d->lru_head->lru_prev = e;
+    else
+        d->lru_tail = e;
+    d->lru_head = e;
+}
+
+static void dns_cache_remove(TDns d, struct dns_entry* e) {
+    struct dns_entry** p = &d->buckets[e->hash & d->buckets_mask];
+    while (*p != e)
+        p = &(*p)->next;
+    *p = e->next;
+    dns_lru_unlink(d, e);
+    d->cache_count--;
+    free(e);
+}
+
+static struct dns_entry* dns_cache_find(TDns d, const uint8_t* name, size_t len, uint32_t hash) {
+    for (struct dns_entry* e = d->buckets[hash & d->buckets_mask]; e != NULL; e = e->next) {
+        if (e->hash == hash && e->name_len == len && dns_same_name(e->name, name, len))
+            return e;
+    }
+    return NULL;
+}
+
+/** busca un nombre codificado en el cache. Las entradas vencidas se descartan */
+static struct dns_entry* dns_cache_lookup(TDns d, const uint8_t* name, size_t len) {
+    if (d->cache_capacity == 0)
+        return NULL;
+
+    struct dns_entry* e = dns_cache_find(d, name, len, dns_hash(name, len));
+    if (e != NULL && e->expires <= dns_now()) {
+        dns_cache_remove(d, e);
+        e = NULL;
+    }
+    if (e != NULL) {
+        dns_lru_unlink(d, e);
+        dns_lru_push(d, e);
+    }
+    metricsRegisterDnsCacheLookup(e != NULL);
+    return e;
+}
+
+/** guarda el resultado de una resolución, reemplazando al que hubiera; si no hay lugar sale la menos usada */
+static void dns_cache_store(TDns d, const uint8_t* name, size_t len, const struct addrinfo* result, uint32_t ttl) {
+    if (d->cache_capacity == 0 || ttl == 0)
+        return;
+
+    uint32_t hash = dns_hash(name, len);
+    struct dns_entry* e = dns_cache_find(d, name, len, hash);
+    if (e != NULL)
+        dns_cache_remove(d, e);
+
+    size_t count = 0;
+    for (const struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next)
+        count++;
+
+    e = malloc(sizeof(*e) + count * sizeof(struct dns_address) + len);
+    if (e == NULL)
+        return;
+
+    e->hash = hash;
+    e->name_len = len;
+    e->name = (uint8_t*)&e->addresses[count];
+    memcpy(e->name, name, len);
+    e->expires = dns_now() + (uint64_t)ttl * 1000;
+    e->count = count;
+
+    struct dns_address* address = e->addresses;
+    for (const struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next, address++) {
+        address->family = ai->ai_family;
+        if (ai->ai_family == AF_INET)
+            memcpy(address->addr, &((const struct sockaddr_in*)ai->ai_addr)->sin_addr, sizeof(struct in_addr));
+        else
+            memcpy(address->addr, &((const struct sockaddr_in6*)ai->ai_addr)->sin6_addr, sizeof(struct in6_addr));
+    }
+
+    if (d->cache_count == d->cache_capacity)
+        dns_cache_remove(d, d->lru_tail);
+
+    struct dns_entry** bucket = &d->buckets[hash & d->buckets_mask];
+    e->next = *bucket;
+    *bucket = e;
+    dns_lru_push(d, e);
+    d->cache_count++;
+}
+
+/* ----------------------------------------------------------------------------
+ * Resoluciones
+ */
+
+/** libera la resolución y su socket, sin llamar al callback */
+static void dns_query_free(TDnsQuery* q) {
+    if (q->prev != NULL)
+        q->prev->next = q->next;
+    else
+        q->dns->queries = q->next;
+    if (q->next != NULL)
+        q->next->prev = q->prev;
+
+    if (q->fd != -1) {
+        selector_unregister_fd(q->dns->s, q->fd);
+        close(q->fd);
+    }
+    for (int i = 0; i < DNS_QUERIES; i++)
+        dns_freeaddrinfo(q->results[i]);
+    free(q);
+}
+
+/** termina la resolución con las direcciones obtenidas */
+static void dns_finish(TDnsQuery* q) {
+    // las IPv6 van después de las IPv4
+    struct addrinfo* result = q->results[DNS_QUERY_A];
+    struct addrinfo** tail = &result;
+    while (*tail != NULL)
+        tail = &(*tail)->ai_next;
+    *tail = q->results[DNS_QUERY_AAAA];
+    q->results[DNS_QUERY_A] = q->results[DNS_QUERY_AAAA] = NULL;
+
+    uint32_t ttl;
+    if (result != NULL)
+        ttl = q->ttl < DNS_MAX_TTL ? q->ttl : DNS_MAX_TTL;
+    else if (q->failed || !q->answered[DNS_QUERY_A] || !q->answered[DNS_QUERY_AAAA])
+        ttl = DNS_FAILURE_TTL;
+    else
+        ttl = DNS_NEGATIVE_TTL;
+    dns_cache_store(q->dns, q->name, q->name_len, result, ttl);
+
+    TSelector s = q->dns->s;
+    TDnsCallback callback = q->callback;
+    void* data = q->data;
+    dns_query_free(q);
+    callback(s, data, result);
+}
+
+/** envía las consultas sin responder al nameserver `i' y arma el timeout */
+static bool dns_send_to(TDnsQuery* q, unsigned i) {
+    TDns d = q->dns;
+    const struct sockaddr_storage* nameserver = &d->nameservers[i];
+
+    // un socket por resolución: el puerto de origen aleatorio dificulta falsificar respuestas
+    if (q->fd != -1 && q->family != nameserver->ss_family) {
+        selector_unregister_fd(d->s, q->fd);
+        close(q->fd);
+        q->fd = -1;
+    }
+    if (q->fd == -1) {
+        int fd = socket(nameserver->ss_family, SOCK_DGRAM, 0);
+        if (fd == -1) {
+            logf(LOG_DEBUG, "Failed to create DNS socket: %s", strerror(errno));
+            return false;
+        }
+        if (selector_fd_set_nio(fd) == -1 || selector_register(d->s, fd, &dns_handler, OP_READ, q) != SELECTOR_SUCCESS) {
+            close(fd);
+            return false;
+        }
+        q->fd = fd;
+        q->family = nameserver->ss_family;
+    }
+
+    // conectado, el kernel descarta lo que no venga del nameserver
+    if (connect(q->fd, (const struct sockaddr*)nameserver, d->nameservers_len[i]) == -1) {
+        logf(LOG_DEBUG, "Failed to connect DNS socket to nameserver %u: %s", i, strerror(errno));
+        return false;
+    }
+
+    for (int which = 0; which < DNS_QUERIES; which++) {
+        if (!q->answered[which] && !dns_send(q, which))
+            return false;
+    }
+    return selector_add_timer(d->s, q->fd, d->timeout_ms) == SELECTOR_SUCCESS;
+}
+
+/** pasa al próximo intento. Retorna false si no quedan */
+static bool dns_next_try(TDnsQuery* q) {
+    TDns d = q->dns;
+    unsigned tries = d->attempts * d->nameservers_count;
+    while (q->tries < tries) {
+        unsigned i = q->tries++ % d->nameservers_count;
+        if (dns_send_to(q, i))
+            return true;
+    }
+    return false;
+}
+
+static void dns_retry(TDnsQuery* q) {
+    if (!dns_next_try(q))
+        dns_finish(q);
+}
+
+static void dns_read(TSelectorKey* key) {
+    TDnsQuery* q = key->data;
+    uint8_t msg[DNS_PACKET_SIZE];
+
+    ssize_t n = recv(q->fd, msg, sizeof(msg), 0);
+    if (n == -1) {
+        // llegó un ICMP port unreachable: no hay nameserver, no tiene sentido esperar el timeout
+        if (errno == ECONNREFUSED)
+            dns_retry(q);
+        return;
+    }
+
+    dns_answer(q, msg, (size_t)n);
+    if (q->answered[DNS_QUERY_A] && q->answered[DNS_QUERY_AAAA])
+        dns_finish(q);
+}
+
+static void dns_timeout(TSelectorKey* key) {
+    TDnsQuery* q = key->data;
+    logf(LOG_DEBUG, "DNS query on fd %d timed out", q->fd);
+    dns_retry(q);
+}
+
+TDnsStatus dns_resolve(TDns d, const char* name, uint16_t port, TDnsCallback callback, void* data, struct addrinfo** result, TDnsQuery** query) {
+    *result = NULL;
+    *query = NULL;
+
+    // las direcciones numéricas y hosts(5) no necesitan consultas
+    uint8_t bytes[sizeof(struct in6_addr)];
+    int family = dns_parse_address(name, bytes);
+    if (family != AF_UNSPEC) {
+        struct addrinfo** tail = result;
+        return dns_append(&tail, family, bytes, port) ? DNS_RESOLVED : DNS_ERROR;
+    }
+    if (dns_hosts_lookup(d, name, port, result))
+        return *result != NULL ? DNS_RESOLVED : DNS_ERROR;
+
+    uint8_t encoded[DNS_MAX_NAME];
+    size_t len = dns_encode_name(name, encoded);
+    if (len == 0) {
+        logf(LOG_DEBUG, "Invalid domain name %s", name);
+        return DNS_ERROR;
+    }
+
+    const struct dns_entry* entry = dns_cache_lookup(d, encoded, len);
+    if (entry != NULL) {
+        if (entry->count == 0)
+            return DNS_NOT_FOUND;
+        struct addrinfo** tail = result;
+        for (size_t i = 0; i < entry->count; i++) {
+            if (!dns_append(&tail, entry->addresses[i].family, entry->addresses[i].addr, port)) {
+                dns_freeaddrinfo(*result);
+                *result = NULL;
+                return DNS_ERROR;
+            }
+        }
+        return DNS_RESOLVED;
+    }
+
+    TDnsQuery* q = malloc(sizeof(*q));
+    if (q == NULL)
+        return DNS_ERROR;
+
+    memcpy(q->name, encoded, len);
+    q->name_len = len;
+    q->dns = d;
+    q->fd = -1;
+    q->family = AF_UNSPEC;
+    q->port = port;
+    q->tries = 0;
+    q->ttl = UINT32_MAX;
+    q->failed = false;
+    q->callback = callback;
+    q->data = data;
+    q->ids[DNS_QUERY_A] = dns_next_id(d);
+    do {
+        q->ids[DNS_QUERY_AAAA] = dns_next_id(d);
+    } while (q->ids[DNS_QUERY_AAAA] == q->ids[DNS_QUERY_A]);
+    for (int i = 0; i < DNS_QUERIES; i++) {
+        q->answered[i] = false;
+        q->results[i] = NULL;
+    }
+
+    q->prev = NULL;
+    q->next = d->queries;
+    if (d->queries != NULL)
+        d->queries->prev = q;
+    d->queries = q;
+
+    // si ningún nameserver aceptó las consultas, el fin igual se informa desde el selector
+    if (!dns_next_try(q) && (q->fd == -1 || selector_add_timer(d->s, q->fd, 0) != SELECTOR_SUCCESS)) {
+        dns_query_free(q);
+        return DNS_ERROR;
+    }
+    *query = q;
+    return DNS_PENDING;
+}
+
+void dns_cancel(TDnsQuery* q) {
+    if (q != NULL)
+        dns_query_free(q);
+}
+
+void dns_destroy(TDns d) {
+    if (d == NULL)
+        return;
+
+    // el selector ya no existe: sólo se cierran los sockets
+    TDnsQuery* q = d->queries;
+    while (q != NULL) {
+        TDnsQuery* next = q->next;
+        if (q->fd != -1)
+            close(q->fd);
+        for (int i = 0; i < DNS_QUERIES; i++)
+            dns_freeaddrinfo(q->results[i]);
+        free(q);
+        q = next;
+    }
+
+    while (d->lru_head != NULL)
+        dns_cache_remove(d, d->lru_head);
+    free(d->buckets);
+
+    for (size_t i = 0; i < d->hosts_count; i++)
+        free(d->hosts[i].name);
+    free(d->hosts);
+    free(d);
+}
@@ -0,0 +1,95 @@
+#ifndef DNS_H_
+#define DNS_H_
+
+#include "selector.h"
+#include <netdb.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * dns.c - cliente DNS no bloqueante (stub resolver)
+ *
+ * Resuelve nombres sin bloquear al hilo, a diferencia de getaddrinfo(3): cada
+ * resolución envía las consultas A y AAAA por un socket UDP no bloqueante que
+ * se registra en el selector, y las respuestas se asocian a la consulta por
+ * su ID y su pregunta. Si vence el timeout, o el nameserver no está, se
+ * reintenta con el siguiente.
+ *
+ * Los nameservers y las opciones `timeout' y `attempts' se leen de
+ * resolv.conf(5) al crear el resolver, y los nombres de hosts(5) se resuelven
+ * sin consultar a nadie, al igual que las direcciones numéricas. No se usan
+ * los dominios de búsqueda: el nombre se consulta tal cual.
+ *
+ * Las respuestas se guardan en un cache con LRU por la menor TTL de sus
+ * registros, y por unos segundos los nombres sin direcciones o que no se
+ * pudieron resolver, así los nombres frecuentes no esperan ninguna consulta.
+ *
+ * Los callbacks corren en el hilo del selector. No es thread safe: cada hilo
+ * worker usa su propio resolver.
+ *
+ * El flujo de utilización es:
+ *  - crear el resolver asociado a un selector: `dns_new'
+ *  - resolver nombres: `dns_resolve', y cancelar los que ya no interesan
+ *    con `dns_cancel'
+ *  - destruirlo, luego de destruir el selector: `dns_destroy'
+ */
+typedef struct dns* TDns;
+
+/** una resolución en curso */
+typedef struct dns_query TDnsQuery;
+
+#define DNS_RESOLV_CONF "/etc/resolv.conf"
+#define DNS_HOSTS "/etc/hosts"
+
+typedef enum {
+    /** el resultado quedó en `*result': dirección numérica, hosts(5) o cache */
+    DNS_RESOLVED = 0,
+    /** la resolución quedó en `*query' y al terminar se llama al callback */
+    DNS_PENDING,
+    /** el cache dice que el nombre no tiene direcciones */
+    DNS_NOT_FOUND,
+    /** nombre inválido, sin memoria o no se pudo enviar la consulta */
+    DNS_ERROR,
+} TDnsStatus;
+
+/**
+ * fin de una resolución. `result' son las direcciones (primero las IPv4), o
+ * NULL si el nombre no se pudo resolver; se liberan con `dns_freeaddrinfo'.
+ */
+typedef void (*TDnsCallback)(TSelector s, void* data, struct addrinfo* result);
+
+/**
+ * crea un resolver que registra sus sockets en `s', con la configuración de
+ * los archivos `resolv_conf' y `hosts' y un cache de hasta `cache_entries'
+ * nombres (0 lo deshabilita). Sin nameservers se usa el del host local, como
+ * hace la libc. Retorna NULL si no hay memoria.
+ */
+TDns dns_new(TSelector s, const char* resolv_conf, const char* hosts, size_t cache_entries);
+
+/**
+ * libera el resolver, luego de destruir su selector. Las resoluciones que
+ * sigan en curso se descartan sin llamar a sus callbacks. Tolera NULLs
+ */
+void dns_destroy(TDns d);
+
+/**
+ * resuelve `name' en direcciones para conectarse al puerto `port'.
+ *
+ * Sólo con DNS_PENDING se llama luego a `callback' con `data', a menos que
+ * se cancele `*query'; con DNS_RESOLVED el resultado ya está en `*result'.
+ */
+TDnsStatus dns_resolve(TDns d, const char* name, uint16_t port, TDnsCallback callback, void* data, struct addrinfo** result, TDnsQuery** query);
+
+/** cancela una resolución en curso: su callback ya no se llama. Tolera NULLs */
+void dns_cancel(TDnsQuery* q);
+
+/**
+ * crea un nodo de una lista de direcciones, como las de `dns_resolve', con
+ * una copia de `addr'. Retorna NULL si no hay memoria.
+ */
+struct addrinfo* dns_addrinfo_new(const struct sockaddr* addr, socklen_t addrlen);
+
+/** libera una lista de direcciones creada con `dns_addrinfo_new'. Tolera NULLs */
+void dns_freeaddrinfo(struct addrinfo* ai);
+
+#endif
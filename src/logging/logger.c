@@ -2,8 +2,11 @@
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 
 #include "logger.h"
+#include "metrics.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -58,6 +61,18 @@ static int logFileFd = -1;
 static TSelector selector = NULL;
 static TLogLevel logLevel = MIN_LOG_LEVEL;
 
+/**
+ * Worker threads log too, so the buffer is protected by this mutex. It's taken by
+ * loggerPrePrint and released by loggerPostPrint, so a whole log line is written at once.
+ */
+static pthread_mutex_t bufferMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The thread that runs the selector where the log file is registered. */
+static pthread_t selectorThread;
+
+/** Whether a worker thread already asked the selector thread to flush the buffer. */
+static bool flushRequested = false;
+
 /** The stream for writing logs to, or NULL if we're not doing that. */
 static FILE* logStream = NULL;
 
@@ -110,12 +125,27 @@ static inline void tryFlushBufferToFile() {
     }
 
     // If there are still remaining bytes to write, leave them in the buffer and retry
-    // once the selector says the fd can be written.
-    selector_set_interest(selector, logFileFd, bufferLength > 0 ? OP_WRITE : OP_NOOP);
+    // once the selector says the fd can be written. The selector may only be touched
+    // from its own thread, other threads ask it to take care of the retry.
+    if (pthread_equal(pthread_self(), selectorThread)) {
+        selector_set_interest(selector, logFileFd, bufferLength > 0 ? OP_WRITE : OP_NOOP);
+    } else if (bufferLength > 0 && !flushRequested) {
+        flushRequested = true;
+        selector_notify_block(selector, logFileFd);
+    }
 }
 
 static void fdWriteHandler(TSelectorKey* key) {
+    pthread_mutex_lock(&bufferMutex);
     tryFlushBufferToFile();
+    pthread_mutex_unlock(&bufferMutex);
+}
+
+static void fdBlockHandler(TSelectorKey* key) {
+    pthread_mutex_lock(&bufferMutex);
+    flushRequested = false;
+    tryFlushBufferToFile();
+    pthread_mutex_unlock(&bufferMutex);
 }
 
 static void fdCloseHandler(TSelectorKey* key) {
@@ -141,7 +171,8 @@ static TFdHandler fdHandler = {
     .handle_read = NULL,
     .handle_write = fdWriteHandler,
     .handle_close = fdCloseHandler,
-    .handle_block = NULL};
+    .handle_block = fdBlockHandler,
+    .stats_tag = METRICS_HANDLER_LOGGER};
 
 /**
  * @brief Attempts to open a file for logging. Returns the fd, or -1 if failed.
@@ -177,6 +208,7 @@ int loggerInit(TSelector selectorParam, const char* logFile, FILE* logStreamPara
     struct tm tm = *localtime(&timeNow);
 
     selector = selectorParam;
+    selectorThread = pthread_self();
     logFileFd = selectorParam == NULL ? -1 : tryOpenLogfile(logFile, tm);
     logStream = logStreamParam;
     logLevel = MIN_LOG_LEVEL;
@@ -203,6 +235,8 @@ int loggerInit(TSelector selectorParam, const char* logFile, FILE* logStreamPara
 }
 
 int loggerFinalize() {
+    pthread_mutex_lock(&bufferMutex);
+
     // If a logging file is opened, flush buffers, unregister it, and close it.
     if (logFileFd >= 0) {
         selector_unregister_fd(selector, logFileFd); // This will also call the TFdHandler's close, and close the file.
@@ -220,6 +254,8 @@ int loggerFinalize() {
 
     // The logger does not handle closing the stream. We set it to NULL and forget.
     logStream = NULL;
+
+    pthread_mutex_unlock(&bufferMutex);
     return 0;
 }
 
@@ -232,6 +268,7 @@ int loggerIsEnabledFor(TLogLevel level) {
 }
 
 void loggerPrePrint() {
+    pthread_mutex_lock(&bufferMutex);
     makeBufferSpace(LOG_BUFFER_MAX_PRINT_LENGTH);
 }
 
@@ -246,6 +283,7 @@ void loggerGetBufstartAndMaxlength(char** bufstartVar, size_t* maxlenVar) {
 int loggerPostPrint(int written, size_t maxlen) {
     if (written < 0) {
         fprintf(stderr, "Error: snprintf(): %s\n", strerror(errno));
+        pthread_mutex_unlock(&bufferMutex);
         return -1;
     }
 
@@ -264,6 +302,8 @@ int loggerPostPrint(int written, size_t maxlen) {
         bufferLength += written;
         tryFlushBufferToFile();
     }
+
+    pthread_mutex_unlock(&bufferMutex);
     return 0;
 }
 
@@ -62,6 +62,10 @@ void loggerSetLevel(TLogLevel level);
 
 int loggerIsEnabledFor(TLogLevel level);
 
+/**
+ * @brief Called by the logf macro before printing a line. Takes the logger's lock, which
+ * is released by loggerPostPrint, so logging is safe from any thread.
+ */
 void loggerPrePrint();
 
 void loggerGetBufstartAndMaxlength(char** bufstartVar, size_t* maxlenVar);
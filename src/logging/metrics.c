@@ -2,34 +2,254 @@
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 
 #include "metrics.h"
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <string.h>
 
 /**
- * The current metrics values for this server.
+ * Amount of per-thread event loop statistics blocks. Threads beyond this amount share blocks,
+ * which is still correct since every counter is atomic.
  */
-static TMetricsSnapshot metrics;
+#define LOOP_STATS_SLOTS 72
+
+/**
+ * The current metrics values for this server. These are updated from every worker thread,
+ * so each field is an independent atomic counter.
+ */
+static struct {
+    atomic_size_t currentConnectionCount;
+    atomic_size_t totalConnectionCount;
+    atomic_size_t maxConcurrentConnections;
+    atomic_size_t totalBytesSent;
+    atomic_size_t totalBytesReceived;
+    atomic_size_t blockingJobsDispatched;
+    atomic_size_t blockingQueueMaxDepth;
+    atomic_size_t blockingLatencyTotalUs;
+    atomic_size_t blockingLatencyMaxUs;
+    atomic_size_t jobsStarted;
+    atomic_size_t jobsRejected;
+    atomic_size_t jobWaitTotalUs;
+    atomic_size_t jobWaitMaxUs;
+    atomic_size_t dnsCacheHits;
+    atomic_size_t dnsCacheMisses;
+    atomic_size_t zerocopyBytes;
+    atomic_size_t zerocopyCopiedBytes;
+    atomic_size_t relayBuffers[METRICS_RELAY_BUFFER_CLASSES];
+    atomic_size_t relayBufferGrowths;
+    atomic_size_t relayBufferShrinks;
+    atomic_size_t reclaimedSessions;
+    atomic_size_t slabObjects[METRICS_SLAB_COUNT];
+    atomic_size_t slabMaxObjects[METRICS_SLAB_COUNT];
+    atomic_size_t slabBytes[METRICS_SLAB_COUNT];
+} metrics;
+
+/**
+ * The event loop statistics of a thread. Each event loop thread updates its own block, so the
+ * atomic increments don't bounce cache lines between threads.
+ */
+typedef struct {
+    alignas(64) atomic_size_t iterationUs[METRICS_HISTOGRAM_BUCKETS];
+    atomic_size_t pollUs[METRICS_HISTOGRAM_BUCKETS];
+    atomic_size_t readyFds[METRICS_HISTOGRAM_BUCKETS];
+    atomic_size_t handlerUs[METRICS_HANDLER_COUNT][METRICS_HISTOGRAM_BUCKETS];
+} TLoopStats;
+
+static TLoopStats loopStats[LOOP_STATS_SLOTS];
+static atomic_uint loopStatsUsed;
+static _Thread_local TLoopStats* threadLoopStats = NULL;
+
+static TLoopStats* getThreadLoopStats() {
+    if (threadLoopStats == NULL) {
+        threadLoopStats = &loopStats[atomic_fetch_add(&loopStatsUsed, 1) % LOOP_STATS_SLOTS];
+    }
+    return threadLoopStats;
+}
+
+static unsigned histogramBucket(uint64_t value) {
+    if (value == 0)
+        return 0;
+    unsigned bucket = 64 - __builtin_clzll(value);
+    return bucket < METRICS_HISTOGRAM_BUCKETS ? bucket : METRICS_HISTOGRAM_BUCKETS - 1;
+}
+
+static void histogramAdd(atomic_size_t* buckets, uint64_t value) {
+    atomic_fetch_add_explicit(&buckets[histogramBucket(value)], 1, memory_order_relaxed);
+}
+
+static void histogramSum(TMetricsHistogram* histogram, const atomic_size_t* buckets) {
+    for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+        histogram->buckets[i] += atomic_load_explicit(&buckets[i], memory_order_relaxed);
+}
+
+static void updateMax(atomic_size_t* max, size_t value) {
+    size_t current = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > current && !atomic_compare_exchange_weak_explicit(max, &current, value, memory_order_relaxed, memory_order_relaxed)) {
+        // another thread updated the maximum, retry against the new value
+    }
+}
 
 void metricsInit() {
     // Initialize all the metric values to zero.
-    memset(&metrics, 0, sizeof(metrics));
+    atomic_init(&metrics.currentConnectionCount, 0);
+    atomic_init(&metrics.totalConnectionCount, 0);
+    atomic_init(&metrics.maxConcurrentConnections, 0);
+    atomic_init(&metrics.totalBytesSent, 0);
+    atomic_init(&metrics.totalBytesReceived, 0);
+    atomic_init(&metrics.blockingJobsDispatched, 0);
+    atomic_init(&metrics.blockingQueueMaxDepth, 0);
+    atomic_init(&metrics.blockingLatencyTotalUs, 0);
+    atomic_init(&metrics.blockingLatencyMaxUs, 0);
+    atomic_init(&metrics.jobsStarted, 0);
+    atomic_init(&metrics.jobsRejected, 0);
+    atomic_init(&metrics.jobWaitTotalUs, 0);
+    atomic_init(&metrics.jobWaitMaxUs, 0);
+    atomic_init(&metrics.dnsCacheHits, 0);
+    atomic_init(&metrics.dnsCacheMisses, 0);
+    atomic_init(&metrics.zerocopyBytes, 0);
+    atomic_init(&metrics.zerocopyCopiedBytes, 0);
+    for (int i = 0; i < METRICS_RELAY_BUFFER_CLASSES; i++)
+        atomic_init(&metrics.relayBuffers[i], 0);
+    atomic_init(&metrics.relayBufferGrowths, 0);
+    atomic_init(&metrics.relayBufferShrinks, 0);
+    atomic_init(&metrics.reclaimedSessions, 0);
+    for (int i = 0; i < METRICS_SLAB_COUNT; i++) {
+        atomic_init(&metrics.slabObjects[i], 0);
+        atomic_init(&metrics.slabMaxObjects[i], 0);
+        atomic_init(&metrics.slabBytes[i], 0);
+    }
 }
 
 void metricsRegisterNewClient() {
-    metrics.currentConnectionCount++;
-    metrics.totalConnectionCount++;
-    if (metrics.currentConnectionCount > metrics.maxConcurrentConnections)
-        metrics.maxConcurrentConnections = metrics.currentConnectionCount;
+    size_t current = atomic_fetch_add_explicit(&metrics.currentConnectionCount, 1, memory_order_relaxed) + 1;
+    atomic_fetch_add_explicit(&metrics.totalConnectionCount, 1, memory_order_relaxed);
+    updateMax(&metrics.maxConcurrentConnections, current);
 }
 
 void metricsRegisterClientDisconnected() {
-    metrics.currentConnectionCount--;
+    atomic_fetch_sub_explicit(&metrics.currentConnectionCount, 1, memory_order_relaxed);
 }
 
 void metricsRegisterBytesTransfered(size_t bytesSent, size_t bytesReceived) {
-    metrics.totalBytesSent += bytesSent;
-    metrics.totalBytesReceived += bytesReceived;
+    if (bytesSent != 0)
+        atomic_fetch_add_explicit(&metrics.totalBytesSent, bytesSent, memory_order_relaxed);
+    if (bytesReceived != 0)
+        atomic_fetch_add_explicit(&metrics.totalBytesReceived, bytesReceived, memory_order_relaxed);
+}
+
+void metricsRegisterZerocopy(size_t bytes, int copied) {
+    atomic_fetch_add_explicit(copied ? &metrics.zerocopyCopiedBytes : &metrics.zerocopyBytes, bytes, memory_order_relaxed);
+}
+
+static unsigned relayBufferClass(size_t size) {
+    unsigned c = 0;
+    while (c + 1 < METRICS_RELAY_BUFFER_CLASSES && ((size_t)METRICS_RELAY_BUFFER_MIN << c) < size)
+        c++;
+    return c;
+}
+
+void metricsRegisterRelayBuffer(size_t oldSize, size_t newSize) {
+    if (oldSize != 0)
+        atomic_fetch_sub_explicit(&metrics.relayBuffers[relayBufferClass(oldSize)], 1, memory_order_relaxed);
+    if (newSize != 0)
+        atomic_fetch_add_explicit(&metrics.relayBuffers[relayBufferClass(newSize)], 1, memory_order_relaxed);
+    if (oldSize != 0 && newSize > oldSize)
+        atomic_fetch_add_explicit(&metrics.relayBufferGrowths, 1, memory_order_relaxed);
+    else if (newSize != 0 && newSize < oldSize)
+        atomic_fetch_add_explicit(&metrics.relayBufferShrinks, 1, memory_order_relaxed);
+}
+
+void metricsRegisterSessionReclaimed() {
+    atomic_fetch_add_explicit(&metrics.reclaimedSessions, 1, memory_order_relaxed);
+}
+
+void metricsRegisterSlabObject(TMetricsSlab slab, int allocated) {
+    if (allocated) {
+        size_t current = atomic_fetch_add_explicit(&metrics.slabObjects[slab], 1, memory_order_relaxed) + 1;
+        updateMax(&metrics.slabMaxObjects[slab], current);
+    } else {
+        atomic_fetch_sub_explicit(&metrics.slabObjects[slab], 1, memory_order_relaxed);
+    }
+}
+
+void metricsRegisterSlabMemory(TMetricsSlab slab, size_t reserved, size_t released) {
+    if (reserved != 0)
+        atomic_fetch_add_explicit(&metrics.slabBytes[slab], reserved, memory_order_relaxed);
+    if (released != 0)
+        atomic_fetch_sub_explicit(&metrics.slabBytes[slab], released, memory_order_relaxed);
+}
+
+void metricsRegisterBlockingQueueDepth(size_t depth) {
+    updateMax(&metrics.blockingQueueMaxDepth, depth);
+}
+
+void metricsRegisterBlockingJobDispatched(uint64_t latencyUs) {
+    atomic_fetch_add_explicit(&metrics.blockingJobsDispatched, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics.blockingLatencyTotalUs, latencyUs, memory_order_relaxed);
+    updateMax(&metrics.blockingLatencyMaxUs, latencyUs);
+}
+
+void metricsRegisterJobStarted(uint64_t waitUs) {
+    atomic_fetch_add_explicit(&metrics.jobsStarted, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics.jobWaitTotalUs, waitUs, memory_order_relaxed);
+    updateMax(&metrics.jobWaitMaxUs, waitUs);
+}
+
+void metricsRegisterJobRejected() {
+    atomic_fetch_add_explicit(&metrics.jobsRejected, 1, memory_order_relaxed);
+}
+
+void metricsRegisterDnsCacheLookup(bool hit) {
+    atomic_fetch_add_explicit(hit ? &metrics.dnsCacheHits : &metrics.dnsCacheMisses, 1, memory_order_relaxed);
+}
+
+void metricsRegisterLoopIteration(uint64_t pollUs, uint64_t iterationUs, size_t readyFds) {
+    TLoopStats* stats = getThreadLoopStats();
+    histogramAdd(stats->pollUs, pollUs);
+    histogramAdd(stats->iterationUs, iterationUs);
+    histogramAdd(stats->readyFds, readyFds);
+}
+
+void metricsRegisterHandlerTime(TMetricsHandler handler, uint64_t us) {
+    histogramAdd(getThreadLoopStats()->handlerUs[handler], us);
 }
 
 void getMetricsSnapshot(TMetricsSnapshot* snapshot) {
-    memcpy(snapshot, &metrics, sizeof(TMetricsSnapshot));
+    memset(snapshot, 0, sizeof(TMetricsSnapshot));
+    snapshot->currentConnectionCount = atomic_load_explicit(&metrics.currentConnectionCount, memory_order_relaxed);
+    snapshot->totalConnectionCount = atomic_load_explicit(&metrics.totalConnectionCount, memory_order_relaxed);
+    snapshot->maxConcurrentConnections = atomic_load_explicit(&metrics.maxConcurrentConnections, memory_order_relaxed);
+    snapshot->totalBytesSent = atomic_load_explicit(&metrics.totalBytesSent, memory_order_relaxed);
+    snapshot->totalBytesReceived = atomic_load_explicit(&metrics.totalBytesReceived, memory_order_relaxed);
+    snapshot->blockingJobsDispatched = atomic_load_explicit(&metrics.blockingJobsDispatched, memory_order_relaxed);
+    snapshot->blockingQueueMaxDepth = atomic_load_explicit(&metrics.blockingQueueMaxDepth, memory_order_relaxed);
+    snapshot->blockingLatencyTotalUs = atomic_load_explicit(&metrics.blockingLatencyTotalUs, memory_order_relaxed);
+    snapshot->blockingLatencyMaxUs = atomic_load_explicit(&metrics.blockingLatencyMaxUs, memory_order_relaxed);
+    snapshot->jobsStarted = atomic_load_explicit(&metrics.jobsStarted, memory_order_relaxed);
+    snapshot->jobsRejected = atomic_load_explicit(&metrics.jobsRejected, memory_order_relaxed);
+    snapshot->jobWaitTotalUs = atomic_load_explicit(&metrics.jobWaitTotalUs, memory_order_relaxed);
+    snapshot->jobWaitMaxUs = atomic_load_explicit(&metrics.jobWaitMaxUs, memory_order_relaxed);
+    snapshot->dnsCacheHits = atomic_load_explicit(&metrics.dnsCacheHits, memory_order_relaxed);
+    snapshot->dnsCacheMisses = atomic_load_explicit(&metrics.dnsCacheMisses, memory_order_relaxed);
+    snapshot->zerocopyBytes = atomic_load_explicit(&metrics.zerocopyBytes, memory_order_relaxed);
+    snapshot->zerocopyCopiedBytes = atomic_load_explicit(&metrics.zerocopyCopiedBytes, memory_order_relaxed);
+    for (int i = 0; i < METRICS_RELAY_BUFFER_CLASSES; i++)
+        snapshot->relayBuffers[i] = atomic_load_explicit(&metrics.relayBuffers[i], memory_order_relaxed);
+    snapshot->relayBufferGrowths = atomic_load_explicit(&metrics.relayBufferGrowths, memory_order_relaxed);
+    snapshot->relayBufferShrinks = atomic_load_explicit(&metrics.relayBufferShrinks, memory_order_relaxed);
+    snapshot->reclaimedSessions = atomic_load_explicit(&metrics.reclaimedSessions, memory_order_relaxed);
+    for (int i = 0; i < METRICS_SLAB_COUNT; i++) {
+        snapshot->slabObjects[i] = atomic_load_explicit(&metrics.slabObjects[i], memory_order_relaxed);
+        snapshot->slabMaxObjects[i] = atomic_load_explicit(&metrics.slabMaxObjects[i], memory_order_relaxed);
+        snapshot->slabBytes[i] = atomic_load_explicit(&metrics.slabBytes[i], memory_order_relaxed);
+    }
+
+    unsigned used = atomic_load(&loopStatsUsed);
+    for (unsigned i = 0; i < used && i < LOOP_STATS_SLOTS; i++) {
+        const TLoopStats* stats = &loopStats[i];
+        histogramSum(&snapshot->loopIterationUs, stats->iterationUs);
+        histogramSum(&snapshot->loopPollUs, stats->pollUs);
+        histogramSum(&snapshot->loopReadyFds, stats->readyFds);
+        for (int h = 0; h < METRICS_HANDLER_COUNT; h++)
+            histogramSum(&snapshot->handlerUs[h], stats->handlerUs[h]);
+    }
 }
@@ -1,8 +1,50 @@
 #ifndef _METRICS_H_
 #define _METRICS_H_
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+/**
+ * Amount of buckets of the timing histograms. Bucket 0 counts the values under 1, and bucket i
+ * counts the values in [2^(i-1), 2^i). The last bucket also counts everything above.
+ */
+#define METRICS_HISTOGRAM_BUCKETS 16
+
+/**
+ * Relay buffers come in power of two sizes: class i holds METRICS_RELAY_BUFFER_MIN << i bytes.
+ */
+#define METRICS_RELAY_BUFFER_MIN 4096
+#define METRICS_RELAY_BUFFER_CLASSES 9
+
+/**
+ * The kinds of selector handlers whose callbacks are timed separately.
+ */
+typedef enum {
+    /** Handlers without a tag: the selector's own wakeups and io_uring completions. */
+    METRICS_HANDLER_OTHER = 0,
+    METRICS_HANDLER_SOCKS5,
+    METRICS_HANDLER_MGMT,
+    METRICS_HANDLER_LOGGER,
+    METRICS_HANDLER_COUNT,
+} TMetricsHandler;
+
+/**
+ * The kinds of objects allocated from the per-worker slabs (see slab.h).
+ */
+typedef enum {
+    METRICS_SLAB_SOCKS5 = 0,
+    METRICS_SLAB_MGMT,
+    METRICS_SLAB_COUNT,
+} TMetricsSlab;
+
+/**
+ * A histogram with exponential buckets, see METRICS_HISTOGRAM_BUCKETS.
+ */
+typedef struct {
+    size_t buckets[METRICS_HISTOGRAM_BUCKETS];
+} TMetricsHistogram;
+
 /**
  * Represents a snapshot of the proxy server's metrics.
  */
@@ -32,6 +74,108 @@ typedef struct {
      * The total amount of bytes received by clients from origin servers through this proxy.
      */
     size_t totalBytesReceived;
+
+    /**
+     * The total amount of blocking job completions (e.g. name resolutions) dispatched by the selectors.
+     */
+    size_t blockingJobsDispatched;
+
+    /**
+     * The maximum amount of blocking job completions that were waiting to be dispatched at once.
+     */
+    size_t blockingQueueMaxDepth;
+
+    /**
+     * The sum of the latencies, in microseconds, from a blocking job completion until its dispatch.
+     */
+    size_t blockingLatencyTotalUs;
+
+    /**
+     * The maximum latency, in microseconds, from a blocking job completion until its dispatch.
+     */
+    size_t blockingLatencyMaxUs;
+
+    /**
+     * The total amount of blocking jobs the resolver pool started, and of jobs it rejected because
+     * its queue was full.
+     */
+    size_t jobsStarted;
+    size_t jobsRejected;
+
+    /**
+     * The sum of the times, in microseconds, blocking jobs waited in the resolver pool's queue
+     * for a free thread, and the maximum of those times.
+     */
+    size_t jobWaitTotalUs;
+    size_t jobWaitMaxUs;
+
+    /**
+     * The total amount of lookups into the workers' DNS caches that found a live entry, and
+     * of lookups that had to query a nameserver.
+     */
+    size_t dnsCacheHits;
+    size_t dnsCacheMisses;
+
+    /**
+     * The total amount of relayed bytes the kernel sent straight from the relay buffers (MSG_ZEROCOPY).
+     */
+    size_t zerocopyBytes;
+
+    /**
+     * The total amount of relayed bytes sent with MSG_ZEROCOPY that the kernel ended up copying anyway
+     * (e.g. the destination is a local socket).
+     */
+    size_t zerocopyCopiedBytes;
+
+    /**
+     * The amount of relay buffers in use at the time this snapshot was taken, by size class
+     * (see METRICS_RELAY_BUFFER_CLASSES).
+     */
+    size_t relayBuffers[METRICS_RELAY_BUFFER_CLASSES];
+
+    /**
+     * The total amount of times a relay buffer was grown or shrunk.
+     */
+    size_t relayBufferGrowths;
+    size_t relayBufferShrinks;
+
+    /**
+     * The total amount of sessions closed because the kernel declared a peer dead (keepalive
+     * probes or TCP_USER_TIMEOUT went unanswered).
+     */
+    size_t reclaimedSessions;
+
+    /**
+     * The amount of objects taken from the slabs at the time this snapshot was taken, and the
+     * maximum throughout the proxy's lifetime, by kind of object (see TMetricsSlab).
+     */
+    size_t slabObjects[METRICS_SLAB_COUNT];
+    size_t slabMaxObjects[METRICS_SLAB_COUNT];
+
+    /**
+     * The amount of memory, in bytes, the slabs have reserved, by kind of object.
+     */
+    size_t slabBytes[METRICS_SLAB_COUNT];
+
+    /**
+     * Time, in microseconds, each event loop iteration spent dispatching the ready events.
+     */
+    TMetricsHistogram loopIterationUs;
+
+    /**
+     * Time, in microseconds, each event loop iteration spent blocked waiting for events.
+     */
+    TMetricsHistogram loopPollUs;
+
+    /**
+     * Amount of ready file descriptors returned on each event loop iteration.
+     */
+    TMetricsHistogram loopReadyFds;
+
+    /**
+     * Time, in microseconds, spent inside each handler callback, by kind of handler.
+     */
+    TMetricsHistogram handlerUs[METRICS_HANDLER_COUNT];
 } TMetricsSnapshot;
 
 /**
@@ -57,6 +201,87 @@ void metricsRegisterClientDisconnected();
  */
 void metricsRegisterBytesTransfered(size_t bytesSent, size_t bytesReceived);
 
+/**
+ * @brief Registers into the metrics the completion of relay writes sent with MSG_ZEROCOPY.
+ * @param bytes The amount of bytes those writes sent.
+ * @param copied Whether the kernel reported that it had to copy them.
+ */
+void metricsRegisterZerocopy(size_t bytes, int copied);
+
+/**
+ * @brief Registers into the metrics that a relay buffer was allocated, resized or released.
+ * @param oldSize The previous size of the buffer, or 0 if it was just allocated.
+ * @param newSize The new size of the buffer, or 0 if it was released.
+ */
+void metricsRegisterRelayBuffer(size_t oldSize, size_t newSize);
+
+/**
+ * @brief Registers into the metrics that a session was closed because the kernel declared
+ * one of its peers dead.
+ */
+void metricsRegisterSessionReclaimed();
+
+/**
+ * @brief Registers into the metrics that an object was taken from or returned to a slab.
+ * @param slab The kind of object.
+ * @param allocated Whether the object was taken (non zero) or returned (zero).
+ */
+void metricsRegisterSlabObject(TMetricsSlab slab, int allocated);
+
+/**
+ * @brief Registers into the metrics that a slab reserved or released memory.
+ * @param slab The kind of object the slab holds.
+ * @param reserved The amount of bytes reserved.
+ * @param released The amount of bytes released.
+ */
+void metricsRegisterSlabMemory(TMetricsSlab slab, size_t reserved, size_t released);
+
+/**
+ * @brief Registers into the metrics how many blocking job completions a selector found waiting
+ * when it woke up to dispatch them.
+ * @param depth The amount of completions waiting to be dispatched.
+ */
+void metricsRegisterBlockingQueueDepth(size_t depth);
+
+/**
+ * @brief Registers into the metrics that a blocking job completion was dispatched.
+ * @param latencyUs The time elapsed, in microseconds, since the job notified its completion.
+ */
+void metricsRegisterBlockingJobDispatched(uint64_t latencyUs);
+
+/**
+ * @brief Registers into the metrics that a thread of the resolver pool started a blocking job.
+ * @param waitUs The time, in microseconds, the job waited in the queue.
+ */
+void metricsRegisterJobStarted(uint64_t waitUs);
+
+/**
+ * @brief Registers into the metrics that a blocking job was rejected because the resolver
+ * pool's queue was full.
+ */
+void metricsRegisterJobRejected();
+
+/**
+ * @brief Registers into the metrics a lookup into a worker's DNS cache.
+ * @param hit Whether the lookup found a live entry.
+ */
+void metricsRegisterDnsCacheLookup(bool hit);
+
+/**
+ * @brief Registers into the metrics an event loop iteration of the calling thread.
+ * @param pollUs The time, in microseconds, blocked waiting for events.
+ * @param iterationUs The time, in microseconds, spent dispatching the events.
+ * @param readyFds The amount of ready file descriptors.
+ */
+void metricsRegisterLoopIteration(uint64_t pollUs, uint64_t iterationUs, size_t readyFds);
+
+/**
+ * @brief Registers into the metrics the time spent inside a handler callback.
+ * @param handler The kind of handler.
+ * @param us The time, in microseconds, spent inside the callback.
+ */
+void metricsRegisterHandlerTime(TMetricsHandler handler, uint64_t us);
+
 /**
  * @brief Gets a snapshot of the server's current metrics.
  * @param snapshot A pointer to the struct to where the metrics snapshot will be written.
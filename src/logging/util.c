@@ -55,7 +55,7 @@ const char* printProtocol(int protocol) {
 }
 
 const char* printFlags(int flags) {
-    static char flagsBuf[FLAGSTR_BUFLEN];
+    static _Thread_local char flagsBuf[FLAGSTR_BUFLEN];
 
     strcpy(flagsBuf, "flags");
     if (flags == 0) {
@@ -82,7 +82,7 @@ const char* printAddressPort(int family, struct sockaddr* address) {
     if (address == NULL)
         return "unknown address";
 
-    static char addrBuffer[ADDRSTR_BUFLEN];
+    static _Thread_local char addrBuffer[ADDRSTR_BUFLEN];
     char abuf[INET6_ADDRSTRLEN];
     const char* addrAux;
     if (family == AF_INET) {
@@ -113,7 +113,7 @@ const char* printSocketAddressWith(const struct sockaddr* address, const char se
     if (address == NULL)
         return "unknown address";
 
-    static char addrBuffer[ADDRSTR_BUFLEN];
+    static _Thread_local char addrBuffer[ADDRSTR_BUFLEN];
     void* numericAddress;
     in_port_t port;
 
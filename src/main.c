@@ -1,32 +1,156 @@
 // This is a personal academic project. Dear PVS-Studio, please check it.
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE // SO_REUSEPORT en glibc
+#endif
 #include "args.h"
+#include "dns.h"
 #include "logging/logger.h"
 #include "logging/util.h"
 #include "mgmt/mgmt.h"
 #include "logging/metrics.h"
 #include "negotiation/negotiationParser.h"
+#include "request/request.h"
 #include "selector.h"
+#include "slab.h"
 #include "socks5.h"
+#include "uring.h"
 #include "users.h"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
-static bool terminationRequested = false;
+/** operaciones que se pueden preparar en io_uring por iteración */
+#define URING_ENTRIES 1024
+
+/** backlog de los sockets pasivos */
+#define LISTEN_BACKLOG 20
+
+/** memoria máxima del slab de clientes de management */
+#define MGMT_SLAB_BYTES (1024 * 1024)
+
+// lo leen todos los hilos worker
+static atomic_bool terminationRequested = false;
 
 static void sigterm_handler(const int signal) {
     logf(LOG_INFO, "Signal %d, cleaning up and exiting", signal);
     terminationRequested = true;
 }
 
+/**
+ * Un event loop que atiende conexiones socks. Cada worker tiene su propio
+ * selector, su propio socket pasivo y sus propias sesiones; el kernel reparte
+ * las conexiones entrantes entre los sockets gracias a SO_REUSEPORT.
+ * El worker 0 corre en el hilo principal junto con el management.
+ */
+typedef struct {
+    TSelector selector;
+    TUring ring;
+    TDns dns;
+    TSlab sessions;
+    int server;
+    bool uringEnabled;
+    bool dnsEnabled;
+    unsigned dnsCacheEntries;
+    pthread_t thread;
+} TWorker;
+
+static const TFdHandler socksv5 = {
+    .handle_read = socksv5PassivAccept,
+    .handle_write = NULL,
+    .handle_close = NULL, // nada que liberar
+    .stats_tag = METRICS_HANDLER_SOCKS5,
+};
+
+/**
+ * comienza a aceptar conexiones en el socket pasivo del worker: mediante
+ * io_uring si fue pedido y está disponible, sino con el selector.
+ * Debe llamarse desde el hilo del worker.
+ */
+static TSelectorStatus workerListen(TWorker* w) {
+    socksv5UseSlab(w->sessions);
+    if (w->dnsEnabled) {
+        w->dns = dns_new(w->selector, DNS_RESOLV_CONF, DNS_HOSTS, w->dnsCacheEntries);
+        if (w->dns == NULL) {
+            log(LOG_WARNING, "Unable to create the DNS resolver, falling back to getaddrinfo");
+        }
+    }
+    requestUseResolver(w->dns);
+    if (w->uringEnabled) {
+        w->ring = uring_new(w->selector, URING_ENTRIES);
+        if (w->ring == NULL) {
+            log(LOG_WARNING, "io_uring is not available, falling back to the selector");
+        } else {
+            copyUseUring(w->ring);
+            if (socksv5UringListen(w->ring, w->selector, w->server)) {
+                return SELECTOR_SUCCESS;
+            }
+        }
+    }
+    return selector_register(w->selector, w->server, &socksv5, OP_READ, NULL);
+}
+
+/** ejecuta una iteración del event loop del worker */
+static TSelectorStatus workerIterate(TWorker* w) {
+    if (w->ring != NULL) {
+        // todo lo preparado en la iteración anterior sale en un único io_uring_enter
+        uring_submit(w->ring);
+    }
+    return selector_select(w->selector);
+}
+
+/** libera el motor io_uring del worker. Debe llamarse desde el hilo del worker */
+static void workerStopUring(TWorker* w) {
+    if (w->ring != NULL) {
+        // las operaciones en vuelo se cancelan junto con el motor
+        copyUseUring(NULL);
+        uring_destroy(w->ring);
+        w->ring = NULL;
+    }
+}
+
+static void* workerRun(void* arg) {
+    TWorker* w = arg;
+    TSelectorStatus ss = workerListen(w);
+    while (ss == SELECTOR_SUCCESS && !terminationRequested) {
+        ss = workerIterate(w);
+    }
+    if (ss != SELECTOR_SUCCESS) {
+        logf(LOG_ERROR, "Socks worker stopped: %s", ss == SELECTOR_IO ? strerror(errno) : selector_error(ss));
+    }
+    workerStopUring(w);
+    copyRelayPoolDestroy();
+    return NULL;
+}
+
+/**
+ * crea el socket pasivo de un worker adicional, escuchando en la misma
+ * dirección que el del worker 0.
+ */
+static int workerSocket(const struct sockaddr_storage* addr, socklen_t addrLen) {
+    int fd = socket(addr->ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) < 0 || bind(fd, (const struct sockaddr*)addr, addrLen) < 0 ||
+        listen(fd, LISTEN_BACKLOG) < 0 || selector_fd_set_nio(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
 static int setupSockAddr(char* addr, unsigned short port, void* res, socklen_t* socklenResult) {
     int ipv6 = strchr(addr, ':') != NULL;
 
@@ -72,16 +196,32 @@ int main(const int argc, char** argv) {
     // no tenemos nada que leer de stdin
     close(STDIN_FILENO);
 
+    // Cada sesión usa dos fds: subimos el límite blando de RLIMIT_NOFILE al
+    // máximo permitido. El selector dimensiona su tabla a partir de este límite.
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max) {
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+
     // Creamos el selector
     const char* err_msg = NULL;
     TSelectorStatus ss = SELECTOR_SUCCESS;
     TSelector selector = NULL;
+    TWorker workers[MAX_ARGS_WORKERS];
+    TSlab mgmtSlab = NULL;
+    int workersCount = 0;  // workers inicializados en `workers'
+    int workersRunning = 0; // workers adicionales con su hilo lanzado
+    struct socks5args args;
+    parse_args(argc, argv, &args);
+
     const TSelectorInit conf = {
-        .signal = SIGALRM,
         .select_timeout = {
             .tv_sec = 10,
             .tv_nsec = 0,
         },
+        .job_threads = args.resolverThreads,
+        .job_queue = args.resolverQueue,
     };
     if (0 != selector_init(&conf)) {
         // NOTE: Can't do logging without a selector
@@ -102,17 +242,28 @@ int main(const int argc, char** argv) {
     usersInit(NULL);
     changeAuthMethod(NEG_METHOD_PASS); // Initially, authentication with user&pass is required.
 
-    struct socks5args args;
-    parse_args(argc, argv, &args);
-
     for (int i = 0; i < args.nusers; ++i) {
         usersCreate(args.users[i].name, args.users[i].pass, 0, UPRIV_USER, 0);
     }
+    if (args.rateLimit != 0) {
+        usersSetRateLimit(NULL, args.rateLimit);
+    }
 
     if(!args.disectorsEnabled){
         turnOffPDissector();
     }
 
+    socksv5SetTimeout(SOCKS_TIMEOUT_HANDSHAKE, args.handshakeTimeout);
+    socksv5SetTimeout(SOCKS_TIMEOUT_CONNECT, args.connectTimeout);
+    socksv5SetTimeout(SOCKS_TIMEOUT_IDLE, args.idleTimeout);
+    socksv5SetKeepalive(args.keepaliveIdle, args.keepaliveInterval, args.keepaliveCount);
+    socksv5SetUserTimeout(args.userTimeout);
+    copyUseEdgeTriggered(args.edgeTriggered, args.relayBudget);
+    copyUseSplice(args.spliceEnabled);
+    copyUseZerocopy(args.zerocopyThreshold);
+    copyUseBufferSizes(args.relayBufferMin, args.relayBufferMax);
+    copyUseWatermarks(args.notsentLowat, args.highWatermark);
+
     // Listening on just IPv6 allow us to handle both IPv6 and IPv4 connections!
     // https://stackoverflow.com/questions/50208540/cant-listen-on-ipv4-and-ipv6-together-address-already-in-use
 
@@ -138,12 +289,18 @@ int main(const int argc, char** argv) {
     // man 7 ip. no importa reportar nada si falla.
     setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
 
+    // con varios workers cada uno tiene su socket pasivo en el mismo puerto
+    if (args.workers > 1 && setsockopt(server, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) < 0) {
+        err_msg = "Unable to set SO_REUSEPORT";
+        goto finally;
+    }
+
     if (bind(server, (struct sockaddr*)&auxAddr, auxAddrLen) < 0) {
         err_msg = "Unable to bind socket";
         goto finally;
     }
 
-    if (listen(server, 20) < 0) {
+    if (listen(server, LISTEN_BACKLOG) < 0) {
         err_msg = "Unable to listen";
         goto finally;
     }
@@ -161,6 +318,39 @@ int main(const int argc, char** argv) {
         logf(LOG_OUTPUT, "Listening for socks5 connections on TCP port %d", args.socksPort);
     }
 
+    // el worker 0 usa el selector y el socket del hilo principal
+    workers[0] = (TWorker){
+        .selector = selector,
+        .sessions = slab_new(sizeof(TClientData), args.sessionSlabBytes, METRICS_SLAB_SOCKS5),
+        .server = server,
+        .uringEnabled = args.uringEnabled,
+        .dnsEnabled = args.dnsEnabled,
+        .dnsCacheEntries = args.dnsCacheEntries,
+    };
+    workersCount = 1;
+    if (workers[0].sessions == NULL) {
+        err_msg = "Unable to create socks5 worker";
+        goto finally;
+    }
+
+    // los workers adicionales escuchan en la dirección efectiva del primero
+    for (; workersCount < args.workers; workersCount++) {
+        TWorker* w = &workers[workersCount];
+        *w = (TWorker){
+            .selector = selector_new(1024),
+            .sessions = slab_new(sizeof(TClientData), args.sessionSlabBytes, METRICS_SLAB_SOCKS5),
+            .server = workerSocket(&auxAddr, auxAddrLen),
+            .uringEnabled = args.uringEnabled,
+            .dnsEnabled = args.dnsEnabled,
+            .dnsCacheEntries = args.dnsCacheEntries,
+        };
+        if (w->selector == NULL || w->sessions == NULL || w->server < 0) {
+            err_msg = "Unable to create socks5 worker";
+            workersCount++;
+            goto finally;
+        }
+    }
+
     // MANAGEMENT
     memset(&auxAddr, 0, sizeof(auxAddr));
     auxAddrLen = sizeof(auxAddr);
@@ -183,7 +373,7 @@ int main(const int argc, char** argv) {
         goto finally;
     }
 
-    if (listen(mgmtServer, 20) < 0) {
+    if (listen(mgmtServer, LISTEN_BACKLOG) < 0) {
         err_msg = "Unable to listen";
         goto finally;
     }
@@ -206,32 +396,53 @@ int main(const int argc, char** argv) {
     signal(SIGTERM, sigterm_handler);
     signal(SIGINT, sigterm_handler);
 
-    const TFdHandler socksv5 = {
-        .handle_read = socksv5PassivAccept,
-        .handle_write = NULL,
-        .handle_close = NULL, // nada que liberar
-    };
-
     const TFdHandler management = {
         .handle_read = mgmtPassiveAccept,
         .handle_write = NULL,
         .handle_close = NULL, // nada que liberar
+        .stats_tag = METRICS_HANDLER_MGMT,
     };
 
-    ss = selector_register(selector, server, &socksv5, OP_READ, NULL);
+    ss = workerListen(&workers[0]);
     if (ss != SELECTOR_SUCCESS) {
         err_msg = "Registering fd";
         goto finally;
     }
 
+    mgmtSlab = slab_new(sizeof(TMgmtClient), MGMT_SLAB_BYTES, METRICS_SLAB_MGMT);
+    if (mgmtSlab == NULL) {
+        err_msg = "Unable to create management slab";
+        goto finally;
+    }
+    mgmtUseSlab(mgmtSlab);
+
     ss = selector_register(selector, mgmtServer, &management, OP_READ, NULL);
     if (ss != SELECTOR_SUCCESS) {
         err_msg = "Registering fd";
         goto finally;
     }
+
+    // las señales de terminación las atiende solo el hilo principal
+    sigset_t terminationSignals, previousMask;
+    sigemptyset(&terminationSignals);
+    sigaddset(&terminationSignals, SIGTERM);
+    sigaddset(&terminationSignals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &terminationSignals, &previousMask);
+    for (; workersRunning + 1 < workersCount; workersRunning++) {
+        TWorker* w = &workers[workersRunning + 1];
+        if (pthread_create(&w->thread, NULL, workerRun, w) != 0) {
+            err_msg = "Unable to start socks5 worker thread";
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previousMask, NULL);
+    if (workersRunning + 1 < workersCount) {
+        goto finally;
+    }
+
     while (!terminationRequested) {
         err_msg = NULL;
-        ss = selector_select(selector);
+        ss = workerIterate(&workers[0]);
         if (ss != SELECTOR_SUCCESS) {
             err_msg = "Serving";
             goto finally;
@@ -243,8 +454,30 @@ int main(const int argc, char** argv) {
 
     int ret = 0;
 finally:
+    // detenemos los workers antes de liberar lo que comparten. errno se
+    // preserva para el reporte de más abajo.
+    terminationRequested = true;
+    const int finallyErrno = errno;
+    for (int i = 1; i <= workersRunning; i++) {
+        selector_wakeup(workers[i].selector);
+        pthread_join(workers[i].thread, NULL);
+    }
+    if (workersCount > 0) {
+        workerStopUring(&workers[0]);
+    }
+    // sin resoluciones en curso: las que quedan se despachan al destruir cada selector
+    selector_close();
+    for (int i = 1; i < workersCount; i++) {
+        if (workers[i].selector != NULL) {
+            selector_destroy(workers[i].selector);
+        }
+        if (workers[i].server >= 0) {
+            close(workers[i].server);
+        }
+    }
     usersFinalize();
     loggerFinalize();
+    errno = finallyErrno;
     if (ss != SELECTOR_SUCCESS) {
         fprintf(stderr, "%s: %s\n", (err_msg == NULL) ? "Unknown error" : err_msg, ss == SELECTOR_IO ? strerror(errno) : selector_error(ss));
         ret = 2;
@@ -257,13 +490,20 @@ finally:
     if (selector != NULL) {
         selector_destroy(selector);
     }
-    selector_close();
+    copyRelayPoolDestroy();
+    // recién ahora no quedan sesiones: las de los demás workers se liberaron
+    // al destruir sus selectores en este hilo, cada una hacia su propio slab
+    for (int i = 0; i < workersCount; i++) {
+        slab_destroy(workers[i].sessions);
+        dns_destroy(workers[i].dns);
+    }
+    slab_destroy(mgmtSlab);
 
     if (server >= 0) {
         close(server);
     }
     if (mgmtServer >= 0) {
-        close(server);
+        close(mgmtServer);
     }
     return ret;
 }
@@ -3,10 +3,18 @@
 
 #include "mgmt.h"
 #include "../logging/logger.h"
+#include "../logging/metrics.h"
 #include "../logging/util.h"
 #include "mgmtAuth.h"
 #include "mgmtRequest.h"
 
+/** slab del que salen los clientes de management, ver `mgmtUseSlab' */
+static _Thread_local TSlab mgmtSlab = NULL;
+
+void mgmtUseSlab(TSlab slab) {
+    mgmtSlab = slab;
+}
+
 static void mgmtdoneArrival(const unsigned state, TSelectorKey* key) {
     log(LOG_DEBUG, "mgmtdoneArrival: Done state");
 }
@@ -54,6 +62,7 @@ static TFdHandler handler = {
     .handle_write = mgmt_write,
     .handle_close = mgmt_close,
     .handle_block = mgmt_block,
+    .stats_tag = METRICS_HANDLER_MGMT,
 };
 
 void mgmt_close(TSelectorKey* key) {
@@ -95,16 +104,12 @@ void mgmtPassiveAccept(TSelectorKey* key) {
         logf(LOG_WARNING, "Management socket: accept() returned negative value: %d", newClientSocket);
         return;
     }
-    if (newClientSocket > 1023) {
-        close(newClientSocket);
-        return;
-    }
 
-    // Consider using a function to initialize the TClientData structure.
-    TMgmtClient* clientData = calloc(1, sizeof(TMgmtClient));
+    // el slab no lo pone en cero: los estados inicializan sus campos al arribar
+    TMgmtClient* clientData = slab_alloc(mgmtSlab);
     if (clientData == NULL) {
         close(newClientSocket);
-        logf(LOG_WARNING, "Management new client from %s with fd %d rejected because fd was too high", printSocketAddress((struct sockaddr*)&clientAddress), newClientSocket);
+        logf(LOG_WARNING, "Management new client from %s with fd %d rejected because the management slab is full", printSocketAddress((struct sockaddr*)&clientAddress), newClientSocket);
         return;
     }
 
@@ -123,7 +128,7 @@ void mgmtPassiveAccept(TSelectorKey* key) {
 
     if (status != SELECTOR_SUCCESS) {
         logf(LOG_ERROR, "Management new client from %s with fd %d rejected because registering into selector failed: %s", printSocketAddress((struct sockaddr*)&clientAddress), newClientSocket, selector_error(status));
-        free(clientData);
+        slab_free(mgmtSlab, clientData);
         return;
     }
 
@@ -153,5 +158,5 @@ static void mgmtClose_connection(TSelectorKey* key) {
     //     }
     // }
 
-    free(data);
+    slab_free(mgmtSlab, data);
 }
@@ -4,6 +4,7 @@
 #include "../auth/authParser.h"
 #include "../buffer.h"
 #include "../selector.h"
+#include "../slab.h"
 #include "../stm.h"
 #include "mgmtCmdParser.h"
 #include <stdio.h>
@@ -27,6 +28,11 @@ typedef struct {
     TMgmtCmd cmd;
     int clientFd;
 
+    // CONNECTIONS se envía de a un buffer por vez: id de la última sesión
+    // enviada, y si ya no quedan más
+    unsigned long connectionsCursor;
+    bool connectionsDone;
+
     struct buffer readBuffer;
     struct buffer writeBuffer;
     uint8_t readRawBuffer[MGMT_BUFFER_SIZE];
@@ -64,6 +70,13 @@ enum mgmt_state {
 
 };
 
+/**
+ * @brief Sets the slab the management clients are allocated from. Must be called from the
+ * thread that serves management before it accepts clients
+ * @param slab a slab of sizeof(TMgmtClient) objects
+ */
+void mgmtUseSlab(TSlab slab);
+
 /**
  * @brief Handler to accept connections for server monitoring
  * @param key Selector key that holds information regarding the ready fd
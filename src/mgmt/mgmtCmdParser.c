@@ -4,7 +4,7 @@
 #include "mgmtCmdParser.h"
 #include "../logging/logger.h"
 
-#define MGMT_CMD_COUNT 10
+#define MGMT_CMD_COUNT 12
 
 typedef TMgmtState (*parseCharacter)(TMgmtParser* p, uint8_t c);
 
@@ -69,6 +69,16 @@ static TCmd commands[] = {
         .argc = 0,
         // NO ARGS -> NO ARG TYPE
     },
+    {
+        .id = MGMT_CMD_SET_RATE_LIMIT,
+        .argc = 2,
+        .argt = {STRING, STRING, EMPTY},
+    },
+    {
+        .id = MGMT_CMD_CONNECTIONS,
+        .argc = 0,
+        // NO ARGS -> NO ARG TYPE
+    },
 };
 
 static TMgmtState parseCmd(TMgmtParser* p, uint8_t c);
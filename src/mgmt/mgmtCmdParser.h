@@ -19,7 +19,9 @@ typedef enum TMgmtCmd {
     MGMT_CMD_SET_DISSECTOR_STATUS,
     MGMT_CMD_GET_AUTHENTICATION_STATUS,
     MGMT_CMD_SET_AUTHENTICATION_STATUS,
-    MGMT_CMD_STATISTICS
+    MGMT_CMD_STATISTICS,
+    MGMT_CMD_SET_RATE_LIMIT,
+    MGMT_CMD_CONNECTIONS
 } TMgmtCmd;
 
 typedef enum TMgmtState {
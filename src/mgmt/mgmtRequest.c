@@ -4,11 +4,16 @@
 #include "mgmtRequest.h"
 #include "../logging/logger.h"
 #include "../logging/metrics.h"
+#include "../logging/util.h"
 #include "../negotiation/negotiationParser.h"
 #include "../passwordDissector.h"
+#include "../socks5.h"
 #include "../users.h"
 #include "mgmt.h"
 #include "mgmtCmdParser.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 static uint8_t fillMgmtCmdAnswer(TMgmtParser* p, struct buffer* buffer, int fd);
 
@@ -18,6 +23,8 @@ void mgmtRequestReadInit(const unsigned state, TSelectorKey* key) {
     logf(LOG_DEBUG, "mgmtRequestReadInit: init at socket fd %d", key->fd);
     TMgmtClient* data = GET_ATTACHMENT(key);
     initMgmtCmdParser(&data->client.cmdParser);
+    data->connectionsCursor = 0;
+    data->connectionsDone = false;
 }
 unsigned mgmtRequestRead(TSelectorKey* key) {
     logf(LOG_DEBUG, "mgmtRequestRead: read at socket fd %d", key->fd);
@@ -285,6 +292,51 @@ static int handleChangeRoleCmdResponse(buffer* buffer, TMgmtParser* p, int fd) {
     return 0;
 }
 
+static int handleSetRateLimitCmdResponse(buffer* buffer, TMgmtParser* p, int fd) {
+    logf(LOG_INFO, "Management client %d requested command SET-RATE-LIMIT", fd);
+    size_t size;
+    uint8_t* ptr = buffer_write_ptr(buffer, &size);
+    char* username = p->args[0].string;
+    char* rate = p->args[1].string;
+
+    static const char* successMessage = "+OK rate limit successfully set";
+    static const char* wrongUsernameMessage = "-ERR user doesn't exist";
+    static const char* badRateMessage = "-ERR rate limit must be a number of bytes per second";
+    static const char* unkownErrorMessage = "-ERR can't set rate limit, try again";
+
+    const char* toReturn;
+
+    // the rate goes as a decimal string, since it doesn't fit in a byte
+    char* end;
+    errno = 0;
+    unsigned long long rateLimit = strtoull(rate, &end, 10);
+    if (*end != '\0' || rate[0] < '0' || rate[0] > '9' || errno == ERANGE || rateLimit > SIZE_MAX) {
+        toReturn = badRateMessage;
+    } else {
+        // "*" is the default for the sessions that didn't authenticate
+        TUserStatus status = usersSetRateLimit(strcmp(username, "*") == 0 ? NULL : username, (size_t)rateLimit);
+        switch (status) {
+            case EUSER_OK:
+                toReturn = successMessage;
+                break;
+            case EUSER_WRONGUSERNAME:
+                toReturn = wrongUsernameMessage;
+                break;
+            default:
+                toReturn = unkownErrorMessage;
+        }
+    }
+
+    size_t toReturnSize = strlen(toReturn);
+
+    if(toReturnSize > size){
+        return 1;
+    }
+    strcpy((char*)ptr, toReturn);
+    buffer_write_adv(buffer, toReturnSize);
+    return 0;
+}
+
 static int handleGetDissectorStatusCmdResponse(buffer* buffer, TMgmtParser* p, int fd) {
     logf(LOG_INFO, "Management client %d requested command GET-DISSECTOR-STATUS", fd);
     size_t size;
@@ -349,6 +401,24 @@ static void copyMetric(buffer* buffer, const char* metricString, size_t metricVa
     buffer_write_adv(buffer, len);
 }
 
+/**
+ * Writes a histogram as a line with its name followed by the count of each of its `count` buckets,
+ * separated by spaces. Returns 1 if it doesn't fit in the buffer.
+ */
+static int copyHistogram(buffer* buffer, const char* histogramString, const size_t* buckets, int count) {
+    size_t size;
+    char* ptr = (char*)buffer_write_ptr(buffer, &size);
+
+    int len = snprintf(ptr, size, "%s", histogramString);
+    for (int i = 0; i < count && len >= 0 && (size_t)len < size; i++)
+        len += snprintf(ptr + len, size - len, i == 0 ? "%zu" : " %zu", buckets[i]);
+    if (len < 0 || (size_t)len >= size)
+        return 1;
+    ptr[len++] = '\n';
+    buffer_write_adv(buffer, len);
+    return 0;
+}
+
 static int handleStatisticsCmdResponse(buffer* buffer, TMgmtParser* p, int fd) {
     logf(LOG_INFO, "Management client %d requested command STATISTICS", fd);
     TMetricsSnapshot metrics;
@@ -362,9 +432,35 @@ static int handleStatisticsCmdResponse(buffer* buffer, TMgmtParser* p, int fd) {
     static const char* totalBytesRecv = "TBRECV:";
     static const char* totalBytesSent = "TBSENT:";
     static const char* totalConnectionCount = "TCON:";
-
-    const char* statsString[] = {connectionCount, maxConcurrmetrics, totalBytesRecv, totalBytesSent, totalConnectionCount};
-    size_t stats[] = {metrics.currentConnectionCount, metrics.maxConcurrentConnections, metrics.totalBytesReceived, metrics.totalBytesSent, metrics.totalConnectionCount};
+    static const char* blockingJobs = "BJOBS:";
+    static const char* blockingQueueMax = "BQMAX:";
+    static const char* blockingLatencyAvg = "BLATAVG:";
+    static const char* blockingLatencyMax = "BLATMAX:";
+    static const char* zerocopyBytes = "ZCBYTES:";
+    static const char* zerocopyCopiedBytes = "ZCCOPIED:";
+    static const char* relayBufferGrowths = "RBUFGROW:";
+    static const char* relayBufferShrinks = "RBUFSHRINK:";
+    static const char* reclaimedSessions = "RECLAIMED:";
+    static const char* slabSessions = "SLABSOCKS:";
+    static const char* slabSessionsMax = "SLABSOCKSMAX:";
+    static const char* slabMgmt = "SLABMGMT:";
+    static const char* slabMgmtMax = "SLABMGMTMAX:";
+    static const char* slabBytes = "SLABBYTES:";
+    static const char* jobsStarted = "JOBS:";
+    static const char* jobsRejected = "JOBREJECTED:";
+    static const char* jobWaitAvg = "JOBWAITAVG:";
+    static const char* jobWaitMax = "JOBWAITMAX:";
+    static const char* dnsCacheHits = "DNSHITS:";
+    static const char* dnsCacheMisses = "DNSMISSES:";
+    static const char* dnsCacheHitRatio = "DNSHITPCT:";
+
+    size_t blockingLatencyAvgUs = metrics.blockingJobsDispatched == 0 ? 0 : metrics.blockingLatencyTotalUs / metrics.blockingJobsDispatched;
+    size_t jobWaitAvgUs = metrics.jobsStarted == 0 ? 0 : metrics.jobWaitTotalUs / metrics.jobsStarted;
+    size_t dnsCacheLookups = metrics.dnsCacheHits + metrics.dnsCacheMisses;
+    size_t dnsCacheHitPct = dnsCacheLookups == 0 ? 0 : metrics.dnsCacheHits * 100 / dnsCacheLookups;
+
+    const char* statsString[] = {connectionCount, maxConcurrmetrics, totalBytesRecv, totalBytesSent, totalConnectionCount, blockingJobs, blockingQueueMax, blockingLatencyAvg, blockingLatencyMax, zerocopyBytes, zerocopyCopiedBytes, relayBufferGrowths, relayBufferShrinks, reclaimedSessions, slabSessions, slabSessionsMax, slabMgmt, slabMgmtMax, slabBytes, jobsStarted, jobsRejected, jobWaitAvg, jobWaitMax, dnsCacheHits, dnsCacheMisses, dnsCacheHitRatio};
+    size_t stats[] = {metrics.currentConnectionCount, metrics.maxConcurrentConnections, metrics.totalBytesReceived, metrics.totalBytesSent, metrics.totalConnectionCount, metrics.blockingJobsDispatched, metrics.blockingQueueMaxDepth, blockingLatencyAvgUs, metrics.blockingLatencyMaxUs, metrics.zerocopyBytes, metrics.zerocopyCopiedBytes, metrics.relayBufferGrowths, metrics.relayBufferShrinks, metrics.reclaimedSessions, metrics.slabObjects[METRICS_SLAB_SOCKS5], metrics.slabMaxObjects[METRICS_SLAB_SOCKS5], metrics.slabObjects[METRICS_SLAB_MGMT], metrics.slabMaxObjects[METRICS_SLAB_MGMT], metrics.slabBytes[METRICS_SLAB_SOCKS5] + metrics.slabBytes[METRICS_SLAB_MGMT], metrics.jobsStarted, metrics.jobsRejected, jobWaitAvgUs, metrics.jobWaitMaxUs, metrics.dnsCacheHits, metrics.dnsCacheMisses, dnsCacheHitPct};
 
     size_t size;
 
@@ -379,9 +475,81 @@ static int handleStatisticsCmdResponse(buffer* buffer, TMgmtParser* p, int fd) {
     for (int i = 0; i < (int)(sizeof(statsString) / sizeof(statsString[0])); i++)
         copyMetric(buffer, statsString[i], stats[i]);
 
+    // event loop histograms: times in microseconds, see METRICS_HISTOGRAM_BUCKETS for the buckets
+    const char* histogramsString[] = {"HLOOPUS:", "HPOLLUS:", "HREADYFDS:", "HOTHERUS:", "HSOCKS5US:", "HMGMTUS:", "HLOGGERUS:"};
+    const TMetricsHistogram* histograms[] = {&metrics.loopIterationUs, &metrics.loopPollUs, &metrics.loopReadyFds, &metrics.handlerUs[METRICS_HANDLER_OTHER],
+                                             &metrics.handlerUs[METRICS_HANDLER_SOCKS5], &metrics.handlerUs[METRICS_HANDLER_MGMT], &metrics.handlerUs[METRICS_HANDLER_LOGGER]};
+
+    for (int i = 0; i < (int)(sizeof(histogramsString) / sizeof(histogramsString[0])); i++)
+        if (copyHistogram(buffer, histogramsString[i], histograms[i]->buckets, METRICS_HISTOGRAM_BUCKETS))
+            return 1;
+
+    // relay buffers in use by size: 4KB, 8KB, ... see METRICS_RELAY_BUFFER_CLASSES
+    if (copyHistogram(buffer, "RBUFSIZES:", metrics.relayBuffers, METRICS_RELAY_BUFFER_CLASSES))
+        return 1;
+
+    return 0;
+}
+
+static int handleConnectionsCmdResponse(buffer* buffer, TMgmtParser* p, int fd) {
+    logf(LOG_INFO, "Management client %d requested command CONNECTIONS", fd);
+    size_t size;
+    uint8_t* ptr = buffer_write_ptr(buffer, &size);
+
+    // the rows follow as the buffer gets sent, see fillConnections
+    static const char* successMessage = "+OK listing connections:\n";
+    size_t len = strlen(successMessage);
+    if (len > size) {
+        return 1;
+    }
+    memcpy(ptr, successMessage, len);
+    buffer_write_adv(buffer, len);
     return 0;
 }
 
+typedef struct {
+    buffer* buffer;
+    unsigned long* cursor;
+} TConnectionsFill;
+
+/**
+ * Writes a session as a tab separated line: id, client address and port, username, state,
+ * destination and port, start time, and bytes sent to the origin and to the client. Returns false,
+ * without writing anything, if it doesn't fit in the buffer.
+ */
+static bool copyConnection(const TSessionInfo* info, void* arg) {
+    TConnectionsFill* fill = arg;
+    size_t size;
+    char* ptr = (char*)buffer_write_ptr(fill->buffer, &size);
+
+    struct tm tm;
+    localtime_r(&info->start, &tm);
+    int len = snprintf(ptr, size, "%lu\t%s\t%s\t%s\t%s\t%04d-%02d-%02dT%02d:%02d:%02d\t%zu\t%zu\n", info->id,
+                       printSocketAddressWith((const struct sockaddr*)info->clientAddress, '\t'), info->username == NULL ? "-" : info->username,
+                       info->state, info->destination == NULL ? "-\t-" : info->destination, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                       tm.tm_hour, tm.tm_min, tm.tm_sec, info->bytesToOrigin, info->bytesToClient);
+    if (len < 0 || (size_t)len >= size)
+        return false;
+
+    buffer_write_adv(fill->buffer, len);
+    *fill->cursor = info->id;
+    return true;
+}
+
+/**
+ * Fills the write buffer with the next sessions of the CONNECTIONS table. Returns false once
+ * there are no more to send.
+ */
+static bool fillConnections(TMgmtClient* data) {
+    if (data->connectionsDone)
+        return false;
+
+    unsigned long cursor = data->connectionsCursor;
+    TConnectionsFill fill = {.buffer = &data->writeBuffer, .cursor = &data->connectionsCursor};
+    data->connectionsDone = socksv5ForEachSession(cursor, copyConnection, &fill);
+    return data->connectionsCursor != cursor;
+}
+
 static int handleGetAuthenticationStatusCmdResponse(buffer* buffer, TMgmtParser* p, int fd) {
     logf(LOG_INFO, "Management client %d requested command GET-AUTHENTICATION-STATUS", fd);
     size_t size;
@@ -461,7 +629,7 @@ static int handleUnknownCmd(buffer* buffer, TMgmtParser* p) {
 typedef int (*cmdHandler)(buffer* buffer, TMgmtParser* p, int fd);
 
 static uint8_t isValidCmd(uint8_t cmd) {
-    return cmd <= MGMT_CMD_STATISTICS;
+    return cmd <= MGMT_CMD_CONNECTIONS;
 }
 
 static cmdHandler handlers[] = {
@@ -474,7 +642,9 @@ static cmdHandler handlers[] = {
     /* MGMT_CMD_SET_DISSECTOR_STATUS,       */ handleSetDissectorStatusCmdResponse,
     /* MGMT_CMD_GET_AUTHENTICATION_STATUS,  */ handleGetAuthenticationStatusCmdResponse,
     /* MGMT_CMD_SET_AUTHENTICATION_STATUS,  */ handleSetAuthenticationStatusCmdResponse,
-    /* MGMT_CMD_STATISTICS                  */ handleStatisticsCmdResponse};
+    /* MGMT_CMD_STATISTICS                  */ handleStatisticsCmdResponse,
+    /* MGMT_CMD_SET_RATE_LIMIT              */ handleSetRateLimitCmdResponse,
+    /* MGMT_CMD_CONNECTIONS                 */ handleConnectionsCmdResponse};
 
 static uint8_t fillMgmtCmdAnswer(TMgmtParser* p, struct buffer* buffer, int fd) {
     if (isValidCmd(p->cmd)) {
@@ -518,6 +688,11 @@ unsigned mgmtRequestWrite(TSelectorKey* key) {
         return MGMT_REQUEST_WRITE;
     }
 
+    // the connections table is sent in parts, as the buffer empties
+    if (data->cmd == MGMT_CMD_CONNECTIONS && !hasMgmtCmdErrors(&data->client.cmdParser) && fillConnections(data)) {
+        return MGMT_REQUEST_WRITE;
+    }
+
     if (hasMgmtCmdErrors(&data->client.cmdParser)) {
         return MGMT_ERROR;
     }
@@ -88,9 +88,13 @@ void initPDissector(TPDissector* pd, in_port_t port, int clientFd, int originFd)
 
 TPDStatus parseUserData(TPDissector* pd, struct buffer* buffer, int fd) {
     int idx = (fd == pd->clientFd ? CLIENT_IDX : ORIGIN_IDX);
-    int end = buffer->write - buffer->read;
-    for (int i = 0; i < end && pd->state != PDS_END; ++i) {
-        pd->state = stateRead[pd->state][idx](pd, buffer->read[i]);
+    struct iovec iov[2];
+    int segments = buffer_read_iov(buffer, iov);
+    for (int j = 0; j < segments; j++) {
+        const uint8_t* data = iov[j].iov_base;
+        for (size_t i = 0; i < iov[j].iov_len && pd->state != PDS_END; ++i) {
+            pd->state = stateRead[pd->state][idx](pd, data[i]);
+        }
     }
     return pd->state;
 }
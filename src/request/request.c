@@ -6,7 +6,6 @@
 #include "../logging/util.h"
 #include <errno.h>
 #include <netdb.h>
-#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -19,10 +18,20 @@
 #endif
 
 static unsigned requestProcess(TSelectorKey* key);
-static void* requestNameResolution(void* data);
+static void requestNameResolution(void* data);
+static void requestNameResolved(TSelector s, void* data);
+static void requestNameResolvedDns(TSelector s, void* data, struct addrinfo* result);
 static unsigned startConnection(TSelectorKey* key);
+static unsigned connectNextAddress(TSelectorKey* key);
 static TReqStatus connectErrorToRequestStatus(int e);
 
+/** resolver del hilo worker; sin él los nombres se resuelven en el pool del selector */
+static _Thread_local TDns resolver = NULL;
+
+void requestUseResolver(TDns dns) {
+    resolver = dns;
+}
+
 static void logAccess(const TClientData* data, int socksStatus) {
     if (data->isAuth) {
         logf(LOG_OUTPUT, "%s\tA\t%s\t%s\t%d", data->username, printSocketAddressWith((struct sockaddr*)&data->clientAddress, '\t'), reqParserToString(&data->client.reqParser), socksStatus);
@@ -75,68 +84,69 @@ static unsigned requestProcess(TSelectorKey* key) {
     logf(LOG_DEBUG, "requestProcess: Init process for fd: %d", key->fd);
 
     if (atyp == REQ_ATYP_IPV4) {
-        struct sockaddr_in* sockaddr = malloc(sizeof(struct sockaddr_in));
-        data->originResolution = calloc(1, sizeof(struct addrinfo));
-        if (sockaddr == NULL) {
-            logf(LOG_DEBUG, "requestProcess: malloc error for fd: %d", key->fd);
-            goto finally;
-        } else if (data->originResolution == NULL) {
-            free(sockaddr);
-            logf(LOG_DEBUG, "requestProcess: malloc error for fd: %d", key->fd);
-            goto finally;
-        }
-        *sockaddr = (struct sockaddr_in){
+        struct sockaddr_in sockaddr = {
             .sin_family = AF_INET,
             .sin_addr = rp.address.ipv4,
             .sin_port = htons(rp.port),
         };
+        data->originResolution = dns_addrinfo_new((struct sockaddr*)&sockaddr, sizeof(sockaddr));
+        if (data->originResolution == NULL) {
+            logf(LOG_DEBUG, "requestProcess: malloc error for fd: %d", key->fd);
+            goto finally;
+        }
 
-        *data->originResolution = (struct addrinfo){
-            .ai_family = AF_INET,
-            .ai_addr = (struct sockaddr*)sockaddr,
-            .ai_addrlen = sizeof(*sockaddr),
-        };
-
-        logf(LOG_INFO, "Client %d requested to connect to IPv4 address %s", data->clientFd, printSocketAddress((struct sockaddr*)sockaddr));
+        logf(LOG_INFO, "Client %d requested to connect to IPv4 address %s", data->clientFd, printSocketAddress((struct sockaddr*)&sockaddr));
         return startConnection(key);
     }
 
     if (atyp == REQ_ATYP_IPV6) {
-        struct sockaddr_in6* sockaddr = malloc(sizeof(struct sockaddr_in6));
-        data->originResolution = calloc(1, sizeof(struct addrinfo));
-        if (sockaddr == NULL) {
-            logf(LOG_DEBUG, "requestProcess: malloc error for fd: %d", key->fd);
-            goto finally;
-        } else if (data->originResolution == NULL) {
-            free(sockaddr);
-            logf(LOG_DEBUG, "requestProcess: malloc error for fd: %d", key->fd);
-            goto finally;
-        }
-        *sockaddr = (struct sockaddr_in6){
+        struct sockaddr_in6 sockaddr = {
             .sin6_family = AF_INET6,
             .sin6_addr = rp.address.ipv6,
             .sin6_port = htons(rp.port)};
+        data->originResolution = dns_addrinfo_new((struct sockaddr*)&sockaddr, sizeof(sockaddr));
+        if (data->originResolution == NULL) {
+            logf(LOG_DEBUG, "requestProcess: malloc error for fd: %d", key->fd);
+            goto finally;
+        }
 
-        *data->originResolution = (struct addrinfo){
-            .ai_family = AF_INET6,
-            .ai_addr = (struct sockaddr*)sockaddr,
-            .ai_addrlen = sizeof(*sockaddr),
-        };
-
-        logf(LOG_INFO, "Client %d requested to connect to IPv6 address %s", data->clientFd, printSocketAddress((struct sockaddr*)sockaddr));
+        logf(LOG_INFO, "Client %d requested to connect to IPv6 address %s", data->clientFd, printSocketAddress((struct sockaddr*)&sockaddr));
         return startConnection(key);
     }
 
     if (atyp == REQ_ATYP_DOMAINNAME) {
         logf(LOG_INFO, "Client %d requested to connect to domain name %s:%d", data->clientFd, data->client.reqParser.address.domainname, data->client.reqParser.port);
 
-        pthread_t tid;
-        TSelectorKey* key2 = malloc(sizeof(*key));
-        memcpy(key2, key, sizeof(*key2));
-        if (pthread_create(&tid, NULL, requestNameResolution, key2) == -1) {
-            logf(LOG_DEBUG, "requestProcess: thread error fd: %d", key->fd);
+        if (resolver != NULL) {
+            // las consultas van por el selector; los nombres numéricos, de
+            // hosts(5) o que están en el cache se resuelven en el momento
+            struct addrinfo* result;
+            switch (dns_resolve(resolver, (char*)rp.address.domainname, rp.port, requestNameResolvedDns, data, &result, &data->resolvingQuery)) {
+                case DNS_RESOLVED:
+                    data->originResolution = result;
+                    return startConnection(key);
+                case DNS_PENDING:
+                    if (selector_set_interest_key(key, OP_NOOP) != SELECTOR_SUCCESS) {
+                        return ERROR;
+                    }
+                    return REQUEST_RESOLV;
+                case DNS_NOT_FOUND:
+                    logf(LOG_DEBUG, "Resolve of domain name requested by %d found no results in the cache", key->fd);
+                    return fillRequestAnswerWitheErrorState(data, key, REQ_ERROR_HOST_UNREACHABLE);
+                default:
+                    logf(LOG_ERROR, "requestProcess: cannot resolve %s for client %d", rp.address.domainname, key->fd);
+                    goto finally;
+            }
+        }
+
+        // getaddrinfo(3) bloquea: corre en el pool del selector, que con
+        // demasiadas resoluciones en espera rechaza el pedido
+        TSelectorStatus status = selector_submit_job(key->s, requestNameResolution, requestNameResolved, data);
+        if (status != SELECTOR_SUCCESS) {
+            logf(LOG_ERROR, "requestProcess: cannot resolve %s for client %d: %s", data->client.reqParser.address.domainname, key->fd, selector_error(status));
             goto finally;
         }
+        data->resolving = true;
         if (selector_set_interest_key(key, OP_NOOP) != SELECTOR_SUCCESS) {
             return ERROR;
         }
@@ -149,13 +159,11 @@ finally:
     return REQUEST_WRITE;
 }
 
-static void* requestNameResolution(void* data) {
+static void requestNameResolution(void* data) {
     // WARNING: This function is run on a separate thread. Functions such as logging
     // will break if used from here. Modify with caution.
-    TSelectorKey* key = (TSelectorKey*)data;
-    TClientData* c = ATTACHMENT(key);
+    TClientData* c = (TClientData*)data;
 
-    pthread_detach(pthread_self());
     struct addrinfo hints = {
         .ai_family = AF_UNSPEC,
         .ai_socktype = SOCK_STREAM,
@@ -169,13 +177,50 @@ static void* requestNameResolution(void* data) {
     char service[6] = {0};
     sprintf(service, "%d", (int)c->client.reqParser.port);
 
-    int err = getaddrinfo((char*)c->client.reqParser.address.domainname, service, &hints, &(c->originResolution));
-    if (err != 0) {
-        c->originResolution = NULL;
+    struct addrinfo* list;
+    c->originResolution = NULL;
+    if (getaddrinfo((char*)c->client.reqParser.address.domainname, service, &hints, &list) != 0) {
+        return;
+    }
+
+    // se copia a nodos de dns_addrinfo_new, así toda resolución se libera igual
+    struct addrinfo** tail = &c->originResolution;
+    for (struct addrinfo* ai = list; ai != NULL; ai = ai->ai_next) {
+        *tail = dns_addrinfo_new(ai->ai_addr, ai->ai_addrlen);
+        if (*tail == NULL) {
+            break;
+        }
+        tail = &(*tail)->ai_next;
     }
-    selector_notify_block(key->s, key->fd);
-    free(data);
-    return NULL;
+    freeaddrinfo(list);
+}
+
+static void requestResolved(TSelector s, TClientData* c) {
+    TSelectorKey key = {
+        .s = s,
+        .fd = c->clientFd,
+        .data = c,
+    };
+    getStateHandler()->handle_block(&key);
+}
+
+static void requestNameResolved(TSelector s, void* data) {
+    TClientData* c = (TClientData*)data;
+    c->resolving = false;
+    if (c->closed) {
+        // la sesión se cerró durante la resolución y dejó su liberación para acá
+        releaseClientData(c);
+        return;
+    }
+    requestResolved(s, c);
+}
+
+static void requestNameResolvedDns(TSelector s, void* data, struct addrinfo* result) {
+    // a diferencia del pool, si la sesión se cierra la resolución se cancela
+    TClientData* c = (TClientData*)data;
+    c->resolvingQuery = NULL;
+    c->originResolution = result;
+    requestResolved(s, c);
 }
 
 unsigned requestResolveDone(TSelectorKey* key) {
@@ -210,6 +255,11 @@ unsigned fillRequestAnswerWitheErrorState(const TClientData* data, TSelectorKey*
     return REQUEST_WRITE;
 }
 
+void requestWriteInit(const unsigned state, TSelectorKey* key) {
+    // the answer is bounded by the handshake timeout as well
+    socksv5ArmTimeout(key->s, ATTACHMENT(key), SOCKS_TIMEOUT_HANDSHAKE);
+}
+
 unsigned requestWrite(TSelectorKey* key) {
     TClientData* data = ATTACHMENT(key);
     logf(LOG_DEBUG, "requestWrite: rw p.state = %d", data->client.reqParser.state);
@@ -235,7 +285,7 @@ unsigned requestWrite(TSelectorKey* key) {
         return REQUEST_WRITE;
     }
 
-    if (hasRequestErrors(&data->client.reqParser) || selector_set_interest_key(key, OP_READ) != SELECTOR_SUCCESS) {
+    if (hasRequestErrors(&data->client.reqParser) || selector_set_interest_key(key, OP_READ) != SELECTOR_SUCCESS || !copyRelayAcquire(data)) {
         logf(LOG_DEBUG, "requestWrite: error %d ", key->fd);
         return ERROR;
     }
@@ -264,13 +314,7 @@ unsigned requestConecting(TSelectorKey* key) {
             logf(LOG_INFO, "Failed to fulfill connection request from client %d", d->clientFd);
             return fillRequestAnswerWitheErrorState(d, key, connectErrorToRequestStatus(error));
         } else {
-            selector_unregister_fd_noclose(key->s, d->originFd);
-            close(d->originFd);
-            struct addrinfo* next = d->originResolution->ai_next;
-            d->originResolution->ai_next = NULL;
-            freeaddrinfo(d->originResolution);
-            d->originResolution = next;
-            return startConnection(key);
+            return connectNextAddress(key);
         }
     }
 
@@ -283,6 +327,35 @@ unsigned requestConecting(TSelectorKey* key) {
     return REQUEST_WRITE;
 }
 
+unsigned requestConectingTimeout(TSelectorKey* key) {
+    TClientData* d = ATTACHMENT(key);
+    logf(LOG_INFO, "Connect attempt to %s timed out (requested by client %d)", printSocketAddress(d->originResolution->ai_addr), d->clientFd);
+
+    if (d->originResolution->ai_next != NULL) {
+        return connectNextAddress(key);
+    }
+
+    selector_unregister_fd_noclose(key->s, d->originFd);
+    close(d->originFd);
+    d->originFd = -1;
+    logf(LOG_INFO, "Failed to fulfill connection request from client %d", d->clientFd);
+    return fillRequestAnswerWitheErrorState(d, key, REQ_ERROR_TTL_EXPIRED);
+}
+
+/** drops the current origin socket and attempts the next resolved address */
+static unsigned connectNextAddress(TSelectorKey* key) {
+    TClientData* d = ATTACHMENT(key);
+
+    selector_unregister_fd_noclose(key->s, d->originFd);
+    close(d->originFd);
+    d->originFd = -1;
+    struct addrinfo* next = d->originResolution->ai_next;
+    d->originResolution->ai_next = NULL;
+    dns_freeaddrinfo(d->originResolution);
+    d->originResolution = next;
+    return startConnection(key);
+}
+
 static unsigned startConnection(TSelectorKey* key) {
     TClientData* d = ATTACHMENT(key);
 
@@ -295,15 +368,17 @@ static unsigned startConnection(TSelectorKey* key) {
         return ERROR;
     }
     selector_fd_set_nio(d->originFd);
+    socksv5SetSocketOptions(d->originFd);
 
     logf(LOG_INFO, "Attempting to connect to %s as requested by client %d", printSocketAddress(d->originResolution->ai_addr), d->clientFd);
 
     if (connect(d->originFd, d->originResolution->ai_addr, d->originResolution->ai_addrlen) == 0 || errno == EINPROGRESS) {
-        if (selector_register(key->s, d->originFd, getStateHandler(), OP_WRITE, d) != SELECTOR_SUCCESS || SELECTOR_SUCCESS != selector_set_interest(key->s, key->fd, OP_NOOP)) {
+        if (selector_register(key->s, d->originFd, getStateHandler(), OP_WRITE, d) != SELECTOR_SUCCESS || SELECTOR_SUCCESS != selector_set_interest(key->s, d->clientFd, OP_NOOP)) {
             logf(LOG_DEBUG, "startConnection: Failed to register and set interests for request by client fd %d", d->clientFd);
             return ERROR;
         }
         logf(LOG_DEBUG, "startConnection: Connect attempt in progress for request by client fd %d", d->clientFd);
+        socksv5ArmTimeout(key->s, d, SOCKS_TIMEOUT_CONNECT);
         return REQUEST_CONNECTING;
     }
 
@@ -311,13 +386,7 @@ static unsigned startConnection(TSelectorKey* key) {
 
     // Could not connect to the first address, try with the next one, if exists
     if (d->originResolution->ai_next != NULL) {
-        selector_unregister_fd_noclose(key->s, d->originFd);
-        close(d->originFd);
-        struct addrinfo* next = d->originResolution->ai_next;
-        d->originResolution->ai_next = NULL;
-        freeaddrinfo(d->originResolution);
-        d->originResolution = next;
-        return startConnection(key);
+        return connectNextAddress(key);
     }
 
     // Return a connection error after trying to connect to all the addresses
@@ -1,10 +1,18 @@
 #ifndef REQUEST_H
 #define REQUEST_H
 
+#include "../dns.h"
 #include "../selector.h"
 #include "requestParser.h"
 #include "../socks5.h"
 
+/**
+ * @brief Sets the resolver used for domain names by the calling worker thread
+ * @param dns resolver bound to the worker's selector, or NULL to resolve with
+ * getaddrinfo on the selector's blocking job pool
+ */
+void requestUseResolver(TDns dns);
+
 /**
  * @brief Handler to initialize resources when the REQUEST_READ state is reached
  *
@@ -20,6 +28,13 @@ void requestReadInit(const unsigned state, TSelectorKey* key);
  */
 unsigned requestRead(TSelectorKey* key);
 
+/**
+ * @brief Handler to initialize resources when the REQUEST_WRITE state is reached
+ * @param state the state from which the state machine arrived
+ * @param key Selector key that holds information regarding the woken up fd
+ */
+void requestWriteInit(const unsigned state, TSelectorKey* key);
+
 /**
  * @brief Handler to write to ready file descriptor when inside REQUEST_WRITE state
  * @param key Selector key that holds information regarding the ready fd
@@ -48,6 +63,14 @@ unsigned fillRequestAnswerWitheErrorState(const TClientData* data, TSelectorKey*
  */
 unsigned requestConecting(TSelectorKey* key);
 
+/**
+ * @brief Handler for the expiration of the connect timeout: tries with the next
+ * resolved address, if any, or answers the client with a TTL expired error
+ * @param key Selector key of the client fd
+ * @returns resulting state machine state
+ */
+unsigned requestConectingTimeout(TSelectorKey* key);
+
 /**
  * @brief Handler to initialize resources when the REQUEST_CONNECTING state is reached
  * @param key Selector key that holds information regarding the ready fd
@@ -38,7 +38,7 @@ const char* reqParserToString(const TReqParser* p) {
     // ipv6 --> "::ffff:1.2.3.4\t4321"
     // domainname --> "www.google.com\t4321"
 
-    static char toReturn[REQ_MAX_DN_LENGHT + 1 + 5 + 1];
+    static _Thread_local char toReturn[REQ_MAX_DN_LENGHT + 1 + 5 + 1];
     uint8_t atyp = p->atyp;
     TAddress aux = p->address;
 
@@ -147,6 +147,8 @@ static TReqState reqParseDnLength(TReqParser* p, uint8_t c) {
 static TReqState reqParseDstAddr(TReqParser* p, uint8_t c) {
     p->address.bytes[p->readBytes++] = c;
     if (p->totalAtypBytes == p->readBytes) {
+        // los nombres de dominio se usan como strings
+        p->address.bytes[p->readBytes] = '\0';
         p->readBytes = 0;
         return REQ_DST_PORT;
     }
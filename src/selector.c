@@ -7,21 +7,40 @@
  */
 #include "selector.h"
 #include "logging/logger.h"
+#include "logging/metrics.h"
+
+// En Linux usamos epoll(7) salvo que se pida explícitamente pselect(2)
+// compilando con -DSELECTOR_PSELECT.
+#if defined(__linux__) && !defined(SELECTOR_PSELECT)
+#define SELECTOR_EPOLL
+#endif
+
 #include <assert.h> // :)
 #include <errno.h>  // :)
 #include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h> // SIZE_MAX
 #include <stdio.h>  // perror
 #include <stdlib.h> // malloc
 #include <string.h> // memset
+#include <sys/resource.h>
 #include <sys/select.h>
-#include <sys/signal.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef SELECTOR_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#define SELECTOR_EVENTFD
+#endif
+
 #define N(x) (sizeof(x) / sizeof((x)[0]))
 
 #define ERROR_DEFAULT_MSG "something failed"
@@ -48,60 +67,17 @@ const char* selector_error(const TSelectorStatus status) {
         case SELECTOR_FDINUSE:
             msg = "FD in use";
             break;
+        case SELECTOR_QFULL:
+            msg = "Blocking job queue full";
+            break;
         default:
             msg = ERROR_DEFAULT_MSG;
     }
     return msg;
 }
 
-static void wake_handler(const int signal) {
-    // nada que hacer. está solo para interrumpir el select
-}
-
-// señal a usar para las notificaciones de resolución
+// configuración de la librería
 TSelectorInit conf;
-static sigset_t emptyset, blockset;
-
-TSelectorStatus selector_init(const TSelectorInit* c) {
-    memcpy(&conf, c, sizeof(conf));
-
-    // inicializamos el sistema de comunicación entre threads y el selector
-    // principal. La técnica se encuentra descripta en
-    // "The new pselect() system call" <https://lwn.net/Articles/176911/>
-    //  March 24, 2006
-    TSelectorStatus ret = SELECTOR_SUCCESS;
-    struct sigaction act = {
-        .sa_handler = wake_handler,
-    };
-
-    // 0. calculamos mascara para evitar que se interrumpa antes de llegar al
-    //    select
-    sigemptyset(&blockset);
-    sigaddset(&blockset, conf.signal);
-    if (-1 == sigprocmask(SIG_BLOCK, &blockset, NULL)) {
-        ret = SELECTOR_IO;
-        goto finally;
-    }
-
-    // 1. Registramos una función que atenderá la señal de interrupción
-    //    del selector.
-    //    Esta interrupción es útil en entornos multi-hilos.
-
-    if (sigaction(conf.signal, &act, 0)) {
-        ret = SELECTOR_IO;
-        goto finally;
-    }
-    sigemptyset(&emptyset);
-
-finally:
-    return ret;
-}
-
-TSelectorStatus selector_close(void) {
-    // Nada para liberar.
-    // TODO(juan): podriamos reestablecer el handler de la señal.
-    return SELECTOR_SUCCESS;
-}
 
 // estructuras internas
 struct item {
@@ -109,22 +85,173 @@ struct item {
     TFdInterests interest;
     const TFdHandler* handler;
     void* data;
+#ifdef SELECTOR_EPOLL
+    /** el fd está actualmente en el interest list de epoll */
+    bool polled;
+    /**
+     * epoll(7) no acepta algunos descriptores (ej: archivos regulares) que
+     * select(2) siempre reporta como listos. Los tratamos igual: se despachan
+     * en cada iteración mientras tengan algún interés.
+     */
+    bool unpollable;
+    /** se registra en modo edge-triggered (EPOLLET) */
+    bool edge;
+    /**
+     * el handler no terminó de consumir los eventos (ver `selector_yield'):
+     * se lo vuelve a despachar en la próxima iteración.
+     */
+    bool yielded;
+#endif
+
+    /**
+     * el item está en la lista de activos del selector: con pselect(2) los
+     * que tienen algún interés, con epoll(7) los `unpollable' con interés y
+     * los que cedieron el turno.
+     */
+    bool active;
+    struct item* active_next;
+    struct item* active_prev;
+
+    // timer del fd, enlazado en un slot de la rueda de timers
+    struct item* timer_next;
+    struct item* timer_prev;
+    /** vencimiento en ticks de la rueda */
+    uint64_t timer_expires;
+    /** slot de la rueda (nivel * TIMER_SLOTS + slot), o TIMER_UNARMED */
+    int timer_slot;
 };
 
 /* tarea bloqueante */
 struct blocking_job {
-    /** selector dueño de la resolucion */
-    TSelector s;
-    /** file descriptor dueño de la resolucion */
+    /** file descriptor dueño de la resolucion, o -1 si es de `selector_submit_job' */
     int fd;
+    /** trabajo de `selector_submit_job', quién lo despacha al terminar y su argumento */
+    TSelectorJob job;
+    TSelectorJobDone done;
+    void* arg;
+    /** selector en cuyo hilo se despacha */
+    TSelector s;
+    /**
+     * momento en que se encoló en el pool, para medir la espera, y luego el de
+     * la notificación, para medir la latencia hasta el despacho
+     */
+    uint64_t notified_at;
 
-    /** datos del trabajo provisto por el usuario */
-    void* data;
-
-    /** el siguiente en la lista */
+    /** el siguiente en la cola de notificaciones */
     struct blocking_job* next;
+    /** el siguiente libre del pool (índice + 1, 0 es el fin de la lista) */
+    _Atomic uint32_t free_next;
+    /** posición en el pool (índice + 1), 0 si se alocó con malloc */
+    uint32_t pool_index;
 };
 
+/**
+ * cantidad de nodos de blocking jobs que se preasignan por selector. Si en
+ * algún momento hay más notificaciones pendientes se usa malloc.
+ */
+#define BLOCKING_POOL_SIZE 256
+
+/**
+ * pool de hilos que corre los trabajos de `selector_submit_job', común a
+ * todos los selectores. Los trabajos esperan un hilo libre en una cola FIFO
+ * de a lo sumo `conf.job_queue' elementos.
+ */
+static struct {
+    pthread_mutex_t lock;
+    /** hay trabajos encolados, o hay que cerrar el pool */
+    pthread_cond_t ready;
+    struct blocking_job* head;
+    struct blocking_job* tail;
+    size_t queued;
+    bool closing;
+
+    pthread_t* threads;
+    size_t threads_count;
+} jobs = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+};
+
+static void* job_worker(void* unused);
+static TSelectorStatus job_notify(TSelector s, struct blocking_job* job);
+
+TSelectorStatus selector_init(const TSelectorInit* c) {
+    memcpy(&conf, c, sizeof(conf));
+
+    jobs.closing = false;
+    if (conf.job_threads == 0) {
+        return SELECTOR_SUCCESS;
+    }
+    jobs.threads = calloc(conf.job_threads, sizeof(*jobs.threads));
+    if (jobs.threads == NULL) {
+        return SELECTOR_ENOMEM;
+    }
+
+    // las señales las atienden los hilos de los selectores, no los del pool
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    for (jobs.threads_count = 0; jobs.threads_count < conf.job_threads; jobs.threads_count++) {
+        if (pthread_create(&jobs.threads[jobs.threads_count], NULL, job_worker, NULL) != 0) {
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    if (jobs.threads_count < conf.job_threads) {
+        selector_close();
+        return SELECTOR_ENOMEM;
+    }
+    return SELECTOR_SUCCESS;
+}
+
+TSelectorStatus selector_close(void) {
+    pthread_mutex_lock(&jobs.lock);
+    jobs.closing = true;
+    pthread_cond_broadcast(&jobs.ready);
+    pthread_mutex_unlock(&jobs.lock);
+
+    for (size_t i = 0; i < jobs.threads_count; i++) {
+        pthread_join(jobs.threads[i], NULL);
+    }
+    free(jobs.threads);
+    jobs.threads = NULL;
+    jobs.threads_count = 0;
+
+    // los que no llegaron a correr igual se notifican, para que su `done'
+    // libere lo que tenga que liberar
+    struct blocking_job* job = jobs.head;
+    jobs.head = jobs.tail = NULL;
+    jobs.queued = 0;
+    while (job != NULL) {
+        struct blocking_job* next = job->next;
+        job_notify(job->s, job);
+        job = next;
+    }
+    return SELECTOR_SUCCESS;
+}
+
+#ifdef SELECTOR_EPOLL
+/** cantidad máxima de eventos que se retiran por llamada a epoll_wait() */
+#define SELECTOR_EPOLL_MAX_EVENTS 1024
+#endif
+
+/**
+ * Rueda de timers jerárquica: TIMER_LEVELS niveles de TIMER_SLOTS slots. Un
+ * tick es un milisegundo. Un slot del nivel n agrupa los timers que vencen en
+ * un mismo intervalo de TIMER_SLOTS^n ticks; al completar una vuelta del
+ * nivel inferior se redistribuye el slot correspondiente del superior
+ * ("cascada"). Un bitmap por nivel indica qué slots tienen timers, lo que
+ * permite saltear los ticks vacíos y calcular el próximo vencimiento.
+ */
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_MASK ((uint64_t)TIMER_SLOTS - 1)
+#define TIMER_LEVELS 6
+/** los vencimientos más lejanos (~795 días) se recortan a este horizonte */
+#define TIMER_HORIZON ((uint64_t)1 << (TIMER_LEVELS * TIMER_BITS))
+#define TIMER_UNARMED (-1)
+
 /** marca para usar en item->fd para saber que no está en uso */
 static const int FD_UNUSED = -1;
 
@@ -132,46 +259,108 @@ static const int FD_UNUSED = -1;
 #define ITEM_USED(i) ((FD_UNUSED != (i)->fd))
 
 struct fdselector {
-    // almacenamos en una jump table donde la entrada es el file descriptor.
-    // Asumimos que el espacio de file descriptors no va a ser esparso; pero
-    // esto podría mejorarse utilizando otra estructura de datos
-    struct item* fds;
-    size_t fd_size; // cantidad de elementos posibles de fds
+    // almacenamos en una jump table de dos niveles donde la entrada es el
+    // file descriptor. Los bloques de ITEMS_CHUNK_SIZE items se alocan recién
+    // cuando se registra un fd que cae en ellos, así un límite de 100k fds no
+    // requiere un arreglo denso de 100k items.
+    struct item** chunks;
+    size_t chunks_size; // cantidad de bloques direccionables en chunks
+    size_t fd_size;     // cantidad de elementos posibles (chunks_size * ITEMS_CHUNK_SIZE)
+    size_t fd_limit;    // máximo de fds que la plataforma nos permite manejar
 
     /** fd maximo para usar en select() */
     int max_fd; // max(.fds[].fd)
 
+    /**
+     * items activos (ver `struct item'), para no tener que recorrer toda la
+     * tabla en cada iteración.
+     */
+    struct item* active;
+    /** fds listos de la iteración en curso, tomados de la lista de activos */
+    int* ready;
+    size_t ready_size;
+
+#ifndef SELECTOR_EPOLL
     /** descriptores prototipicos ser usados en select */
     fd_set master_r, master_w;
     /** para ser usado en el select() (recordar que select cambia el valor) */
     fd_set slave_r, slave_w;
+#endif
+
+    /** slots de la rueda de timers: listas de items */
+    struct item* wheel[TIMER_LEVELS][TIMER_SLOTS];
+    /** bit i del nivel n prendido sii wheel[n][i] tiene timers */
+    uint64_t wheel_bitmap[TIMER_LEVELS];
+    /** último tick procesado: vencieron todos los timers hasta acá */
+    uint64_t wheel_now;
+    /** cantidad de timers programados */
+    size_t timers;
 
     /** timeout prototipico para usar en select() */
     struct timespec master_t;
     /** tambien select() puede cambiar el valor */
     struct timespec slave_t;
 
+#ifdef SELECTOR_EPOLL
+    /** instancia de epoll(7) del selector */
+    int epfd;
+    /** eventos devueltos por epoll_wait() */
+    struct epoll_event events[SELECTOR_EPOLL_MAX_EVENTS];
+#endif
+
     // notificaciónes entre blocking jobs y el selector
-    volatile pthread_t selector_thread;
-    /** protege el acceso a resolutions jobs */
-    pthread_mutex_t resolution_mutex;
     /**
-     * lista de trabajos blockeantes que finalizaron y que pueden ser
-     * notificados.
+     * extremos de lectura y escritura del canal para despertar al selector.
+     * Con eventfd(2) ambos son el mismo descriptor.
+     */
+    int wake_r, wake_w;
+    /** ya hay un despertar pendiente: no hace falta volver a escribir */
+    atomic_bool wake_pending;
+    /**
+     * pila lock-free de trabajos blockeantes que finalizaron y que pueden ser
+     * notificados. Varios hilos apilan, y solo el hilo del selector la vacía
+     * de una vez, por lo que no hay ABA.
      */
-    struct blocking_job* resolution_jobs;
+    _Atomic(struct blocking_job*) resolution_jobs;
+    /** nodos preasignados para `resolution_jobs' */
+    struct blocking_job job_pool[BLOCKING_POOL_SIZE];
+    /**
+     * lista de nodos libres del pool: índice + 1 del primero en los 32 bits
+     * bajos y un contador de modificaciones en los altos, que evita el ABA
+     * entre los hilos que toman nodos.
+     */
+    _Atomic uint64_t job_free;
 };
 
-/** cantidad máxima de file descriptors que la plataforma puede manejar */
-#define ITEMS_MAX_SIZE FD_SETSIZE
+/** cantidad de items en cada bloque de la tabla de fds */
+#define ITEMS_CHUNK_SIZE 1024
 
-// en esta implementación el máximo está dado por el límite natural de select(2).
+/** límite de fds cuando RLIMIT_NOFILE es infinito */
+#define ITEMS_DEFAULT_MAX_SIZE (1 << 20)
+
+/**
+ * cantidad máxima de file descriptors que la plataforma puede manejar.
+ *
+ * pselect(2) está limitado por FD_SETSIZE; con epoll(7) el límite es el
+ * máximo al que se puede llevar RLIMIT_NOFILE.
+ */
+static size_t items_max_size(void) {
+#ifdef SELECTOR_EPOLL
+    struct rlimit rl;
+    if (-1 == getrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_max == RLIM_INFINITY || rl.rlim_max > INT32_MAX) {
+        return ITEMS_DEFAULT_MAX_SIZE;
+    }
+    return rl.rlim_max;
+#else
+    return FD_SETSIZE;
+#endif
+}
 
 /**
  * determina el tamaño a crecer, generando algo de slack para no tener
  * que realocar constantemente.
  */
-static size_t next_capacity(const size_t n) {
+static size_t next_capacity(TSelector s, const size_t n) {
     unsigned bits = 0;
     size_t tmp = n;
     while (tmp != 0) {
@@ -181,8 +370,8 @@ static size_t next_capacity(const size_t n) {
     tmp = 1UL << bits;
 
     assert(tmp >= n);
-    if (tmp > ITEMS_MAX_SIZE) {
-        tmp = ITEMS_MAX_SIZE;
+    if (tmp > s->fd_limit) {
+        tmp = s->fd_limit;
     }
 
     return tmp + 1;
@@ -190,44 +379,154 @@ static size_t next_capacity(const size_t n) {
 
 static inline void item_init(struct item* item) {
     item->fd = FD_UNUSED;
+    item->timer_slot = TIMER_UNARMED;
+}
+
+/** obtiene el item de `fd', o NULL si su bloque nunca fue alocado */
+static inline struct item* item_at(TSelector s, const size_t fd) {
+    struct item* chunk = s->chunks[fd / ITEMS_CHUNK_SIZE];
+    return chunk == NULL ? NULL : chunk + fd % ITEMS_CHUNK_SIZE;
+}
+
+/** como item_at, pero aloca el bloque de `fd' si todavía no existe */
+static struct item* item_at_alloc(TSelector s, const size_t fd) {
+    struct item** chunk = s->chunks + fd / ITEMS_CHUNK_SIZE;
+    if (*chunk == NULL) {
+        *chunk = malloc(ITEMS_CHUNK_SIZE * sizeof(**chunk));
+        if (*chunk == NULL) {
+            return NULL;
+        }
+        memset(*chunk, 0x00, ITEMS_CHUNK_SIZE * sizeof(**chunk));
+        for (size_t i = 0; i < ITEMS_CHUNK_SIZE; i++) {
+            item_init(*chunk + i);
+        }
+    }
+    return *chunk + fd % ITEMS_CHUNK_SIZE;
+}
+
+/** verifica si un fd registrado está en uso; NULL si no lo está */
+static inline struct item* item_used(TSelector s, const int fd) {
+    struct item* item = item_at(s, fd);
+    return item != NULL && ITEM_USED(item) ? item : NULL;
 }
 
 /**
- * inicializa los nuevos items. `last' es el indice anterior.
- * asume que ya está blanqueada la memoria.
+ * actualiza el fd maximo luego de liberar `fd'. Solo hay que buscar si era
+ * el máximo, y en ese caso se busca hacia abajo salteando los bloques sin
+ * alocar: en un cierre masivo cada fd se visita una única vez.
  */
-static void items_init(TSelector s, const size_t last) {
-    assert(last <= s->fd_size);
-    for (size_t i = last; i < s->fd_size; i++) {
-        item_init(s->fds + i);
+static void items_max_fd_release(TSelector s, const int fd) {
+    if (fd != s->max_fd) {
+        return;
+    }
+    int i = fd - 1;
+    while (i > 0) {
+        const struct item* chunk = s->chunks[i / ITEMS_CHUNK_SIZE];
+        if (chunk == NULL) {
+            i -= i % ITEMS_CHUNK_SIZE + 1;
+        } else if (ITEM_USED(chunk + i % ITEMS_CHUNK_SIZE)) {
+            break;
+        } else {
+            i--;
+        }
+    }
+    s->max_fd = i < 0 ? 0 : i;
+}
+
+/** agrega o quita al item de la lista de activos según su estado actual */
+static void items_update_active(TSelector s, struct item* item) {
+    bool active = ITEM_USED(item) && item->interest != OP_NOOP;
+#ifdef SELECTOR_EPOLL
+    active = (active && item->unpollable) || (ITEM_USED(item) && item->yielded);
+#endif
+    if (active == item->active) {
+        return;
     }
+
+    if (active) {
+        item->active_prev = NULL;
+        item->active_next = s->active;
+        if (s->active != NULL) {
+            s->active->active_prev = item;
+        }
+        s->active = item;
+    } else {
+        if (item->active_prev != NULL) {
+            item->active_prev->active_next = item->active_next;
+        } else {
+            s->active = item->active_next;
+        }
+        if (item->active_next != NULL) {
+            item->active_next->active_prev = item->active_prev;
+        }
+        item->active_next = item->active_prev = NULL;
+    }
+    item->active = active;
 }
 
+#ifdef SELECTOR_EPOLL
 /**
- * calcula el fd maximo para ser utilizado en select()
+ * sincroniza el interest list de epoll con los intereses del item.
+ *
+ * Los fds sin interés se quitan de epoll: epoll siempre reporta EPOLLHUP y
+ * EPOLLERR, y un fd con OP_NOOP que el peer cerró haría girar el loop. Por lo
+ * mismo OP_ERROR no agrega eventos: alcanza con que el fd siga registrado.
  */
-static int items_max_fd(TSelector s) {
-    int max = 0;
-    for (int i = 0; i <= s->max_fd; i++) {
-        struct item* item = s->fds + i;
-        if (ITEM_USED(item)) {
-            if (item->fd > max) {
-                max = item->fd;
-            }
+static TSelectorStatus items_update_interest(TSelector s, struct item* item) {
+    if (item->fd == -1) {
+        return SELECTOR_SUCCESS;
+    }
+
+    uint32_t events = 0;
+    if (ITEM_USED(item)) {
+        if (item->interest & OP_READ) {
+            events |= EPOLLIN;
+        }
+        if (item->interest & OP_WRITE) {
+            events |= EPOLLOUT;
         }
     }
-    return max;
-}
 
-static void items_update_fdset_for_fd(TSelector s, const struct item* item) {
+    if (item->unpollable) {
+        return SELECTOR_SUCCESS;
+    }
+
+    if (events == 0 && !(ITEM_USED(item) && (item->interest & OP_ERROR))) {
+        if (item->polled) {
+            // puede fallar si el fd ya fue cerrado (epoll lo quita solo).
+            epoll_ctl(s->epfd, EPOLL_CTL_DEL, item->fd, NULL);
+            item->polled = false;
+        }
+        return SELECTOR_SUCCESS;
+    }
+
+    struct epoll_event ev = {
+        .events = item->edge ? events | EPOLLET : events,
+        .data.fd = item->fd,
+    };
+    const int op = item->polled ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (-1 == epoll_ctl(s->epfd, op, item->fd, &ev)) {
+        if (op == EPOLL_CTL_ADD && errno == EPERM) {
+            // archivo regular o similar: siempre está listo.
+            item->unpollable = true;
+            return SELECTOR_SUCCESS;
+        }
+        return SELECTOR_IO;
+    }
+    item->polled = true;
+    return SELECTOR_SUCCESS;
+}
+#else
+static TSelectorStatus items_update_interest(TSelector s, struct item* item) {
     if (item->fd == -1) {
-        return;
+        return SELECTOR_SUCCESS;
     }
     FD_CLR(item->fd, &s->master_r);
     FD_CLR(item->fd, &s->master_w);
 
     if (ITEM_USED(item)) {
-        if (item->interest & OP_READ) {
+        // select(2) reporta los errores pendientes como lectura
+        if (item->interest & (OP_READ | OP_ERROR)) {
             FD_SET(item->fd, &(s->master_r));
         }
 
@@ -235,49 +534,225 @@ static void items_update_fdset_for_fd(TSelector s, const struct item* item) {
             FD_SET(item->fd, &(s->master_w));
         }
     }
+    return SELECTOR_SUCCESS;
+}
+#endif
+
+/** tiempo monotónico en microsegundos */
+static uint64_t timers_clock_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** tiempo monotónico en ticks de la rueda */
+static uint64_t timers_clock(void) {
+    return timers_clock_us() / 1000;
 }
 
 /**
- * garantizar cierta cantidad de elemenos en `fds'.
+ * llama a un callback del handler midiendo cuánto tarda. `handler' es
+ * estático, por lo que sigue siendo válido aunque el callback desregistre
+ * el fd.
+ */
+static void handler_call(const TFdHandler* handler, void (*callback)(TSelectorKey* key), TSelectorKey* key) {
+    const uint64_t start = timers_clock_us();
+    callback(key);
+    metricsRegisterHandlerTime(handler->stats_tag, timers_clock_us() - start);
+}
+
+/** inserta el timer del item en el slot que le corresponde según su vencimiento */
+static void timer_link(TSelector s, struct item* item) {
+    uint64_t expires = item->timer_expires;
+    if (expires < s->wheel_now) {
+        // ya vencido (en una cascada): va al slot que se está procesando
+        expires = s->wheel_now;
+    } else if (expires - s->wheel_now >= TIMER_HORIZON) {
+        expires = item->timer_expires = s->wheel_now + TIMER_HORIZON - 1;
+    }
+
+    const uint64_t delta = expires - s->wheel_now;
+    unsigned level = 0;
+    while (delta >> ((level + 1) * TIMER_BITS) != 0) {
+        level++;
+    }
+    const unsigned slot = (expires >> (level * TIMER_BITS)) & TIMER_MASK;
+
+    struct item** head = &s->wheel[level][slot];
+    item->timer_prev = NULL;
+    item->timer_next = *head;
+    if (*head != NULL) {
+        (*head)->timer_prev = item;
+    }
+    *head = item;
+    s->wheel_bitmap[level] |= (uint64_t)1 << slot;
+    item->timer_slot = level * TIMER_SLOTS + slot;
+}
+
+/** quita el timer del item de su slot */
+static void timer_unlink(TSelector s, struct item* item) {
+    const unsigned level = item->timer_slot / TIMER_SLOTS;
+    const unsigned slot = item->timer_slot % TIMER_SLOTS;
+
+    if (item->timer_prev != NULL) {
+        item->timer_prev->timer_next = item->timer_next;
+    } else {
+        s->wheel[level][slot] = item->timer_next;
+    }
+    if (item->timer_next != NULL) {
+        item->timer_next->timer_prev = item->timer_prev;
+    }
+    if (s->wheel[level][slot] == NULL) {
+        s->wheel_bitmap[level] &= ~((uint64_t)1 << slot);
+    }
+    item->timer_next = item->timer_prev = NULL;
+    item->timer_slot = TIMER_UNARMED;
+}
+
+static void timer_cancel(TSelector s, struct item* item) {
+    if (item->timer_slot != TIMER_UNARMED) {
+        timer_unlink(s, item);
+        s->timers--;
+    }
+}
+
+/**
+ * redistribuye en los niveles inferiores el slot actual de `level'. Si ese
+ * slot es el primero del nivel, antes se redistribuye el superior.
+ */
+static void timers_cascade(TSelector s, const unsigned level) {
+    if (level >= TIMER_LEVELS) {
+        return;
+    }
+    const unsigned slot = (s->wheel_now >> (level * TIMER_BITS)) & TIMER_MASK;
+    if (slot == 0) {
+        timers_cascade(s, level + 1);
+    }
+
+    struct item* item;
+    while ((item = s->wheel[level][slot]) != NULL) {
+        timer_unlink(s, item);
+        timer_link(s, item);
+    }
+}
+
+/** avanza la rueda hasta `now' despachando los timers vencidos */
+static void timers_advance(TSelector s, const uint64_t now) {
+    TSelectorKey key = {
+        .s = s,
+    };
+
+    while (s->wheel_now < now) {
+        if (s->timers == 0) {
+            s->wheel_now = now;
+            break;
+        }
+
+        // salteamos hasta el próximo slot ocupado del nivel 0, o hasta que
+        // termine la vuelta y haya que hacer una cascada.
+        uint64_t next = s->wheel_now + 1;
+        unsigned slot = next & TIMER_MASK;
+        if (slot != 0) {
+            const uint64_t pending = s->wheel_bitmap[0] & (~(uint64_t)0 << slot);
+            next = pending != 0 ? (next & ~TIMER_MASK) + __builtin_ctzll(pending) : (next | TIMER_MASK) + 1;
+            if (next > now) {
+                s->wheel_now = now;
+                break;
+            }
+            slot = next & TIMER_MASK;
+        }
+
+        s->wheel_now = next;
+        if (slot == 0) {
+            timers_cascade(s, 1);
+        }
+
+        // el handler puede programar o cancelar otros timers: tomamos de a uno
+        struct item* item;
+        while ((item = s->wheel[0][slot]) != NULL) {
+            timer_cancel(s, item);
+            if (item->handler->handle_timeout != NULL) {
+                key.fd = item->fd;
+                key.data = item->data;
+                handler_call(item->handler, item->handler->handle_timeout, &key);
+            }
+        }
+    }
+}
+
+/**
+ * milisegundos hasta el próximo evento de la rueda (un vencimiento o una
+ * cascada, que nunca es posterior al vencimiento que la provoca), o -1 si no
+ * hay timers.
+ */
+static int64_t timers_next(TSelector s, const uint64_t now) {
+    if (s->timers == 0) {
+        return -1;
+    }
+
+    uint64_t deadline = UINT64_MAX;
+    for (unsigned level = 0; level < TIMER_LEVELS; level++) {
+        const uint64_t bitmap = s->wheel_bitmap[level];
+        if (bitmap == 0) {
+            continue;
+        }
+        // primer slot ocupado luego del actual, dando la vuelta
+        const unsigned shift = level * TIMER_BITS;
+        const uint64_t base = s->wheel_now >> shift;
+        const unsigned from = (base + 1) & TIMER_MASK;
+        const uint64_t rotated = from == 0 ? bitmap : (bitmap >> from) | (bitmap << (TIMER_SLOTS - from));
+        const uint64_t candidate = (base + 1 + __builtin_ctzll(rotated)) << shift;
+        if (candidate < deadline) {
+            deadline = candidate;
+        }
+    }
+    return deadline <= now ? 0 : (int64_t)(deadline - now);
+}
+
+/** quita al item del backend y lo marca como libre */
+static void items_clear(TSelector s, struct item* item) {
+    item->interest = OP_NOOP;
+    items_update_interest(s, item);
+#ifdef SELECTOR_EPOLL
+    item->yielded = false;
+#endif
+    items_update_active(s, item);
+    timer_cancel(s, item);
+
+    memset(item, 0x00, sizeof(*item));
+    item_init(item);
+}
+
+/**
+ * garantizar que la tabla pueda direccionar `n' elementos. Solo crece el
+ * arreglo de bloques; los bloques se alocan a demanda en `item_at_alloc'.
  * Se asegura de que `n' sea un número que la plataforma donde corremos lo
  * soporta
  */
 static TSelectorStatus ensure_capacity(TSelector s, const size_t n) {
     TSelectorStatus ret = SELECTOR_SUCCESS;
 
-    const size_t element_size = sizeof(*s->fds);
+    const size_t element_size = sizeof(*s->chunks);
     if (n < s->fd_size) {
         // nada para hacer, entra...
         ret = SELECTOR_SUCCESS;
-    } else if (n > ITEMS_MAX_SIZE) {
+    } else if (n > s->fd_limit) {
         // me estás pidiendo más de lo que se puede.
         ret = SELECTOR_MAXFD;
-    } else if (NULL == s->fds) {
-        // primera vez.. alocamos
-        const size_t new_size = next_capacity(n);
-
-        s->fds = calloc(new_size, element_size);
-        if (NULL == s->fds) {
-            ret = SELECTOR_ENOMEM;
-        } else {
-            s->fd_size = new_size;
-            items_init(s, 0);
-        }
     } else {
         // hay que agrandar...
-        const size_t new_size = next_capacity(n);
-        if (new_size > SIZE_MAX / element_size) { // ver MEM07-C
+        const size_t new_chunks = (next_capacity(s, n) + ITEMS_CHUNK_SIZE - 1) / ITEMS_CHUNK_SIZE;
+        if (new_chunks > SIZE_MAX / element_size) { // ver MEM07-C
             ret = SELECTOR_ENOMEM;
         } else {
-            struct item* tmp = realloc(s->fds, new_size * element_size);
+            struct item** tmp = realloc(s->chunks, new_chunks * element_size);
             if (NULL == tmp) {
                 ret = SELECTOR_ENOMEM;
             } else {
-                s->fds = tmp;
-                const size_t old_size = s->fd_size;
-                s->fd_size = new_size;
-
-                items_init(s, old_size);
+                memset(tmp + s->chunks_size, 0x00, (new_chunks - s->chunks_size) * element_size);
+                s->chunks = tmp;
+                s->chunks_size = new_chunks;
+                s->fd_size = new_chunks * ITEMS_CHUNK_SIZE;
             }
         }
     }
@@ -285,6 +760,61 @@ static TSelectorStatus ensure_capacity(TSelector s, const size_t n) {
     return ret;
 }
 
+static void handle_block_notifications(TSelector s);
+
+/** vacía el canal de despertar y atiende los trabajos bloqueantes terminados */
+static void wake_read(TSelectorKey* key) {
+    TSelector s = key->s;
+#ifdef SELECTOR_EVENTFD
+    uint64_t count;
+    if (read(s->wake_r, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        logf(LOG_ERROR, "Selector failed to read its wakeup eventfd: %s", strerror(errno));
+    }
+#else
+    uint8_t drain[64];
+    while (read(s->wake_r, drain, sizeof(drain)) > 0) {
+        // nada que hacer, solo importa haber despertado
+    }
+#endif
+    // a partir de acá, una nueva notificación vuelve a despertar al selector
+    atomic_store(&s->wake_pending, false);
+    handle_block_notifications(s);
+}
+
+static const TFdHandler wake_handler = {
+    .handle_read = wake_read,
+};
+
+/** crea el canal por el cual los blocking jobs despiertan al selector */
+static int wake_open(TSelector s) {
+#ifdef SELECTOR_EVENTFD
+    s->wake_r = s->wake_w = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return s->wake_r;
+#else
+    int fds[2];
+    if (-1 == pipe(fds)) {
+        return -1;
+    }
+    s->wake_r = fds[0];
+    s->wake_w = fds[1];
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    return 0;
+#endif
+}
+
+static void wake_close(TSelector s) {
+    if (s->wake_w != -1 && s->wake_w != s->wake_r) {
+        close(s->wake_w);
+    }
+    if (s->wake_r != -1) {
+        close(s->wake_r);
+    }
+    s->wake_r = s->wake_w = -1;
+}
+
 TSelector selector_new(const size_t initial_elements) {
     size_t size = sizeof(struct fdselector);
     TSelector ret = malloc(size);
@@ -293,9 +823,25 @@ TSelector selector_new(const size_t initial_elements) {
         ret->master_t.tv_sec = conf.select_timeout.tv_sec;
         ret->master_t.tv_nsec = conf.select_timeout.tv_nsec;
         assert(ret->max_fd == 0);
-        ret->resolution_jobs = 0;
-        pthread_mutex_init(&ret->resolution_mutex, 0);
-        if (0 != ensure_capacity(ret, initial_elements)) {
+        ret->fd_limit = items_max_size();
+        ret->wheel_now = timers_clock();
+        ret->wake_r = ret->wake_w = -1;
+        atomic_init(&ret->wake_pending, false);
+        atomic_init(&ret->resolution_jobs, NULL);
+        for (uint32_t i = 0; i < BLOCKING_POOL_SIZE; i++) {
+            ret->job_pool[i].pool_index = i + 1;
+            atomic_init(&ret->job_pool[i].free_next, i + 1 < BLOCKING_POOL_SIZE ? i + 2 : 0);
+        }
+        atomic_init(&ret->job_free, 1);
+#ifdef SELECTOR_EPOLL
+        ret->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (ret->epfd == -1) {
+            free(ret);
+            return NULL;
+        }
+#endif
+        if (0 != ensure_capacity(ret, initial_elements) || -1 == wake_open(ret) ||
+            SELECTOR_SUCCESS != selector_register(ret, ret->wake_r, &wake_handler, OP_READ, NULL)) {
             selector_destroy(ret);
             ret = NULL;
         }
@@ -306,39 +852,48 @@ TSelector selector_new(const size_t initial_elements) {
 void selector_destroy(TSelector s) {
     // lean ya que se llama desde los casos fallidos de _new.
     if (s != NULL) {
-        if (s->fds != NULL) {
+        if (s->chunks != NULL) {
             for (size_t i = 0; i < s->fd_size; i++) {
-                if (ITEM_USED(s->fds + i)) {
+                if (item_used(s, i) != NULL) {
                     selector_unregister_fd(s, i);
                 }
             }
-            pthread_mutex_destroy(&s->resolution_mutex);
-            struct blocking_job* j = s->resolution_jobs;
-            while (j != NULL) {
-                struct blocking_job* aux = j;
-                j = j->next;
-                free(aux);
+            // los fds ya no tienen handler, pero los `done' de los trabajos
+            // terminados todavía tienen que liberar sus argumentos
+            handle_block_notifications(s);
+            for (size_t i = 0; i < s->chunks_size; i++) {
+                free(s->chunks[i]);
             }
-            free(s->fds);
-            s->fds = NULL;
+            free(s->chunks);
+            free(s->ready);
+            s->chunks = NULL;
+            s->chunks_size = 0;
             s->fd_size = 0;
         }
+        wake_close(s);
+#ifdef SELECTOR_EPOLL
+        close(s->epfd);
+#endif
         free(s);
     }
 }
 
-#define INVALID_FD(fd) ((fd) < 0 || (fd) >= ITEMS_MAX_SIZE)
+#define INVALID_FD(s, fd) ((fd) < 0 || (size_t)(fd) >= (s)->fd_size)
 
 TSelectorStatus selector_register(TSelector s, const int fd, const TFdHandler* handler, const TFdInterests interest, void* data) {
     TSelectorStatus ret = SELECTOR_SUCCESS;
     // 0. validación de argumentos
-    if (s == NULL || INVALID_FD(fd) || handler == NULL) {
+    if (s == NULL || fd < 0 || handler == NULL) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
     // 1. tenemos espacio?
     size_t ufd = (size_t)fd;
-    if (ufd > s->fd_size) {
+    if (ufd >= s->fd_limit) {
+        ret = SELECTOR_MAXFD;
+        goto finally;
+    }
+    if (ufd >= s->fd_size) {
         ret = ensure_capacity(s, ufd);
         if (SELECTOR_SUCCESS != ret) {
             goto finally;
@@ -346,7 +901,11 @@ TSelectorStatus selector_register(TSelector s, const int fd, const TFdHandler* h
     }
 
     // 2. registración
-    struct item* item = s->fds + ufd;
+    struct item* item = item_at_alloc(s, ufd);
+    if (item == NULL) {
+        ret = SELECTOR_ENOMEM;
+        goto finally;
+    }
     if (ITEM_USED(item)) {
         ret = SELECTOR_FDINUSE;
         goto finally;
@@ -357,10 +916,16 @@ TSelectorStatus selector_register(TSelector s, const int fd, const TFdHandler* h
         item->data = data;
 
         // actualizo colaterales
+        ret = items_update_interest(s, item);
+        if (SELECTOR_SUCCESS != ret) {
+            memset(item, 0x00, sizeof(*item));
+            item_init(item);
+            goto finally;
+        }
+        items_update_active(s, item);
         if (fd > s->max_fd) {
             s->max_fd = fd;
         }
-        items_update_fdset_for_fd(s, item);
     }
 
 finally:
@@ -370,13 +935,13 @@ finally:
 TSelectorStatus selector_unregister_fd(TSelector s, const int fd) {
     TSelectorStatus ret = SELECTOR_SUCCESS;
 
-    if (NULL == s || INVALID_FD(fd)) {
+    if (NULL == s || INVALID_FD(s, fd)) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
 
-    struct item* item = s->fds + fd;
-    if (!ITEM_USED(item)) {
+    struct item* item = item_used(s, fd);
+    if (item == NULL) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
@@ -390,12 +955,8 @@ TSelectorStatus selector_unregister_fd(TSelector s, const int fd) {
         item->handler->handle_close(&key);
     }
 
-    item->interest = OP_NOOP;
-    items_update_fdset_for_fd(s, item);
-
-    memset(item, 0x00, sizeof(*item));
-    item_init(item);
-    s->max_fd = items_max_fd(s);
+    items_clear(s, item);
+    items_max_fd_release(s, fd);
 
 finally:
     return ret;
@@ -404,23 +965,19 @@ finally:
 TSelectorStatus selector_unregister_fd_noclose(TSelector s, const int fd) {
     TSelectorStatus ret = SELECTOR_SUCCESS;
 
-    if (NULL == s || INVALID_FD(fd)) {
+    if (NULL == s || INVALID_FD(s, fd)) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
 
-    struct item* item = s->fds + fd;
-    if (!ITEM_USED(item)) {
+    struct item* item = item_used(s, fd);
+    if (item == NULL) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
 
-    item->interest = OP_NOOP;
-    items_update_fdset_for_fd(s, item);
-
-    memset(item, 0x00, sizeof(*item));
-    item_init(item);
-    s->max_fd = items_max_fd(s);
+    items_clear(s, item);
+    items_max_fd_release(s, fd);
 
 finally:
     return ret;
@@ -429,17 +986,21 @@ finally:
 TSelectorStatus selector_set_interest(TSelector s, int fd, TFdInterests i) {
     TSelectorStatus ret = SELECTOR_SUCCESS;
 
-    if (NULL == s || INVALID_FD(fd)) {
+    if (NULL == s || INVALID_FD(s, fd)) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
-    struct item* item = s->fds + fd;
-    if (!ITEM_USED(item)) {
+    struct item* item = item_used(s, fd);
+    if (item == NULL) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
+    if (item->interest == i) {
+        goto finally;
+    }
     item->interest = i;
-    items_update_fdset_for_fd(s, item);
+    ret = items_update_interest(s, item);
+    items_update_active(s, item);
 finally:
     return ret;
 }
@@ -447,12 +1008,12 @@ finally:
 TSelectorStatus selector_get_interests(TSelector s, int fd, TFdInterests* i) {
     TSelectorStatus ret = SELECTOR_SUCCESS;
 
-    if (NULL == s || INVALID_FD(fd)) {
+    if (NULL == s || INVALID_FD(s, fd)) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
-    struct item* item = s->fds + fd;
-    if (!ITEM_USED(item)) {
+    struct item* item = item_used(s, fd);
+    if (item == NULL) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
@@ -463,12 +1024,12 @@ finally:
 TSelectorStatus selector_get_interests_key(TSelectorKey* key, TFdInterests* i) {
     TSelectorStatus ret = SELECTOR_SUCCESS;
 
-    if (NULL == key || INVALID_FD(key->fd)) {
+    if (NULL == key || INVALID_FD(key->s, key->fd)) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
-    struct item* item = key->s->fds + key->fd;
-    if (!ITEM_USED(item)) {
+    struct item* item = item_used(key->s, key->fd);
+    if (item == NULL) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
@@ -480,7 +1041,7 @@ finally:
 TSelectorStatus selector_set_interest_key(TSelectorKey* key, TFdInterests i) {
     TSelectorStatus ret;
 
-    if (NULL == key || NULL == key->s || INVALID_FD(key->fd)) {
+    if (NULL == key || NULL == key->s || INVALID_FD(key->s, key->fd)) {
         ret = SELECTOR_IARGS;
     } else {
         ret = selector_set_interest(key->s, key->fd, i);
@@ -489,102 +1050,459 @@ TSelectorStatus selector_set_interest_key(TSelectorKey* key, TFdInterests i) {
     return ret;
 }
 
+TSelectorStatus selector_set_edge_triggered(TSelector s, int fd, bool edge) {
+    TSelectorStatus ret = SELECTOR_SUCCESS;
+
+    if (NULL == s || INVALID_FD(s, fd)) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    struct item* item = item_used(s, fd);
+    if (item == NULL) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+#ifdef SELECTOR_EPOLL
+    if (item->edge != edge) {
+        item->edge = edge;
+        ret = items_update_interest(s, item);
+    }
+#endif
+finally:
+    return ret;
+}
+
+TSelectorStatus selector_yield(TSelector s, int fd) {
+    TSelectorStatus ret = SELECTOR_SUCCESS;
+
+    if (NULL == s || INVALID_FD(s, fd)) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    struct item* item = item_used(s, fd);
+    if (item == NULL) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+#ifdef SELECTOR_EPOLL
+    if (item->edge) {
+        item->yielded = true;
+        items_update_active(s, item);
+    }
+#endif
+finally:
+    return ret;
+}
+
+TSelectorStatus selector_add_timer(TSelector s, int fd, unsigned ms) {
+    TSelectorStatus ret = SELECTOR_SUCCESS;
+
+    if (NULL == s || INVALID_FD(s, fd)) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    struct item* item = item_used(s, fd);
+    if (item == NULL) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+
+    timer_cancel(s, item);
+    item->timer_expires = timers_clock() + ms;
+    if (item->timer_expires <= s->wheel_now) {
+        // el slot del tick actual ya fue procesado
+        item->timer_expires = s->wheel_now + 1;
+    }
+    timer_link(s, item);
+    s->timers++;
+finally:
+    return ret;
+}
+
+TSelectorStatus selector_cancel_timer(TSelector s, int fd) {
+    TSelectorStatus ret = SELECTOR_SUCCESS;
+
+    if (NULL == s || INVALID_FD(s, fd)) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    struct item* item = item_used(s, fd);
+    if (item == NULL) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    timer_cancel(s, item);
+finally:
+    return ret;
+}
+
+/** despacha los eventos de un item según sus intereses actuales */
+static inline void handle_item(TSelectorKey* key, struct item* item, const bool readable, const bool writable, const bool error) {
+    key->fd = item->fd;
+    key->data = item->data;
+    if (error && (OP_ERROR & item->interest) && item->handler->handle_error != NULL) {
+        handler_call(item->handler, item->handler->handle_error, key);
+    }
+    if (readable) {
+        if (OP_READ & item->interest) {
+            if (0 == item->handler->handle_read) {
+                assert(("OP_READ arrived but no handler. bug!" == 0));
+            } else {
+                handler_call(item->handler, item->handler->handle_read, key);
+            }
+        }
+    }
+    if (writable) {
+        if (OP_WRITE & item->interest) {
+            if (0 == item->handler->handle_write) {
+                assert(("OP_WRITE arrived but no handler. bug!" == 0));
+            } else {
+                handler_call(item->handler, item->handler->handle_write, key);
+            }
+        }
+    }
+}
+
+/**
+ * toma de la lista de activos los fds que se van a despachar (todos, o los
+ * que pselect marcó) antes de llamar a los handlers, que pueden modificarla.
+ *
+ * @return la cantidad de fds listos en s->ready, o -1 si no hay memoria
+ */
+static int items_collect_ready(TSelector s) {
+    size_t n = 0;
+    for (struct item* item = s->active; item != NULL; item = item->active_next) {
+#ifndef SELECTOR_EPOLL
+        if (!FD_ISSET(item->fd, &s->slave_r) && !FD_ISSET(item->fd, &s->slave_w)) {
+            continue;
+        }
+#endif
+        if (n == s->ready_size) {
+            const size_t size = s->ready_size == 0 ? 64 : s->ready_size * 2;
+            int* tmp = realloc(s->ready, size * sizeof(*tmp));
+            if (tmp == NULL) {
+                return -1;
+            }
+            s->ready = tmp;
+            s->ready_size = size;
+        }
+        s->ready[n++] = item->fd;
+    }
+    return (int)n;
+}
+
+#ifdef SELECTOR_EPOLL
+/**
+ * se encarga de manejar los resultados de epoll_wait.
+ * solo se visitan los fds listos.
+ */
+static TSelectorStatus handle_iteration(TSelector s, const int n) {
+    TSelectorKey key = {
+        .s = s,
+    };
+
+    // los que ceden el turno durante esta iteración esperan a la próxima
+    const int ready = items_collect_ready(s);
+    if (ready < 0) {
+        return SELECTOR_ENOMEM;
+    }
+
+    for (int i = 0; i < n; i++) {
+        const struct epoll_event* ev = s->events + i;
+        struct item* item = item_used(s, ev->data.fd);
+        if (item != NULL) {
+            // como select(2): un error o hangup despierta a lectores y escritores
+            const bool err = (ev->events & (EPOLLERR | EPOLLHUP)) != 0;
+            handle_item(&key, item, err || (ev->events & EPOLLIN), err || (ev->events & EPOLLOUT), (ev->events & EPOLLERR) != 0);
+        }
+    }
+
+    // los unpollable (ej: el archivo de log) siempre están listos, y los que
+    // cedieron el turno se reintentan como si lo estuvieran
+    for (int i = 0; i < ready; i++) {
+        struct item* item = item_used(s, s->ready[i]);
+        if (item == NULL) {
+            continue;
+        }
+        if (item->yielded) {
+            item->yielded = false;
+            items_update_active(s, item);
+            handle_item(&key, item, true, true, false);
+        } else if (item->unpollable) {
+            handle_item(&key, item, true, true, false);
+        }
+    }
+    return SELECTOR_SUCCESS;
+}
+#else
 /**
  * se encarga de manejar los resultados del select.
- * se encuentra separado para facilitar el testing
+ * solo se visitan los items con algún interés.
  */
-static void handle_iteration(TSelector s) {
-    int n = s->max_fd;
+static TSelectorStatus handle_iteration(TSelector s) {
     TSelectorKey key = {
         .s = s,
     };
 
-    for (int i = 0; i <= n; i++) {
-        struct item* item = s->fds + i;
-        if (ITEM_USED(item)) {
-            key.fd = item->fd;
-            key.data = item->data;
-            if (FD_ISSET(item->fd, &s->slave_r)) {
-                if (OP_READ & item->interest) {
-                    if (0 == item->handler->handle_read) {
-                        assert(("OP_READ arrived but no handler. bug!" == 0));
-                    } else {
-                        item->handler->handle_read(&key);
-                    }
-                }
-            }
-            if (FD_ISSET(i, &s->slave_w)) {
-                if (OP_WRITE & item->interest) {
-                    if (0 == item->handler->handle_write) {
-                        assert(("OP_WRITE arrived but no handler. bug!" == 0));
-                    } else {
-                        item->handler->handle_write(&key);
-                    }
-                }
+    const int n = items_collect_ready(s);
+    if (n < 0) {
+        return SELECTOR_ENOMEM;
+    }
+    for (int i = 0; i < n; i++) {
+        const int fd = s->ready[i];
+        struct item* item = item_used(s, fd);
+        if (item != NULL) {
+            handle_item(&key, item, FD_ISSET(fd, &s->slave_r), FD_ISSET(fd, &s->slave_w), FD_ISSET(fd, &s->slave_r));
+        }
+    }
+    return SELECTOR_SUCCESS;
+}
+#endif
+
+/** toma un nodo libre del pool, o lo aloca si el pool se agotó */
+static struct blocking_job* job_alloc(TSelector s) {
+    uint64_t head = atomic_load(&s->job_free);
+    uint64_t next;
+    struct blocking_job* job;
+    do {
+        const uint32_t index = (uint32_t)head;
+        if (index == 0) {
+            job = malloc(sizeof(*job));
+            if (job != NULL) {
+                job->pool_index = 0;
             }
+            return job;
         }
+        job = s->job_pool + index - 1;
+        // si otro hilo tomó el nodo mientras tanto, el contador cambió y el
+        // compare-exchange falla: el valor leído de free_next se descarta.
+        next = ((head >> 32) + 1) << 32 | atomic_load_explicit(&job->free_next, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak(&s->job_free, &head, next));
+    return job;
+}
+
+/** devuelve un nodo al pool. Solo lo llama el hilo del selector */
+static void job_release(TSelector s, struct blocking_job* job) {
+    if (job->pool_index == 0) {
+        free(job);
+        return;
     }
+    uint64_t head = atomic_load(&s->job_free);
+    uint64_t next;
+    do {
+        atomic_store_explicit(&job->free_next, (uint32_t)head, memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | job->pool_index;
+    } while (!atomic_compare_exchange_weak(&s->job_free, &head, next));
 }
 
 static void handle_block_notifications(TSelector s) {
     TSelectorKey key = {
         .s = s,
     };
-    pthread_mutex_lock(&s->resolution_mutex);
-    struct blocking_job* j = s->resolution_jobs;
+
+    // nos llevamos todas las notificaciones de una vez; los handlers corren
+    // sin bloquear a los hilos que siguen notificando.
+    struct blocking_job* stack = atomic_exchange(&s->resolution_jobs, NULL);
+    if (stack == NULL) {
+        return;
+    }
+
+    // se apilaron en orden inverso: los despachamos en orden de llegada
+    struct blocking_job* j = NULL;
+    size_t depth = 0;
+    while (stack != NULL) {
+        struct blocking_job* aux = stack;
+        stack = stack->next;
+        aux->next = j;
+        j = aux;
+        depth++;
+    }
+    metricsRegisterBlockingQueueDepth(depth);
+
+    const uint64_t now = timers_clock_us();
     while (j != NULL) {
+        struct blocking_job* aux = j;
+        j = j->next;
+        metricsRegisterBlockingJobDispatched(now > aux->notified_at ? now - aux->notified_at : 0);
+
+        if (aux->done != NULL) {
+            TSelectorJobDone done = aux->done;
+            void* arg = aux->arg;
+            job_release(s, aux);
+            done(s, arg);
+            continue;
+        }
 
-        struct item* item = s->fds + j->fd;
-        if (ITEM_USED(item)) {
+        struct item* item = INVALID_FD(s, aux->fd) ? NULL : item_used(s, aux->fd);
+        job_release(s, aux);
+        if (item != NULL) {
             key.fd = item->fd;
             key.data = item->data;
-            item->handler->handle_block(&key);
+            handler_call(item->handler, item->handler->handle_block, &key);
         }
+    }
+}
 
-        struct blocking_job* aux = j;
-        j = j->next;
-        free(aux);
+/** apila `job' en las notificaciones de `s' y lo despierta */
+static TSelectorStatus job_notify(TSelector s, struct blocking_job* job) {
+    job->notified_at = timers_clock_us();
+
+    // encolamos en el selector los resultados
+    job->next = atomic_load_explicit(&s->resolution_jobs, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&s->resolution_jobs, &job->next, job, memory_order_release, memory_order_relaxed)) {
+        // otro hilo apiló primero: job->next ya tiene el nuevo tope
     }
-    s->resolution_jobs = 0;
-    pthread_mutex_unlock(&s->resolution_mutex);
+
+    // notificamos al hilo principal
+    return selector_wakeup(s);
 }
 
 TSelectorStatus selector_notify_block(TSelector s, const int fd) {
-    TSelectorStatus ret = SELECTOR_SUCCESS;
-
-    // TODO(juan): usar un pool
-    struct blocking_job* job = malloc(sizeof(*job));
+    struct blocking_job* job = job_alloc(s);
     if (job == NULL) {
-        ret = SELECTOR_ENOMEM;
-        goto finally;
+        return SELECTOR_ENOMEM;
     }
-    job->s = s;
     job->fd = fd;
+    job->done = NULL;
+    return job_notify(s, job);
+}
 
-    // encolamos en el selector los resultados
-    pthread_mutex_lock(&s->resolution_mutex);
-    job->next = s->resolution_jobs;
-    s->resolution_jobs = job;
-    pthread_mutex_unlock(&s->resolution_mutex);
+/** hilo del pool: corre los trabajos en orden de llegada hasta `selector_close' */
+static void* job_worker(void* unused) {
+    pthread_mutex_lock(&jobs.lock);
+    while (!jobs.closing) {
+        struct blocking_job* job = jobs.head;
+        if (job == NULL) {
+            pthread_cond_wait(&jobs.ready, &jobs.lock);
+            continue;
+        }
+        jobs.head = job->next;
+        if (jobs.head == NULL) {
+            jobs.tail = NULL;
+        }
+        jobs.queued--;
+        pthread_mutex_unlock(&jobs.lock);
 
-    // notificamos al hilo principal
-    pthread_kill(s->selector_thread, conf.signal);
+        const uint64_t now = timers_clock_us();
+        metricsRegisterJobStarted(now > job->notified_at ? now - job->notified_at : 0);
+        job->job(job->arg);
+        job_notify(job->s, job);
 
-finally:
+        pthread_mutex_lock(&jobs.lock);
+    }
+    pthread_mutex_unlock(&jobs.lock);
+    return NULL;
+}
+
+TSelectorStatus selector_submit_job(TSelector s, TSelectorJob job, TSelectorJobDone done, void* arg) {
+    if (job == NULL || done == NULL) {
+        return SELECTOR_IARGS;
+    }
+    struct blocking_job* j = job_alloc(s);
+    if (j == NULL) {
+        return SELECTOR_ENOMEM;
+    }
+    j->fd = -1;
+    j->job = job;
+    j->done = done;
+    j->arg = arg;
+    j->s = s;
+    j->next = NULL;
+    j->notified_at = timers_clock_us();
+
+    pthread_mutex_lock(&jobs.lock);
+    // con el pool saturado se rechaza: encolar sin límite solo alarga la espera
+    if (jobs.closing || jobs.threads_count == 0 || jobs.queued >= conf.job_queue) {
+        pthread_mutex_unlock(&jobs.lock);
+        job_release(s, j);
+        metricsRegisterJobRejected();
+        return SELECTOR_QFULL;
+    }
+    if (jobs.tail != NULL) {
+        jobs.tail->next = j;
+    } else {
+        jobs.head = j;
+    }
+    jobs.tail = j;
+    jobs.queued++;
+    pthread_cond_signal(&jobs.ready);
+    pthread_mutex_unlock(&jobs.lock);
+    return SELECTOR_SUCCESS;
+}
+
+TSelectorStatus selector_wakeup(TSelector s) {
+    TSelectorStatus ret = SELECTOR_SUCCESS;
+
+    // si ya hay un despertar en camino no hace falta escribir de nuevo
+    if (!atomic_exchange(&s->wake_pending, true)) {
+#ifdef SELECTOR_EVENTFD
+        const uint64_t one = 1;
+        ssize_t n = write(s->wake_w, &one, sizeof(one));
+#else
+        const uint8_t one = 1;
+        ssize_t n = write(s->wake_w, &one, sizeof(one));
+#endif
+        // EAGAIN: el canal está lleno, por lo que el selector ya va a despertar
+        if (n < 0 && errno != EAGAIN) {
+            ret = SELECTOR_IO;
+        }
+    }
     return ret;
 }
 
+#ifdef SELECTOR_EPOLL
+TSelectorStatus selector_select(TSelector s) {
+    TSelectorStatus ret = SELECTOR_SUCCESS;
+
+    int timeout = s->master_t.tv_sec * 1000 + s->master_t.tv_nsec / 1000000;
+    const int64_t next_timer = timers_next(s, timers_clock());
+    if (next_timer >= 0 && next_timer < timeout) {
+        timeout = (int)next_timer;
+    }
+    if (s->active != NULL) {
+        // hay items unpollable o que cedieron el turno: no nos podemos dormir
+        timeout = 0;
+    }
+
+    const uint64_t poll_start = timers_clock_us();
+    int fds = epoll_wait(s->epfd, s->events, SELECTOR_EPOLL_MAX_EVENTS, timeout);
+    const uint64_t poll_end = timers_clock_us();
+    if (-1 == fds) {
+        switch (errno) {
+            case EAGAIN:
+            case EINTR:
+                // si una señal nos interrumpio. ok!
+                fds = 0;
+                break;
+            default:
+                ret = SELECTOR_IO;
+                goto finally;
+        }
+    }
+    ret = handle_iteration(s, fds);
+    if (ret == SELECTOR_SUCCESS) {
+        timers_advance(s, timers_clock());
+        metricsRegisterLoopIteration(poll_end - poll_start, timers_clock_us() - poll_end, fds);
+    }
+finally:
+    return ret;
+}
+#else
 TSelectorStatus selector_select(TSelector s) {
     TSelectorStatus ret = SELECTOR_SUCCESS;
 
     memcpy(&s->slave_r, &s->master_r, sizeof(s->slave_r));
     memcpy(&s->slave_w, &s->master_w, sizeof(s->slave_w));
     memcpy(&s->slave_t, &s->master_t, sizeof(s->slave_t));
+    const int64_t next_timer = timers_next(s, timers_clock());
+    if (next_timer >= 0 && next_timer < s->slave_t.tv_sec * 1000 + s->slave_t.tv_nsec / 1000000) {
+        s->slave_t.tv_sec = next_timer / 1000;
+        s->slave_t.tv_nsec = (next_timer % 1000) * 1000000;
+    }
 
-    s->selector_thread = pthread_self();
-
-    int fds = pselect(s->max_fd + 1, &s->slave_r, &s->slave_w, 0, &s->slave_t,
-                      &emptyset);
+    const uint64_t poll_start = timers_clock_us();
+    int fds = pselect(s->max_fd + 1, &s->slave_r, &s->slave_w, 0, &s->slave_t, NULL);
+    const uint64_t poll_end = timers_clock_us();
     if (-1 == fds) {
         switch (errno) {
             case EAGAIN:
@@ -608,14 +1526,16 @@ TSelectorStatus selector_select(TSelector s) {
                 goto finally;
         }
     } else {
-        handle_iteration(s);
+        ret = handle_iteration(s);
     }
     if (ret == SELECTOR_SUCCESS) {
-        handle_block_notifications(s);
+        timers_advance(s, timers_clock());
+        metricsRegisterLoopIteration(poll_end - poll_start, timers_clock_us() - poll_end, fds < 0 ? 0 : fds);
     }
 finally:
     return ret;
 }
+#endif
 
 int selector_fd_set_nio(const int fd) {
     int ret = 0;
@@ -12,6 +12,8 @@
  * de file descriptors de forma no bloqueante.
  *
  * Esconde la implementación final (select(2) / poll(2) / epoll(2) / ..)
+ * En Linux se utiliza epoll(7), que solo despacha los descriptores listos.
+ * Compilando con -DSELECTOR_PSELECT se utiliza pselect(2) en su lugar.
  *
  * El usuario registra para un file descriptor especificando:
  *  1. un handler: provee funciones callback que manejarán los eventos de
@@ -26,10 +28,17 @@
  * descargar el trabajo en un hilo notificará al selector que el resultado del
  * trabajo está disponible y se le presentará a los handlers durante
  * la iteración normal. Los handlers no se tienen que preocupar por la
- * concurrencia.
+ * concurrencia. `selector_submit_job' corre esos trabajos en un pool de hilos
+ * fijo, común a todos los selectores, con una cola acotada.
  *
- * Dicha señalización se realiza mediante señales, y es por eso que al
- * iniciar la librería `TSelectorInit' se debe configurar una señal a utilizar.
+ * Dicha señalización se realiza escribiendo en un eventfd(2) (un pipe(2) en
+ * plataformas que no lo tienen) que el selector registra como cualquier otro
+ * descriptor. Varias notificaciones seguidas se agrupan en un único despertar.
+ *
+ * Cada file descriptor registrado puede tener además un timer: el selector
+ * mantiene una rueda de timers jerárquica (alta, baja y vencimiento en O(1))
+ * y duerme a lo sumo hasta el próximo vencimiento, momento en el cual llama
+ * a `handle_timeout' del handler.
  *
  * Todos métodos retornan su estado (éxito / error) de forma uniforme.
  * Puede utilizar `selector_error' para obtener una representación human
@@ -41,7 +50,8 @@
  *  - crear un selector: `selector_new'
  *  - registrar un file descriptor: `selector_register_fd'
  *  - esperar algún evento: `selector_iteratate'
- *  - destruir los recursos de la librería `selector_close'
+ *  - destruir los recursos de la librería `selector_close', y luego los
+ *    selectores `selector_destroy'
  */
 typedef struct fdselector* TSelector;
 
@@ -59,6 +69,8 @@ typedef enum {
     SELECTOR_FDINUSE = 4,
     /** I/O error check errno */
     SELECTOR_IO = 5,
+    /** la cola del pool de trabajos bloqueantes está llena */
+    SELECTOR_QFULL = 6,
 } TSelectorStatus;
 
 /** retorna una descripción humana del fallo */
@@ -66,17 +78,25 @@ const char* selector_error(const TSelectorStatus status);
 
 /** opciones de inicialización del selector */
 typedef struct {
-    /** señal a utilizar para notificaciones internas */
-    const int signal;
-
     /** tiempo máximo de bloqueo durante `selector_iteratate' */
     struct timespec select_timeout;
+    /**
+     * hilos del pool que corre los trabajos de `selector_submit_job', y
+     * cuántos trabajos pueden esperar un hilo libre antes de rechazarlos.
+     * Sin hilos no se aceptan trabajos.
+     */
+    unsigned job_threads;
+    unsigned job_queue;
 } TSelectorInit;
 
-/** inicializa la librería */
+/** inicializa la librería y lanza los hilos del pool de trabajos */
 TSelectorStatus selector_init(const TSelectorInit* c);
 
-/** deshace la incialización de la librería */
+/**
+ * deshace la incialización de la librería: espera a que terminen los trabajos
+ * que están corriendo y descarta los encolados. Sus `done' se llaman en la
+ * próxima iteración de cada selector, o al destruirlo.
+ */
 TSelectorStatus selector_close(void);
 
 /* instancia un nuevo selector. returna NULL si no puede instanciar  */
@@ -97,6 +117,13 @@ typedef enum {
     OP_NOOP = 0,
     OP_READ = 1 << 0,
     OP_WRITE = 1 << 2,
+    /**
+     * interés en la cola de errores del socket (ej: las notificaciones de
+     * MSG_ZEROCOPY). Se despacha a `handle_error'. Con pselect(2) no se
+     * distingue de OP_READ, por lo que el handler debe tolerar no encontrar
+     * nada.
+     */
+    OP_ERROR = 1 << 3,
 } TFdInterests;
 
 /**
@@ -130,6 +157,18 @@ typedef struct {
      */
     void (*handle_close)(TSelectorKey* key);
 
+    /** llamado cuando vence el timer del fd (ver `selector_add_timer') */
+    void (*handle_timeout)(TSelectorKey* key);
+
+    /** llamado cuando hay un error pendiente en el fd y se pidió OP_ERROR */
+    void (*handle_error)(TSelectorKey* key);
+
+    /**
+     * etiqueta con la que se agrupa el tiempo de los callbacks en las
+     * estadísticas (ver TMetricsHandler en logging/metrics.h). 0 es "otros".
+     */
+    unsigned stats_tag;
+
 } TFdHandler;
 
 /**
@@ -167,6 +206,36 @@ TSelectorStatus selector_get_interests_key(TSelectorKey* key, TFdInterests* i);
 /** Devuelve los intereses del selector */
 TSelectorStatus selector_get_interests(TSelector s, int fd, TFdInterests* i);
 
+/**
+ * pasa `fd' a modo edge-triggered: solo se notifica cuando el descriptor
+ * pasa a estar listo, por lo que el handler debe leer/escribir hasta recibir
+ * EAGAIN, o bien llamar a `selector_yield' si decide cortar antes.
+ *
+ * Con pselect(2) no tiene efecto: un handler que consume hasta EAGAIN
+ * funciona igual con notificaciones por nivel.
+ */
+TSelectorStatus selector_set_edge_triggered(TSelector s, int fd, bool edge);
+
+/**
+ * indica que el handler de un fd edge-triggered cortó antes de consumir
+ * todo lo disponible (ej: agotó su presupuesto), por lo que no va a haber
+ * una nueva notificación. El selector lo vuelve a despachar, como listo para
+ * leer y escribir, en la próxima iteración. Sin efecto en modo por nivel.
+ */
+TSelectorStatus selector_yield(TSelector s, int fd);
+
+/**
+ * programa el timer de `fd' para que venza dentro de `ms' milisegundos,
+ * reemplazando al que tuviera. Al vencer se llama a `handle_timeout'.
+ *
+ * Cada fd tiene a lo sumo un timer, que se cancela solo al desregistrarlo.
+ * La resolución es de un milisegundo.
+ */
+TSelectorStatus selector_add_timer(TSelector s, int fd, unsigned ms);
+
+/** cancela el timer de `fd', si tenía uno programado */
+TSelectorStatus selector_cancel_timer(TSelector s, int fd);
+
 /**
  * se bloquea hasta que hay eventos disponible y los despacha.
  * Retorna luego de cada iteración, o al llegar al timeout.
@@ -180,7 +249,36 @@ TSelectorStatus selector_select(TSelector s);
  */
 int selector_fd_set_nio(const int fd);
 
-/** notifica que un trabajo bloqueante terminó */
+/**
+ * notifica que un trabajo bloqueante terminó. Se puede llamar desde cualquier
+ * hilo; el `handle_block' del fd se ejecuta luego en el hilo del selector.
+ */
 TSelectorStatus selector_notify_block(TSelector s, const int fd);
 
+/** trabajo bloqueante: corre en un hilo del pool */
+typedef void (*TSelectorJob)(void* arg);
+
+/** fin de un trabajo bloqueante: corre en el hilo del selector */
+typedef void (*TSelectorJobDone)(TSelector s, void* arg);
+
+/**
+ * encola `job(arg)' en el pool de hilos. Cuando termina se llama a
+ * `done(s, arg)' en el hilo de `s', durante la iteración normal. Se llama
+ * desde el hilo de `s'.
+ *
+ * `done' se llama siempre, una vez, aunque el pool se cierre antes de correr
+ * `job' (ver `selector_close'), y es quien libera `arg'.
+ *
+ * Retorna SELECTOR_QFULL si ya hay `job_queue' trabajos esperando un hilo (o
+ * no hay pool): el llamador debe rechazar el pedido en lugar de esperar.
+ */
+TSelectorStatus selector_submit_job(TSelector s, TSelectorJob job, TSelectorJobDone done, void* arg);
+
+/**
+ * despierta al selector si está bloqueado esperando eventos, por ejemplo para
+ * que vuelva a evaluar una condición de corte. Se puede llamar desde cualquier
+ * hilo.
+ */
+TSelectorStatus selector_wakeup(TSelector s);
+
 #endif
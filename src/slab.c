@@ -0,0 +1,132 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+/**
+ * slab.c - alocador de objetos de tamaño fijo
+ */
+#include "slab.h"
+#include "logging/metrics.h"
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** tamaño aproximado de cada chunk; tiene al menos un objeto */
+#define SLAB_CHUNK_BYTES (64 * 1024)
+
+/** encabezado de un chunk, seguido de sus objetos */
+typedef union chunk {
+    union chunk* next;
+    // los objetos arrancan alineados al menos como los de malloc(3)
+    max_align_t align;
+} TChunk;
+
+struct slab {
+    /** tamaño de cada objeto, redondeado a su alineación */
+    size_t object_size;
+    size_t align;
+    /** offset del primer objeto en el chunk, que deja lugar al encabezado */
+    size_t header;
+    size_t chunk_objects;
+    size_t chunk_bytes;
+
+    /** memoria reservada en chunks, y su tope */
+    size_t bytes;
+    size_t max_bytes;
+
+    unsigned stats_tag;
+
+    /** objetos libres: cada uno guarda al principio el puntero al siguiente */
+    void* free;
+    /** todos los chunks, para liberarlos al destruir el slab */
+    TChunk* chunks;
+};
+
+TSlab slab_new(size_t object_size, size_t max_bytes, unsigned stats_tag) {
+    TSlab s = malloc(sizeof(*s));
+    if (s == NULL) {
+        return NULL;
+    }
+    if (object_size < sizeof(void*)) {
+        object_size = sizeof(void*);
+    }
+    // los objetos de una línea de cache o más arrancan en una línea, así sus
+    // primeros bytes no se reparten entre dos
+    size_t align = object_size >= SLAB_CACHE_LINE ? SLAB_CACHE_LINE : alignof(max_align_t);
+    object_size = (object_size + align - 1) / align * align;
+    size_t header = (sizeof(TChunk) + align - 1) / align * align;
+
+    s->object_size = object_size;
+    s->align = align;
+    s->header = header;
+    s->chunk_objects = SLAB_CHUNK_BYTES > header + object_size ? (SLAB_CHUNK_BYTES - header) / object_size : 1;
+    // con un tope chico los chunks se achican para poder usarlo
+    if (max_bytes > header && (max_bytes - header) / object_size < s->chunk_objects) {
+        s->chunk_objects = (max_bytes - header) / object_size;
+        if (s->chunk_objects == 0) {
+            s->chunk_objects = 1;
+        }
+    }
+    s->chunk_bytes = header + s->chunk_objects * object_size;
+    s->bytes = 0;
+    s->max_bytes = max_bytes;
+    s->stats_tag = stats_tag;
+    s->free = NULL;
+    s->chunks = NULL;
+    return s;
+}
+
+void slab_destroy(TSlab s) {
+    if (s == NULL) {
+        return;
+    }
+    TChunk* chunk = s->chunks;
+    while (chunk != NULL) {
+        TChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    metricsRegisterSlabMemory(s->stats_tag, 0, s->bytes);
+    free(s);
+}
+
+/** agrega un chunk y encadena sus objetos en la lista de libres */
+static bool slab_grow(TSlab s) {
+    if (s->bytes + s->chunk_bytes > s->max_bytes) {
+        return false;
+    }
+    void* memory;
+    if (posix_memalign(&memory, s->align, s->chunk_bytes) != 0) {
+        return false;
+    }
+    TChunk* chunk = memory;
+    chunk->next = s->chunks;
+    s->chunks = chunk;
+    s->bytes += s->chunk_bytes;
+    metricsRegisterSlabMemory(s->stats_tag, s->chunk_bytes, 0);
+
+    // de atrás para adelante, así se entregan en orden de dirección
+    uint8_t* objects = (uint8_t*)chunk + s->header;
+    for (size_t i = s->chunk_objects; i > 0; i--) {
+        void* object = objects + (i - 1) * s->object_size;
+        *(void**)object = s->free;
+        s->free = object;
+    }
+    return true;
+}
+
+void* slab_alloc(TSlab s) {
+    if (s->free == NULL && !slab_grow(s)) {
+        return NULL;
+    }
+    void* object = s->free;
+    s->free = *(void**)object;
+    metricsRegisterSlabObject(s->stats_tag, 1);
+    return object;
+}
+
+void slab_free(TSlab s, void* object) {
+    *(void**)object = s->free;
+    s->free = object;
+    metricsRegisterSlabObject(s->stats_tag, 0);
+}
@@ -0,0 +1,52 @@
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <stddef.h>
+
+/**
+ * slab.c - alocador de objetos de tamaño fijo
+ *
+ * Reserva la memoria de a chunks de varios objetos y encadena los objetos
+ * libres en una lista, por lo que alocar y liberar son O(1) y no pasan por
+ * malloc(3) salvo al agregar un chunk. Los chunks no se devuelven hasta
+ * destruir el slab, y nunca se pasa de `max_bytes' reservados: al llegar al
+ * tope `slab_alloc' falla.
+ *
+ * La memoria que entrega `slab_alloc' no está inicializada (puede tener los
+ * datos de un objeto anterior): el llamador inicializa lo que necesite.
+ *
+ * No es thread safe: cada hilo worker usa su propio slab.
+ *
+ * El flujo de utilización es:
+ *  - crear el slab: `slab_new'
+ *  - pedir y devolver objetos: `slab_alloc' / `slab_free'
+ *  - destruirlo, con lo que dejan de ser válidos todos sus objetos: `slab_destroy'
+ */
+typedef struct slab* TSlab;
+
+/**
+ * tamaño de una línea de cache: los objetos de al menos este tamaño se
+ * entregan alineados a ella
+ */
+#define SLAB_CACHE_LINE 64
+
+/**
+ * crea un slab de objetos de `object_size' bytes que reserva a lo sumo
+ * `max_bytes'. `stats_tag' agrupa sus objetos en las estadísticas (ver
+ * TMetricsSlab en logging/metrics.h). Retorna NULL si no hay memoria.
+ */
+TSlab slab_new(size_t object_size, size_t max_bytes, unsigned stats_tag);
+
+/** libera todos los chunks del slab. Tolera NULLs */
+void slab_destroy(TSlab s);
+
+/**
+ * retorna un objeto sin inicializar, o NULL si se llegó al tope de memoria o
+ * no se pudo reservar un chunk.
+ */
+void* slab_alloc(TSlab s);
+
+/** devuelve al slab un objeto obtenido con `slab_alloc' */
+void slab_free(TSlab s, void* object);
+
+#endif
@@ -9,8 +9,13 @@
 #include "logging/util.h"
 #include "request/request.h"
 #include "selector.h"
+#include "slab.h"
 #include "stm.h"
+#include <errno.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,7 +23,41 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
-void closeConnection(TSelectorKey* key);
+// en segundos; se configuran antes de lanzar los workers, luego son de solo lectura
+static unsigned timeouts[SOCKS_TIMEOUT_IDLE + 1];
+
+// keepalive en segundos y TCP_USER_TIMEOUT en milisegundos, 0 los deshabilita
+static unsigned keepaliveIdle = 0;
+static unsigned keepaliveInterval = 0;
+static unsigned keepaliveCount = 0;
+static unsigned userTimeout = 0;
+
+/**
+ * sesiones vivas de todos los workers, ordenadas por id, para el comando
+ * CONNECTIONS de management. El lock solo se toma al crear y liberar una
+ * sesión, y mientras management arma un buffer de filas: el relay no lo usa.
+ */
+static pthread_mutex_t sessionsLock = PTHREAD_MUTEX_INITIALIZER;
+static TClientData* sessionsHead = NULL;
+static TClientData* sessionsTail = NULL;
+static unsigned long sessionsNextId = 1;
+
+/** slab del que salen las sesiones del worker, ver `socksv5UseSlab' */
+static _Thread_local TSlab sessionSlab = NULL;
+
+static const char* stateNames[] = {
+    [NEGOTIATION_READ] = "NEGOTIATION_READ",
+    [NEGOTIATION_WRITE] = "NEGOTIATION_WRITE",
+    [AUTH_READ] = "AUTH_READ",
+    [AUTH_WRITE] = "AUTH_WRITE",
+    [REQUEST_READ] = "REQUEST_READ",
+    [REQUEST_RESOLV] = "REQUEST_RESOLV",
+    [REQUEST_CONNECTING] = "REQUEST_CONNECTING",
+    [REQUEST_WRITE] = "REQUEST_WRITE",
+    [COPY] = "COPY",
+    [DONE] = "DONE",
+    [ERROR] = "ERROR",
+};
 
 void doneArrival(const unsigned state, TSelectorKey* key) {
     log(LOG_DEBUG, "Socks5: Done state");
@@ -27,31 +66,42 @@ void errorArrival(const unsigned state, TSelectorKey* key) {
     log(LOG_DEBUG, "Socks5: Error state");
 }
 
+static unsigned handshakeTimeout(TSelectorKey* key) {
+    logf(LOG_INFO, "Socks5 client %d timed out during the handshake", key->fd);
+    return ERROR;
+}
+
 static const struct state_definition clientActions[] = {
     {
         .state = NEGOTIATION_READ,
         .on_arrival = negotiationReadInit,
         .on_read_ready = negotiationRead,
+        .on_timeout = handshakeTimeout,
     },
     {
         .state = NEGOTIATION_WRITE,
         .on_write_ready = negotiationWrite,
+        .on_timeout = handshakeTimeout,
     },
     {
         .state = AUTH_READ,
         .on_arrival = authReadInit,
         .on_read_ready = authRead,
+        .on_timeout = handshakeTimeout,
     },
     {
         .state = AUTH_WRITE,
         .on_write_ready = authWrite,
+        .on_timeout = handshakeTimeout,
     },
     {
         .state = REQUEST_READ,
         .on_arrival = requestReadInit,
         .on_read_ready = requestRead,
+        .on_timeout = handshakeTimeout,
     },
     {
+        // sin on_timeout: el hilo de resolución usa la sesión hasta notificar
         .state = REQUEST_RESOLV,
         .on_block_ready = requestResolveDone,
     },
@@ -59,10 +109,13 @@ static const struct state_definition clientActions[] = {
         .state = REQUEST_CONNECTING,
         .on_arrival = requestConectingInit,
         .on_write_ready = requestConecting,
+        .on_timeout = requestConectingTimeout,
     },
     {
         .state = REQUEST_WRITE,
+        .on_arrival = requestWriteInit,
         .on_write_ready = requestWrite,
+        .on_timeout = handshakeTimeout,
     },
     {
         .state = COPY,
@@ -70,6 +123,8 @@ static const struct state_definition clientActions[] = {
         .on_read_ready = socksv5HandleRead,
         .on_write_ready = socksv5HandleWrite,
         .on_departure = socksv5HandleClose,
+        .on_timeout = socksv5HandleTimeout,
+        .on_error = socksv5HandleError,
     },
     {
         .state = DONE,
@@ -80,15 +135,21 @@ static const struct state_definition clientActions[] = {
         .on_arrival = errorArrival,
     }};
 
+static void sessionsPublish(TClientData* data, unsigned state);
 static void socksv5Read(TSelectorKey* key);
 static void socksv5Write(TSelectorKey* key);
 static void socksv5Close(TSelectorKey* key);
 static void socksv5Block(TSelectorKey* key);
+static void socksv5Timeout(TSelectorKey* key);
+static void socksv5Error(TSelectorKey* key);
 static TFdHandler handler = {
     .handle_read = socksv5Read,
     .handle_write = socksv5Write,
     .handle_close = socksv5Close,
     .handle_block = socksv5Block,
+    .handle_timeout = socksv5Timeout,
+    .handle_error = socksv5Error,
+    .stats_tag = METRICS_HANDLER_SOCKS5,
 };
 
 const TFdHandler* getStateHandler() {
@@ -104,6 +165,7 @@ void socksv5Close(TSelectorKey* key) {
 static void socksv5Read(TSelectorKey* key) {
     struct state_machine* stm = &ATTACHMENT(key)->stm;
     const enum socks_state st = stm_handler_read(stm, key);
+    sessionsPublish(ATTACHMENT(key), st);
     if (st == ERROR || st == DONE) {
         closeConnection(key);
     }
@@ -112,6 +174,7 @@ static void socksv5Read(TSelectorKey* key) {
 static void socksv5Write(TSelectorKey* key) {
     struct state_machine* stm = &ATTACHMENT(key)->stm;
     const enum socks_state st = stm_handler_write(stm, key);
+    sessionsPublish(ATTACHMENT(key), st);
     if (st == ERROR || st == DONE) {
         closeConnection(key);
     }
@@ -120,11 +183,68 @@ static void socksv5Write(TSelectorKey* key) {
 static void socksv5Block(TSelectorKey* key) {
     struct state_machine* stm = &ATTACHMENT(key)->stm;
     const enum socks_state st = stm_handler_block(stm, key);
+    sessionsPublish(ATTACHMENT(key), st);
     if (st == ERROR || st == DONE) {
         closeConnection(key);
     }
 }
 
+static void socksv5Timeout(TSelectorKey* key) {
+    struct state_machine* stm = &ATTACHMENT(key)->stm;
+    const enum socks_state st = stm_handler_timeout(stm, key);
+    sessionsPublish(ATTACHMENT(key), st);
+    if (st == ERROR || st == DONE) {
+        closeConnection(key);
+    }
+}
+
+static void socksv5Error(TSelectorKey* key) {
+    struct state_machine* stm = &ATTACHMENT(key)->stm;
+    const enum socks_state st = stm_handler_error(stm, key);
+    sessionsPublish(ATTACHMENT(key), st);
+    if (st == ERROR || st == DONE) {
+        closeConnection(key);
+    }
+}
+
+void socksv5SetTimeout(TSocksTimeout which, unsigned seconds) {
+    timeouts[which] = seconds;
+}
+
+void socksv5SetKeepalive(unsigned idle, unsigned interval, unsigned count) {
+    keepaliveIdle = idle;
+    keepaliveInterval = interval;
+    keepaliveCount = count;
+}
+
+void socksv5SetUserTimeout(unsigned ms) {
+    userTimeout = ms;
+}
+
+void socksv5SetSocketOptions(int fd) {
+    if (keepaliveIdle != 0) {
+        int idle = (int)keepaliveIdle, interval = (int)keepaliveInterval, count = (int)keepaliveCount;
+        if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &(int){1}, sizeof(int)) < 0 || setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) < 0 ||
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) < 0 || setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) < 0) {
+            logf(LOG_WARNING, "Could not enable keepalive on fd %d: %s", fd, strerror(errno));
+        }
+    }
+    if (userTimeout != 0) {
+        unsigned ms = userTimeout;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &ms, sizeof(ms)) < 0) {
+            logf(LOG_WARNING, "Could not set TCP_USER_TIMEOUT on fd %d: %s", fd, strerror(errno));
+        }
+    }
+}
+
+void socksv5ArmTimeout(TSelector s, TClientData* data, TSocksTimeout which) {
+    if (timeouts[which] == 0) {
+        selector_cancel_timer(s, data->clientFd);
+    } else {
+        selector_add_timer(s, data->clientFd, timeouts[which] * 1000);
+    }
+}
+
 void closeConnection(TSelectorKey* key) {
     TClientData* data = ATTACHMENT(key);
     if (data->closed)
@@ -135,6 +255,9 @@ void closeConnection(TSelectorKey* key) {
 
     int clientSocket = data->clientFd;
     int serverSocket = data->originFd;
+    bool deferred = copyUringRelease(data) || data->resolving;
+    dns_cancel(data->resolvingQuery);
+    data->resolvingQuery = NULL;
 
     if (serverSocket != -1) {
         selector_unregister_fd(key->s, serverSocket);
@@ -145,65 +268,211 @@ void closeConnection(TSelectorKey* key) {
         close(clientSocket);
     }
 
-    if (data->originResolution != NULL) {
-        if (data->client.reqParser.atyp != REQ_ATYP_DOMAINNAME) {
-            free(data->originResolution->ai_addr);
-            free(data->originResolution);
-        } else {
-            freeaddrinfo(data->originResolution);
-        }
+    // si hay operaciones de io_uring en vuelo, la última completion libera, y
+    // si hay una resolución en curso, su fin (ver request.c)
+    if (!deferred) {
+        releaseClientData(data);
     }
+}
 
-    free(data);
+static void sessionsAdd(TClientData* data) {
+    pthread_mutex_lock(&sessionsLock);
+    data->id = sessionsNextId++;
+    data->prevSession = sessionsTail;
+    data->nextSession = NULL;
+    if (sessionsTail != NULL)
+        sessionsTail->nextSession = data;
+    else
+        sessionsHead = data;
+    sessionsTail = data;
+    pthread_mutex_unlock(&sessionsLock);
 }
 
-void socksv5PassivAccept(TSelectorKey* key) {
-    struct sockaddr_storage clientAddress;
-    socklen_t clientAddressLen = sizeof(clientAddress);
-    int newClientSocket = accept(key->fd, (struct sockaddr*)&clientAddress, &clientAddressLen);
+static void sessionsRemove(TClientData* data) {
+    pthread_mutex_lock(&sessionsLock);
+    if (data->prevSession != NULL)
+        data->prevSession->nextSession = data->nextSession;
+    else
+        sessionsHead = data->nextSession;
+    if (data->nextSession != NULL)
+        data->nextSession->prevSession = data->prevSession;
+    else
+        sessionsTail = data->prevSession;
+    pthread_mutex_unlock(&sessionsLock);
+}
 
-    if (newClientSocket < 0) {
-        logf(LOG_WARNING, "Socksv5 socket: accept() returned negative value: %d", newClientSocket);
+// solo el hilo de la sesión escribe publishedState, así que puede compararlo
+// sin el lock y tomarlo únicamente en las transiciones
+static void sessionsPublish(TClientData* data, unsigned state) {
+    if (state == data->publishedState)
         return;
+
+    // el destino se arma afuera del lock, en el buffer por hilo de reqParserToString
+    const char* destination = state > REQUEST_READ && state < DONE ? reqParserToString(&data->client.reqParser) : "";
+    pthread_mutex_lock(&sessionsLock);
+    data->publishedState = state;
+    strcpy(data->publishedUsername, data->isAuth && state > AUTH_WRITE ? data->username : "");
+    strcpy(data->publishedDestination, destination);
+    pthread_mutex_unlock(&sessionsLock);
+}
+
+bool socksv5ForEachSession(unsigned long afterId, bool (*visitor)(const TSessionInfo* info, void* arg), void* arg) {
+    bool all = true;
+    pthread_mutex_lock(&sessionsLock);
+    for (TClientData* data = sessionsHead; data != NULL && all; data = data->nextSession) {
+        if (data->id <= afterId)
+            continue;
+
+        unsigned state = data->publishedState;
+        TSessionInfo info = {
+            .id = data->id,
+            .clientAddress = &data->clientAddress,
+            .username = data->publishedUsername[0] != '\0' ? data->publishedUsername : NULL,
+            .state = state < N(stateNames) ? stateNames[state] : "UNKNOWN",
+            .destination = data->publishedDestination[0] != '\0' ? data->publishedDestination : NULL,
+            .start = data->start,
+            .bytesToClient = atomic_load_explicit(&data->bytesToClient, memory_order_relaxed),
+            .bytesToOrigin = atomic_load_explicit(&data->bytesToOrigin, memory_order_relaxed),
+        };
+        all = visitor(&info, arg);
     }
+    pthread_mutex_unlock(&sessionsLock);
+    return all;
+}
+
+void socksv5UseSlab(TSlab slab) {
+    sessionSlab = slab;
+}
 
-    if (newClientSocket > 1023) {
+void releaseClientData(TClientData* data) {
+    sessionsRemove(data);
+    dns_freeaddrinfo(data->originResolution);
+    copyRelayRelease(data);
+
+    slab_free(data->slab, data);
+}
+
+/** crea la sesión para un socket recién aceptado y lo registra en el selector */
+static void socksv5Accepted(TSelector s, int newClientSocket, const struct sockaddr_storage* clientAddress) {
+    // accept() no hereda O_NONBLOCK: sin esto un recv() de más bloquearía al hilo
+    if (selector_fd_set_nio(newClientSocket) == -1) {
+        logf(LOG_ERROR, "Socksv5 new client from %s with fd %d rejected because it could not be made non-blocking", printSocketAddress((struct sockaddr*)clientAddress), newClientSocket);
         close(newClientSocket);
-        logf(LOG_WARNING, "Socksv5 new client from %s with fd %d rejected because fd was too high", printSocketAddress((struct sockaddr*)&clientAddress), newClientSocket);
         return;
     }
+    socksv5SetSocketOptions(newClientSocket);
 
-    // Consider using a function to initialize the TClientData structure.
-    TClientData* clientData = calloc(1, sizeof(TClientData));
+    // el slab no la pone en cero: cada campo que se lee antes de escribirse
+    // se inicializa acá, el resto lo hace el estado que lo usa
+    TClientData* clientData = slab_alloc(sessionSlab);
     if (clientData == NULL) {
-        logf(LOG_ERROR, "Socksv5 new client from %s with fd %d rejected because alloc failed for clientData", printSocketAddress((struct sockaddr*)&clientAddress), newClientSocket);
+        logf(LOG_ERROR, "Socksv5 new client from %s with fd %d rejected because the session slab is full", printSocketAddress((struct sockaddr*)clientAddress), newClientSocket);
         close(newClientSocket);
         return;
     }
 
+    clientData->slab = sessionSlab;
     clientData->stm.initial = NEGOTIATION_READ;
     clientData->stm.max_state = ERROR;
     clientData->closed = false;
     clientData->isAuth = false;
+    clientData->username[0] = '\0';
     clientData->stm.states = clientActions;
     clientData->clientFd = newClientSocket;
     clientData->originFd = -1;
-    clientData->clientAddress = clientAddress;
+    clientData->originResolution = NULL;
+    clientData->resolving = false;
+    clientData->resolvingQuery = NULL;
+    clientData->relay = NULL;
+    clientData->clientAddress = *clientAddress;
+    clientData->start = time(NULL);
+    atomic_init(&clientData->bytesToClient, 0);
+    atomic_init(&clientData->bytesToOrigin, 0);
 
-    buffer_init(&clientData->originBuffer, BUFFER_SIZE, clientData->inOriginBuffer);
-    buffer_init(&clientData->clientBuffer, BUFFER_SIZE, clientData->inClientBuffer);
+    buffer_init(&clientData->originBuffer, HANDSHAKE_BUFFER_SIZE, clientData->inOriginBuffer);
+    buffer_init(&clientData->clientBuffer, HANDSHAKE_BUFFER_SIZE, clientData->inClientBuffer);
 
     stm_init(&clientData->stm);
 
-    TSelectorStatus status = selector_register(key->s, newClientSocket, getStateHandler(), OP_READ, clientData);
+    TSelectorStatus status = selector_register(s, newClientSocket, getStateHandler(), OP_READ, clientData);
 
     if (status != SELECTOR_SUCCESS) {
-        logf(LOG_ERROR, "Socksv5 new client from %s with fd %d rejected because registering into selector failed: %s", printSocketAddress((struct sockaddr*)&clientAddress), newClientSocket, selector_error(status));
+        logf(LOG_ERROR, "Socksv5 new client from %s with fd %d rejected because registering into selector failed: %s", printSocketAddress((struct sockaddr*)clientAddress), newClientSocket, selector_error(status));
         close(newClientSocket);
-        free(clientData);
+        slab_free(sessionSlab, clientData);
         return;
     }
+    socksv5ArmTimeout(s, clientData, SOCKS_TIMEOUT_HANDSHAKE);
+    clientData->publishedState = NEGOTIATION_READ;
+    clientData->publishedUsername[0] = '\0';
+    clientData->publishedDestination[0] = '\0';
+    sessionsAdd(clientData);
 
     metricsRegisterNewClient();
-    logf(LOG_INFO, "Socksv5 new client from %s assigned id %d", printSocketAddress((struct sockaddr*)&clientAddress), newClientSocket);
+    logf(LOG_INFO, "Socksv5 new client from %s assigned id %d", printSocketAddress((struct sockaddr*)clientAddress), newClientSocket);
+}
+
+void socksv5PassivAccept(TSelectorKey* key) {
+    struct sockaddr_storage clientAddress;
+    socklen_t clientAddressLen = sizeof(clientAddress);
+    int newClientSocket = accept(key->fd, (struct sockaddr*)&clientAddress, &clientAddressLen);
+
+    if (newClientSocket < 0) {
+        logf(LOG_WARNING, "Socksv5 socket: accept() returned negative value: %d", newClientSocket);
+        return;
+    }
+
+    socksv5Accepted(key->s, newClientSocket, &clientAddress);
+}
+
+/** cantidad de accept() que se mantienen en vuelo sobre el socket pasivo */
+#define URING_ACCEPTORS 8
+
+typedef struct TUringAcceptor {
+    TUringOp op;
+    TUring ring;
+    TSelector s;
+    int fd;
+    struct sockaddr_storage clientAddress;
+    socklen_t clientAddressLen;
+} TUringAcceptor;
+
+// cada hilo worker acepta sobre su propio socket pasivo
+static _Thread_local TUringAcceptor acceptors[URING_ACCEPTORS];
+
+static bool socksv5UringAccept(TUringAcceptor* acceptor) {
+    acceptor->clientAddressLen = sizeof(acceptor->clientAddress);
+    return uring_accept(acceptor->ring, &acceptor->op, acceptor->fd, (struct sockaddr*)&acceptor->clientAddress, &acceptor->clientAddressLen);
+}
+
+static void socksv5UringAcceptDone(TUringOp* op, int res) {
+    TUringAcceptor* acceptor = op->data;
+
+    if (res >= 0) {
+        socksv5Accepted(acceptor->s, res, &acceptor->clientAddress);
+    } else {
+        logf(LOG_WARNING, "Socksv5 socket: io_uring accept() failed: %s", strerror(-res));
+        if (res == -EBADF || res == -EINVAL) {
+            // el socket pasivo ya no sirve, no tiene sentido reintentar
+            return;
+        }
+    }
+
+    if (!socksv5UringAccept(acceptor)) {
+        logf(LOG_ERROR, "Socksv5 socket: could not queue io_uring accept() on fd %d", acceptor->fd);
+    }
+}
+
+bool socksv5UringListen(TUring ring, TSelector s, int fd) {
+    for (int i = 0; i < URING_ACCEPTORS; i++) {
+        TUringAcceptor* acceptor = &acceptors[i];
+        acceptor->op = (TUringOp){.callback = socksv5UringAcceptDone, .data = acceptor};
+        acceptor->ring = ring;
+        acceptor->s = s;
+        acceptor->fd = fd;
+        if (!socksv5UringAccept(acceptor)) {
+            return i > 0;
+        }
+    }
+    return true;
 }
@@ -4,47 +4,95 @@
 #include "auth/authParser.h"
 #include "buffer.h"
 #include "copy.h"
+#include "dns.h"
 #include "negotiation/negotiation.h"
 #include "passwordDissector.h"
 #include "request/requestParser.h"
 #include "selector.h"
+#include "slab.h"
 #include "stm.h"
 #include "users.h"
 #include <netdb.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <stdbool.h>
 #include <sys/socket.h>
+#include <time.h>
 
 // obtiene el struct socks5* desde la key
 #define ATTACHMENT(key) ((TClientData*)(key)->data)
+// tamaño fijo de los buffers del relay con io_uring, que los registra
 #define BUFFER_SIZE 32768
+// alcanza para las respuestas; los mensajes del cliente se parsean a medida que llegan
+#define HANDSHAKE_BUFFER_SIZE 256
 #define N(x) (sizeof(x) / sizeof((x)[0]))
 
+/**
+ * Estado que solo se usa en COPY. Se toma de un pool al llegar al estado, de
+ * forma que una conexión que no pasa de la negociación ocupa poca memoria.
+ * Los buffers del relay se piden aparte, ya que su tamaño varía (ver copy.c).
+ */
+typedef struct TRelay {
+    TConnection connections;
+    // solo existe si el password dissector aplica a la sesión (puerto 110)
+    TPDissector* pDissector;
+
+    // siguiente bloque libre, mientras está en el pool
+    struct TRelay* next;
+} TRelay;
+
+/**
+ * Los campos que toca cada evento del relay van primero: la máquina de
+ * estados, los fds y el relay en la primera línea de cache, y cada sentido
+ * (su buffer y sus bytes) en la suya, así un evento toca dos líneas. Lo que
+ * solo se usa en el handshake, los logs o management va después.
+ */
 typedef struct TClientData {
     struct state_machine stm;
-    union {
-        TNegParser negParser;
-        TReqParser reqParser;
-        TAuthParser authParser;
-    } client;
-
-    struct sockaddr_storage clientAddress;
+    // NULL hasta que la conexión llega a COPY
+    TRelay* relay;
+    int clientFd;
+    int originFd;
     bool closed;
 
-    TPDissector pDissector;
+    // apuntan a los arreglos del handshake hasta COPY, y luego a los del
+    // relay. Los bytes son para el comando CONNECTIONS de management, y los
+    // escribe solo el hilo de la sesión
+    alignas(SLAB_CACHE_LINE) struct buffer clientBuffer;
+    atomic_size_t bytesToClient;
+    alignas(SLAB_CACHE_LINE) struct buffer originBuffer;
+    atomic_size_t bytesToOrigin;
 
+    alignas(SLAB_CACHE_LINE) bool isAuth;
+    char username[USERS_MAX_USERNAME_LENGTH + 1];
     struct addrinfo* originResolution;
-    int clientFd;
-    int originFd;
-    TConnection connections;
+    // hay una resolución del nombre del origen en el pool del selector
+    bool resolving;
+    // o en el resolver del worker, que sí se puede cancelar
+    TDnsQuery* resolvingQuery;
+    unsigned long id;
+    time_t start;
+    // slab del worker dueño: al terminar, el hilo principal libera las sesiones de todos
+    TSlab slab;
 
-    char username[USERS_MAX_USERNAME_LENGTH + 1];
-    bool isAuth;
+    // lista de sesiones vivas de todos los workers (ver socks5.c)
+    struct TClientData* prevSession;
+    struct TClientData* nextSession;
+    // lo que ve CONNECTIONS: el hilo de la sesión lo copia bajo sessionsLock
+    // cuando cambia de estado, y el management lee solo esto
+    unsigned publishedState;
+    char publishedUsername[USERS_MAX_USERNAME_LENGTH + 1];
+    char publishedDestination[REQ_MAX_DN_LENGHT + 1 + 5 + 1];
 
-    struct buffer clientBuffer;
-    struct buffer originBuffer;
-    uint8_t inClientBuffer[BUFFER_SIZE];
-    uint8_t inOriginBuffer[BUFFER_SIZE];
+    struct sockaddr_storage clientAddress;
+    union {
+        TNegParser negParser;
+        TReqParser reqParser;
+        TAuthParser authParser;
+    } client;
+    uint8_t inClientBuffer[HANDSHAKE_BUFFER_SIZE];
+    uint8_t inOriginBuffer[HANDSHAKE_BUFFER_SIZE];
 } TClientData;
 
 enum socks_state {
@@ -137,12 +185,117 @@ enum socks_state {
     ERROR,
 };
 
+/** timeouts of a socks session, armed on the client fd */
+typedef enum {
+    /** from accept until the request is read (and while answering it) */
+    SOCKS_TIMEOUT_HANDSHAKE = 0,
+    /** for each connect() attempt to the origin */
+    SOCKS_TIMEOUT_CONNECT,
+    /** without data flowing in any direction while in COPY */
+    SOCKS_TIMEOUT_IDLE,
+} TSocksTimeout;
+
+/**
+ * @brief Configures a session timeout. Must be called before serving clients
+ * @param which the timeout to configure
+ * @param seconds the timeout, or 0 to disable it
+ */
+void socksv5SetTimeout(TSocksTimeout which, unsigned seconds);
+
+/**
+ * @brief Configures TCP keepalive on the client and origin sockets, so the kernel
+ * declares dead the peers that vanish without closing. Must be called before serving clients
+ * @param idle seconds without traffic before the first probe, or 0 to disable keepalive
+ * @param interval seconds between probes
+ * @param count unanswered probes after which the peer is dead
+ */
+void socksv5SetKeepalive(unsigned idle, unsigned interval, unsigned count);
+
+/**
+ * @brief Configures TCP_USER_TIMEOUT on the client and origin sockets: the time sent data
+ * may stay unacknowledged before the kernel declares the peer dead. Must be called before
+ * serving clients
+ * @param ms the timeout in milliseconds, or 0 to keep the system default
+ */
+void socksv5SetUserTimeout(unsigned ms);
+
+/**
+ * @brief Applies the keepalive and TCP_USER_TIMEOUT settings to a client or origin socket.
+ * Failures are only logged, the socket remains usable
+ * @param fd the socket
+ */
+void socksv5SetSocketOptions(int fd);
+
+/**
+ * @brief (Re)arms a timeout on the client fd of a session, replacing the one
+ * it had. If the timeout is disabled the current one is cancelled
+ * @param s the selector where the client fd is registered
+ * @param data the session
+ * @param which the timeout to arm
+ */
+void socksv5ArmTimeout(TSelector s, TClientData* data, TSocksTimeout which);
+
+/** a snapshot of a socks session, see socksv5ForEachSession */
+typedef struct {
+    unsigned long id;
+    const struct sockaddr_storage* clientAddress;
+    /** NULL if the session didn't authenticate */
+    const char* username;
+    const char* state;
+    /** "host\tport" as requested by the client, or NULL if the request wasn't read yet */
+    const char* destination;
+    time_t start;
+    size_t bytesToClient;
+    size_t bytesToOrigin;
+} TSessionInfo;
+
+/**
+ * @brief Calls `visitor` with the live socks sessions of every worker whose id is greater than
+ * `afterId`, in increasing id order, until it returns false. The sessions keep relaying meanwhile,
+ * so the snapshots may be slightly out of date; they are only valid during the call
+ * @param afterId the id of the last session already visited, or 0 to start from the first one
+ * @param visitor the callback, which returns false to stop
+ * @param arg passed to `visitor`
+ * @returns true if every remaining session was visited, false if `visitor` stopped
+ */
+bool socksv5ForEachSession(unsigned long afterId, bool (*visitor)(const TSessionInfo* info, void* arg), void* arg);
+
 /**
  * @brief Handler to accept connections for socks server
  * @param key Selector key that holds information regarding the ready fd
  */
 void socksv5PassivAccept(TSelectorKey* key);
 
+/**
+ * @brief Sets the slab the sessions accepted by the calling worker thread are allocated
+ * from. Must be called from each worker thread before it serves clients
+ * @param slab a slab of sizeof(TClientData) objects
+ */
+void socksv5UseSlab(TSlab slab);
+
+/**
+ * @brief Accepts socks connections on the passive socket `fd` through io_uring
+ * instead of registering it into the selector
+ * @param ring the io_uring engine
+ * @param s the selector where the accepted clients are registered
+ * @param fd the passive socket
+ * @returns true if the accepts were queued, false if the caller must fall back
+ * to `socksv5PassivAccept`
+ */
+bool socksv5UringListen(TUring ring, TSelector s, int fd);
+
+/**
+ * @brief Closes both sockets of a client and releases its resources
+ * @param key Selector key of any of the client's file descriptors
+ */
+void closeConnection(TSelectorKey* key);
+
+/**
+ * @brief Frees a client data whose connection was already closed
+ * @param data the client data
+ */
+void releaseClientData(TClientData* data);
+
 /**
  * @brief Handler to return static function pointers handler for socks server
  * @returns The selector handler for read, write, block, close
@@ -93,6 +93,30 @@ stm_handler_block(struct state_machine* stm, TSelectorKey* key) {
     return ret;
 }
 
+unsigned
+stm_handler_timeout(struct state_machine* stm, TSelectorKey* key) {
+    handle_first(stm, key);
+    if (stm->current->on_timeout == 0) {
+        return stm->current->state;
+    }
+    const unsigned int ret = stm->current->on_timeout(key);
+    jump(stm, ret, key);
+
+    return ret;
+}
+
+unsigned
+stm_handler_error(struct state_machine* stm, TSelectorKey* key) {
+    handle_first(stm, key);
+    if (stm->current->on_error == 0) {
+        return stm->current->state;
+    }
+    const unsigned int ret = stm->current->on_error(key);
+    jump(stm, ret, key);
+
+    return ret;
+}
+
 void stm_handler_close(struct state_machine* stm, TSelectorKey* key) {
     if (stm->current != NULL && stm->current->on_departure != NULL) {
         stm->current->on_departure(stm->current->state, key);
@@ -54,6 +54,10 @@ struct state_definition {
     unsigned (*on_write_ready)(TSelectorKey* key);
     /** ejecutado cuando hay una resolución de nombres lista */
     unsigned (*on_block_ready)(TSelectorKey* key);
+    /** ejecutado cuando vence el timer del fd (opcional) */
+    unsigned (*on_timeout)(TSelectorKey* key);
+    /** ejecutado cuando hay un error pendiente en el fd (opcional) */
+    unsigned (*on_error)(TSelectorKey* key);
 };
 
 /** inicializa el la máquina */
@@ -75,6 +79,20 @@ stm_handler_write(struct state_machine* stm, TSelectorKey* key);
 unsigned
 stm_handler_block(struct state_machine* stm, TSelectorKey* key);
 
+/**
+ * indica que venció el timer. Si el estado no define `on_timeout' se
+ * ignora. retorna nuevo id de nuevo estado.
+ */
+unsigned
+stm_handler_timeout(struct state_machine* stm, TSelectorKey* key);
+
+/**
+ * indica que hay un error pendiente en el fd. Si el estado no define
+ * `on_error' se ignora. retorna nuevo id de nuevo estado.
+ */
+unsigned
+stm_handler_error(struct state_machine* stm, TSelectorKey* key);
+
 /** indica que ocurrió el evento close. retorna nuevo id de nuevo estado. */
 void stm_handler_close(struct state_machine* stm, TSelectorKey* key);
 
@@ -0,0 +1,414 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+/**
+ * uring.c - motor de ejecución basado en io_uring(7)
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // syscall(2), MAP_POPULATE
+#endif
+#include "uring.h"
+#include "logging/logger.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+/** cantidad de buffers que se pueden registrar en simultáneo */
+#define URING_MAX_BUFFERS 4096
+
+/** relación entre el tamaño de la completion queue y la submission queue */
+#define URING_CQ_FACTOR 4
+
+struct uring {
+    int fd;
+    TSelector s;
+    /** eventfd por el que el kernel avisa que hay completions */
+    int eventFd;
+
+    // submission queue
+    void* sqRing;
+    size_t sqRingSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned sqEntries;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    /** cantidad de sqes publicados que todavía no se enviaron al kernel */
+    unsigned unsubmitted;
+
+    // completion queue
+    void* cqRing;
+    size_t cqRingSize;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    /** pila de índices libres de buffers registrados; vacía si no hay soporte */
+    int* freeBuffers;
+    int freeBuffersCount;
+};
+
+static inline int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static inline int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nrArgs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+/** retira y despacha todas las completions disponibles */
+static void uring_reap(TUring u) {
+    unsigned head = *u->cqHead;
+    while (head != __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe* cqe = u->cqes + (head & *u->cqMask);
+        TUringOp* op = (TUringOp*)(uintptr_t)cqe->user_data;
+        const int res = cqe->res;
+
+        // liberamos la entrada antes del callback, que puede preparar otras
+        head++;
+        __atomic_store_n(u->cqHead, head, __ATOMIC_RELEASE);
+
+        if (op != NULL) {
+            op->pending = false;
+            op->callback(op, res);
+        }
+    }
+}
+
+static void uring_event_read(TSelectorKey* key) {
+    TUring u = key->data;
+    uint64_t count;
+    if (read(u->eventFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        logf(LOG_ERROR, "uring: reading completion eventfd failed: %s", strerror(errno));
+    }
+    uring_reap(u);
+}
+
+static const TFdHandler eventHandler = {
+    .handle_read = uring_event_read,
+};
+
+static void uring_unmap(TUring u) {
+    if (u->sqes != NULL && u->sqes != MAP_FAILED) {
+        munmap(u->sqes, u->sqesSize);
+    }
+    if (u->cqRing != NULL && u->cqRing != MAP_FAILED && u->cqRing != u->sqRing) {
+        munmap(u->cqRing, u->cqRingSize);
+    }
+    if (u->sqRing != NULL && u->sqRing != MAP_FAILED) {
+        munmap(u->sqRing, u->sqRingSize);
+    }
+}
+
+static int uring_map(TUring u, const struct io_uring_params* p) {
+    u->sqRingSize = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    u->cqRingSize = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cqRingSize > u->sqRingSize) {
+            u->sqRingSize = u->cqRingSize;
+        }
+        u->cqRingSize = u->sqRingSize;
+    }
+
+    u->sqRing = mmap(NULL, u->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sqRing == MAP_FAILED) {
+        return -1;
+    }
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        u->cqRing = u->sqRing;
+    } else {
+        u->cqRing = mmap(NULL, u->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cqRing == MAP_FAILED) {
+            return -1;
+        }
+    }
+
+    u->sqesSize = p->sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        return -1;
+    }
+
+    uint8_t* sq = u->sqRing;
+    u->sqHead = (unsigned*)(sq + p->sq_off.head);
+    u->sqTail = (unsigned*)(sq + p->sq_off.tail);
+    u->sqMask = (unsigned*)(sq + p->sq_off.ring_mask);
+    u->sqArray = (unsigned*)(sq + p->sq_off.array);
+    u->sqEntries = p->sq_entries;
+
+    uint8_t* cq = u->cqRing;
+    u->cqHead = (unsigned*)(cq + p->cq_off.head);
+    u->cqTail = (unsigned*)(cq + p->cq_off.tail);
+    u->cqMask = (unsigned*)(cq + p->cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p->cq_off.cqes);
+    return 0;
+}
+
+/** intenta crear una tabla esparsa de buffers registrados */
+static void uring_init_buffers(TUring u) {
+    struct io_uring_rsrc_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.nr = URING_MAX_BUFFERS;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (sys_io_uring_register(u->fd, IORING_REGISTER_BUFFERS2, &reg, sizeof(reg)) < 0) {
+        logf(LOG_INFO, "uring: registered buffers not available (%s), using plain recv", strerror(errno));
+        return;
+    }
+
+    u->freeBuffers = malloc(URING_MAX_BUFFERS * sizeof(*u->freeBuffers));
+    if (u->freeBuffers == NULL) {
+        return;
+    }
+    for (int i = 0; i < URING_MAX_BUFFERS; i++) {
+        u->freeBuffers[i] = URING_MAX_BUFFERS - 1 - i;
+    }
+    u->freeBuffersCount = URING_MAX_BUFFERS;
+}
+
+TUring uring_new(TSelector s, unsigned entries) {
+    TUring u = calloc(1, sizeof(*u));
+    if (u == NULL) {
+        return NULL;
+    }
+    u->s = s;
+    u->eventFd = -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP | IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * URING_CQ_FACTOR;
+
+    u->fd = sys_io_uring_setup(entries, &params);
+    if (u->fd < 0) {
+        logf(LOG_WARNING, "uring: io_uring_setup failed: %s", strerror(errno));
+        free(u);
+        return NULL;
+    }
+
+    if (uring_map(u, &params) < 0) {
+        logf(LOG_WARNING, "uring: mapping rings failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    u->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (u->eventFd < 0 || sys_io_uring_register(u->fd, IORING_REGISTER_EVENTFD, &u->eventFd, 1) < 0) {
+        logf(LOG_WARNING, "uring: registering completion eventfd failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    if (SELECTOR_SUCCESS != selector_register(s, u->eventFd, &eventHandler, OP_READ, u)) {
+        log(LOG_WARNING, "uring: registering completion eventfd in selector failed");
+        goto fail;
+    }
+
+    uring_init_buffers(u);
+    logf(LOG_INFO, "uring: io_uring engine ready with %u entries", params.sq_entries);
+    return u;
+
+fail:
+    uring_unmap(u);
+    if (u->eventFd >= 0) {
+        close(u->eventFd);
+    }
+    close(u->fd);
+    free(u);
+    return NULL;
+}
+
+void uring_destroy(TUring u) {
+    if (u == NULL) {
+        return;
+    }
+    selector_unregister_fd(u->s, u->eventFd);
+    close(u->eventFd);
+    uring_unmap(u);
+    close(u->fd);
+    free(u->freeBuffers);
+    free(u);
+}
+
+int uring_register_buffer(TUring u, void* base, size_t len) {
+    if (u == NULL || u->freeBuffersCount == 0) {
+        return -1;
+    }
+
+    const int index = u->freeBuffers[u->freeBuffersCount - 1];
+    struct iovec iov = {
+        .iov_base = base,
+        .iov_len = len,
+    };
+    struct io_uring_rsrc_update2 up;
+    memset(&up, 0, sizeof(up));
+    up.offset = index;
+    up.data = (uint64_t)(uintptr_t)&iov;
+    up.nr = 1;
+    if (sys_io_uring_register(u->fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up)) < 0) {
+        return -1;
+    }
+    u->freeBuffersCount--;
+    return index;
+}
+
+void uring_unregister_buffer(TUring u, int index) {
+    if (u == NULL || index < 0) {
+        return;
+    }
+
+    // un iovec vacío deja el lugar esparso nuevamente. Si hay una lectura en
+    // vuelo sobre el buffer, el kernel mantiene su referencia hasta terminarla.
+    struct iovec iov = {
+        .iov_base = NULL,
+        .iov_len = 0,
+    };
+    struct io_uring_rsrc_update2 up;
+    memset(&up, 0, sizeof(up));
+    up.offset = index;
+    up.data = (uint64_t)(uintptr_t)&iov;
+    up.nr = 1;
+    sys_io_uring_register(u->fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up));
+    u->freeBuffers[u->freeBuffersCount++] = index;
+}
+
+/** obtiene un sqe libre, enviando lo pendiente si la cola está llena */
+static struct io_uring_sqe* uring_get_sqe(TUring u) {
+    unsigned tail = *u->sqTail;
+    if (tail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE) >= u->sqEntries) {
+        uring_submit(u);
+        if (tail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE) >= u->sqEntries) {
+            return NULL;
+        }
+    }
+
+    const unsigned index = tail & *u->sqMask;
+    struct io_uring_sqe* sqe = u->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    u->sqArray[index] = index;
+    return sqe;
+}
+
+/** publica el sqe obtenido con `uring_get_sqe' para el próximo submit */
+static bool uring_push(TUring u, struct io_uring_sqe* sqe, TUringOp* op) {
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    op->pending = true;
+    __atomic_store_n(u->sqTail, *u->sqTail + 1, __ATOMIC_RELEASE);
+    u->unsubmitted++;
+    return true;
+}
+
+bool uring_accept(TUring u, TUringOp* op, int fd, struct sockaddr* addr, socklen_t* addrLen) {
+    struct io_uring_sqe* sqe = uring_get_sqe(u);
+    if (sqe == NULL) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->addr2 = (uint64_t)(uintptr_t)addrLen;
+    return uring_push(u, sqe, op);
+}
+
+bool uring_recv(TUring u, TUringOp* op, int fd, void* buf, size_t len, int bufIndex) {
+    struct io_uring_sqe* sqe = uring_get_sqe(u);
+    if (sqe == NULL) {
+        return false;
+    }
+    if (bufIndex >= 0) {
+        // en un socket, read(2) es equivalente a recv(2) sin flags
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = bufIndex;
+    } else {
+        sqe->opcode = IORING_OP_RECV;
+    }
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    return uring_push(u, sqe, op);
+}
+
+bool uring_send(TUring u, TUringOp* op, int fd, const void* buf, size_t len) {
+    struct io_uring_sqe* sqe = uring_get_sqe(u);
+    if (sqe == NULL) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    return uring_push(u, sqe, op);
+}
+
+void uring_submit(TUring u) {
+    while (u->unsubmitted > 0) {
+        const int submitted = sys_io_uring_enter(u->fd, u->unsubmitted, 0, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EAGAIN/EBUSY: el kernel no tiene recursos, reintentamos en la
+            // próxima iteración.
+            if (errno != EAGAIN && errno != EBUSY) {
+                logf(LOG_ERROR, "uring: io_uring_enter failed: %s", strerror(errno));
+            }
+            return;
+        }
+        if (submitted == 0) {
+            return;
+        }
+        u->unsubmitted -= submitted;
+    }
+}
+
+#else
+
+// Plataforma sin io_uring: el motor nunca está disponible.
+
+TUring uring_new(TSelector s, unsigned entries) {
+    return NULL;
+}
+
+void uring_destroy(TUring u) {
+}
+
+int uring_register_buffer(TUring u, void* base, size_t len) {
+    return -1;
+}
+
+void uring_unregister_buffer(TUring u, int index) {
+}
+
+bool uring_accept(TUring u, TUringOp* op, int fd, struct sockaddr* addr, socklen_t* addrLen) {
+    return false;
+}
+
+bool uring_recv(TUring u, TUringOp* op, int fd, void* buf, size_t len, int bufIndex) {
+    return false;
+}
+
+bool uring_send(TUring u, TUringOp* op, int fd, const void* buf, size_t len) {
+    return false;
+}
+
+void uring_submit(TUring u) {
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include "selector.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+/**
+ * uring.c - motor de ejecución basado en io_uring(7)
+ *
+ * En lugar de esperar a que un file descriptor esté listo y recién ahí hacer
+ * la syscall, se encolan operaciones (accept, recv, send) en la submission
+ * queue y el kernel las completa de forma asincrónica. Todas las operaciones
+ * preparadas durante una iteración del selector se envían juntas con un único
+ * io_uring_enter(2) al llamar a `uring_submit'.
+ *
+ * Las completions se avisan mediante un eventfd que se registra en el
+ * selector como cualquier otro fd, por lo que los callbacks corren en el hilo
+ * del selector y no se tienen que preocupar por la concurrencia.
+ *
+ * Si la plataforma no soporta io_uring (o está deshabilitado), `uring_new'
+ * retorna NULL y el llamador debe seguir utilizando el selector.
+ *
+ * El flujo de utilización es:
+ *  - crear el motor asociado a un selector: `uring_new'
+ *  - preparar operaciones: `uring_accept' / `uring_recv' / `uring_send'
+ *  - enviarlas al kernel luego de cada iteración: `uring_submit'
+ *  - destruir el motor: `uring_destroy'
+ */
+typedef struct uring* TUring;
+
+typedef struct TUringOp TUringOp;
+
+/**
+ * callback de una operación completada. `res' tiene la semántica de
+ * io_uring: el valor de retorno de la syscall equivalente, o -errno.
+ */
+typedef void (*TUringCallback)(TUringOp* op, int res);
+
+/**
+ * Una operación asincrónica. La memoria debe seguir siendo válida hasta que
+ * se llame a su callback.
+ */
+struct TUringOp {
+    TUringCallback callback;
+    /** dato provisto por el usuario */
+    void* data;
+    /** true mientras la operación está en vuelo */
+    bool pending;
+};
+
+/**
+ * crea un motor con capacidad para `entries' operaciones por submit y lo
+ * asocia al selector `s'. Retorna NULL si io_uring no está disponible.
+ */
+TUring uring_new(TSelector s, unsigned entries);
+
+/** destruye el motor. Las operaciones en vuelo no se notifican. Tolera NULLs */
+void uring_destroy(TUring u);
+
+/**
+ * registra la región [base, base + len) como buffer fijo del kernel, para
+ * que las lecturas sobre ella eviten mapear las páginas en cada operación.
+ *
+ * @return el índice del buffer registrado, o -1 si no se pudo registrar
+ */
+int uring_register_buffer(TUring u, void* base, size_t len);
+
+/** libera un buffer registrado con `uring_register_buffer' */
+void uring_unregister_buffer(TUring u, int index);
+
+/** prepara un accept(2) sobre el socket pasivo `fd' */
+bool uring_accept(TUring u, TUringOp* op, int fd, struct sockaddr* addr, socklen_t* addrLen);
+
+/**
+ * prepara un recv(2) de hasta `len' bytes en `buf'. Si `bufIndex' no es
+ * negativo, `buf' debe caer dentro de ese buffer registrado.
+ */
+bool uring_recv(TUring u, TUringOp* op, int fd, void* buf, size_t len, int bufIndex);
+
+/** prepara un send(2) de hasta `len' bytes desde `buf' */
+bool uring_send(TUring u, TUringOp* op, int fd, const void* buf, size_t len);
+
+/** envía al kernel todas las operaciones preparadas */
+void uring_submit(TUring u);
+
+#endif
@@ -7,7 +7,9 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <regex.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +30,15 @@ static const char* usersFile;
 static regex_t usernameValidationRegex;
 static regex_t passwordValidationRegex;
 
+/**
+ * Protects the users table. Sessions on every worker thread read it while logging in, but
+ * it's only modified by the management protocol (or during startup and shutdown).
+ */
+static pthread_rwlock_t usersLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/** The bucket shared by all the sessions that didn't authenticate. It's never freed. */
+static TRateBucket anonymousRateBucket = {.references = 1};
+
 const TUserData* getUsersInternalArray(unsigned int* length) {
     *length = usersLength;
     return users;
@@ -123,7 +134,7 @@ static int loadUsersFileSingleLine(FILE* file, unsigned int* line, TUserData* us
         return -1;
 
     int passwordLength = 0;
-    while ((c = fgetc(file)) >= 32) {
+    while ((c = fgetc(file)) >= 32 && c != ':') {
         if (passwordLength == USERS_MAX_PASSWORD_LENGTH) {
             logf(LOG_ERROR, "Reading users file, password too long in line %u", *line);
             return 1;
@@ -133,6 +144,18 @@ static int loadUsersFileSingleLine(FILE* file, unsigned int* line, TUserData* us
     }
     userData->password[passwordLength] = '\0';
 
+    // An optional rate limit may follow the password.
+    userData->rateLimit = 0;
+    if (c == ':') {
+        while ((c = fgetc(file)) >= '0' && c <= '9')
+            userData->rateLimit = userData->rateLimit * 10 + (c - '0');
+
+        if (c >= 32) {
+            logf(LOG_ERROR, "Reading users file, invalid rate limit in line %u", *line);
+            return skipUntilNextLine(file, line);
+        }
+    }
+
     if (c == '\n')
         ungetc(c, file);
     return 0;
@@ -157,6 +180,8 @@ static int loadUsersFile() {
         TUserStatus status = usersCreate(userData.username, userData.password, 0, userData.privilegeLevel, 0);
         switch (status) {
             case EUSER_OK:
+                if (userData.rateLimit != 0)
+                    usersSetRateLimit(userData.username, userData.rateLimit);
                 break;
             case EUSER_ALREADYEXISTS:
                 logf(LOG_ERROR, "Reading users file, duplicate user in line %u", line);
@@ -190,7 +215,11 @@ static int saveUsersFile() {
 
     for (unsigned int i = 0; i < usersLength; i++) {
         const TUserData* user = &users[i];
-        int status = fprintf(file, "%c%s:%s\n", user->privilegeLevel == UPRIV_ADMIN ? '@' : '#', user->username, user->password);
+        int status;
+        if (user->rateLimit != 0)
+            status = fprintf(file, "%c%s:%s:%zu\n", user->privilegeLevel == UPRIV_ADMIN ? '@' : '#', user->username, user->password, user->rateLimit);
+        else
+            status = fprintf(file, "%c%s:%s\n", user->privilegeLevel == UPRIV_ADMIN ? '@' : '#', user->username, user->password);
         if (status < 0) {
             logf(LOG_ERROR, "Failure while writing to users file \"%s\": %s", usersFile, strerror(errno));
             break;
@@ -273,10 +302,7 @@ int usersInit(const char* usersFileParam) {
     return 0;
 }
 
-TUserStatus usersLogin(const char* username, const char* password, TUserPrivilegeLevel* outLevel) {
-    if (password == NULL)
-        password = "";
-
+static TUserStatus usersLoginLocked(const char* username, const char* password, TUserPrivilegeLevel* outLevel) {
     if (usersLength == 0) {
         log(LOG_WARNING, "A login attempt failed because there are no users in the system");
         return EUSER_WRONGUSERNAME;
@@ -295,10 +321,17 @@ TUserStatus usersLogin(const char* username, const char* password, TUserPrivileg
     return EUSER_OK;
 }
 
-TUserStatus usersCreate(const char* username, const char* password, bool updatePassword, TUserPrivilegeLevel privilege, bool updatePrivilege) {
+TUserStatus usersLogin(const char* username, const char* password, TUserPrivilegeLevel* outLevel) {
     if (password == NULL)
         password = "";
 
+    pthread_rwlock_rdlock(&usersLock);
+    TUserStatus status = usersLoginLocked(username, password, outLevel);
+    pthread_rwlock_unlock(&usersLock);
+    return status;
+}
+
+static TUserStatus usersCreateLocked(const char* username, const char* password, bool updatePassword, TUserPrivilegeLevel privilege, bool updatePrivilege) {
     // Calculate the index at which the user is, or should be.
     int index = usersGetIndexOf(username);
     if (index >= 0) {
@@ -358,6 +391,13 @@ TUserStatus usersCreate(const char* username, const char* password, bool updateP
     if (status != EUSER_OK)
         return status;
 
+    TRateBucket* rateBucket = malloc(sizeof(TRateBucket));
+    if (rateBucket == NULL)
+        return EUSER_NOMEMORY;
+    atomic_init(&rateBucket->rate, 0);
+    atomic_init(&rateBucket->full, 0);
+    atomic_init(&rateBucket->references, 1);
+
     // Ensure the users array has enough space.
     if (usersLength == usersCapacity) {
         size_t newUsersCapacity = usersCapacity + USERS_ARRAY_SIZE_GRANULARITY;
@@ -365,8 +405,10 @@ TUserStatus usersCreate(const char* username, const char* password, bool updateP
             newUsersCapacity = USERS_MAX_COUNT;
 
         TUserData* newUsers = realloc(users, newUsersCapacity * sizeof(TUserData));
-        if (newUsers == NULL)
+        if (newUsers == NULL) {
+            free(rateBucket);
             return EUSER_NOMEMORY;
+        }
 
         users = newUsers;
         usersCapacity = newUsersCapacity;
@@ -382,6 +424,8 @@ TUserStatus usersCreate(const char* username, const char* password, bool updateP
     strcpy(users[insertIndex].username, username);
     strcpy(users[insertIndex].password, password);
     users[insertIndex].privilegeLevel = privilege;
+    users[insertIndex].rateLimit = 0;
+    users[insertIndex].rateBucket = rateBucket;
 
     if (privilege == UPRIV_ADMIN)
         adminUsersCount++;
@@ -390,7 +434,17 @@ TUserStatus usersCreate(const char* username, const char* password, bool updateP
     return EUSER_OK;
 }
 
-TUserStatus usersDelete(const char* username) {
+TUserStatus usersCreate(const char* username, const char* password, bool updatePassword, TUserPrivilegeLevel privilege, bool updatePrivilege) {
+    if (password == NULL)
+        password = "";
+
+    pthread_rwlock_wrlock(&usersLock);
+    TUserStatus status = usersCreateLocked(username, password, updatePassword, privilege, updatePrivilege);
+    pthread_rwlock_unlock(&usersLock);
+    return status;
+}
+
+static TUserStatus usersDeleteLocked(const char* username) {
     int index = usersGetIndexOf(username);
     if (index < 0)
         return EUSER_WRONGUSERNAME;
@@ -403,6 +457,10 @@ TUserStatus usersDelete(const char* username) {
         adminUsersCount--;
     }
 
+    // Sessions still holding the bucket stop being limited.
+    atomic_store(&users[index].rateBucket->rate, 0);
+    usersReleaseRateBucket(users[index].rateBucket);
+
     usersLength--;
     memmove(&users[index], &users[index + 1], (usersLength - index) * sizeof(TUserData));
 
@@ -410,14 +468,67 @@ TUserStatus usersDelete(const char* username) {
     return EUSER_OK;
 }
 
+TUserStatus usersDelete(const char* username) {
+    pthread_rwlock_wrlock(&usersLock);
+    TUserStatus status = usersDeleteLocked(username);
+    pthread_rwlock_unlock(&usersLock);
+    return status;
+}
+
 TUserStatus usersFinalize() {
+    pthread_rwlock_wrlock(&usersLock);
     saveUsersFile();
+    for (unsigned int i = 0; i < usersLength; i++)
+        usersReleaseRateBucket(users[i].rateBucket);
     free(users);
+    users = NULL;
+    usersLength = 0;
     regfree(&usernameValidationRegex);
     regfree(&passwordValidationRegex);
+    pthread_rwlock_unlock(&usersLock);
     return EUSER_OK;
 }
 
+TUserStatus usersSetRateLimit(const char* username, size_t rateLimit) {
+    if (username == NULL) {
+        atomic_store(&anonymousRateBucket.rate, rateLimit);
+        logf(LOG_INFO, "Rate limit for unauthenticated sessions set to %zu bytes/s", rateLimit);
+        return EUSER_OK;
+    }
+
+    pthread_rwlock_wrlock(&usersLock);
+    int index = usersGetIndexOf(username);
+    if (index >= 0) {
+        users[index].rateLimit = rateLimit;
+        atomic_store(&users[index].rateBucket->rate, rateLimit);
+    }
+    pthread_rwlock_unlock(&usersLock);
+
+    if (index < 0)
+        return EUSER_WRONGUSERNAME;
+
+    logf(LOG_INFO, "Rate limit for user %s set to %zu bytes/s", username, rateLimit);
+    return EUSER_OK;
+}
+
+TRateBucket* usersAcquireRateBucket(const char* username) {
+    if (username == NULL)
+        return &anonymousRateBucket;
+
+    pthread_rwlock_rdlock(&usersLock);
+    int index = usersGetIndexOf(username);
+    TRateBucket* bucket = index >= 0 ? users[index].rateBucket : NULL;
+    if (bucket != NULL)
+        atomic_fetch_add_explicit(&bucket->references, 1, memory_order_relaxed);
+    pthread_rwlock_unlock(&usersLock);
+    return bucket;
+}
+
+void usersReleaseRateBucket(TRateBucket* bucket) {
+    if (bucket != &anonymousRateBucket && atomic_fetch_sub_explicit(&bucket->references, 1, memory_order_acq_rel) == 1)
+        free(bucket);
+}
+
 const char* usersPrivilegeToString(TUserPrivilegeLevel privilege) {
     switch (privilege) {
         case UPRIV_USER:
@@ -430,5 +541,8 @@ const char* usersPrivilegeToString(TUserPrivilegeLevel privilege) {
 }
 
 bool userExists(const char* username) {
-    return usersGetIndexOf(username) >= 0;
+    pthread_rwlock_rdlock(&usersLock);
+    bool exists = usersGetIndexOf(username) >= 0;
+    pthread_rwlock_unlock(&usersLock);
+    return exists;
 }
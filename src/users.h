@@ -2,7 +2,9 @@
 #define _USERS_H_
 
 #include "selector.h"
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /** The maximum length of a user's username. */
 #define USERS_MAX_USERNAME_LENGTH 255
@@ -16,16 +18,17 @@
  * server administrator.
  * Each line contains the data about a single user. First, a character indicating the level of
  * privilege. '@' for admin, '#' for user. This is followed by the username, followed by a ':',
- * followed by the password.
+ * followed by the password, optionally followed by a ':' and the user's rate limit in bytes per
+ * second.
  * The order in which the users are specified is irrelevant.
  *
  * Example of how a users file would look if it had four users; an admin named "admin" with password
  * "1234", a user named "user" with no password, an admin named "pedro_el_grande" with password
- * "gomero", and another user named "pedro_el_chico" with password "4321":
+ * "gomero", and another user named "pedro_el_chico" with password "4321" limited to 1 MB/s:
 @admin:1234
 #user:
 @pedro_el_grande:gomero
-#pedro_el_chico:4321
+#pedro_el_chico:4321:1048576
 */
 
 /** The maximum amount of users the system supports. */
@@ -49,6 +52,23 @@ typedef enum {
     UPRIV_ADMIN = 1
 } TUserPrivilegeLevel;
 
+/**
+ * A token bucket shared by all the sessions of a user, across every worker thread. It counts the
+ * bytes relayed in both directions together, holds at most one second of its rate, and is refilled
+ * lazily by whoever looks at it, without locks.
+ */
+typedef struct {
+    /** The bytes per second the bucket refills, or 0 for no limit. */
+    atomic_size_t rate;
+    /**
+     * When the bucket will be full again, in nanoseconds of CLOCK_MONOTONIC. Up to one second ahead
+     * of now, or further if sessions took more than it had.
+     */
+    atomic_uint_least64_t full;
+    /** The users table holds one reference, and each session using the bucket another one. */
+    atomic_uint references;
+} TRateBucket;
+
 /**
  * Represents a user. Used as internal struct for the users module.
  */
@@ -56,6 +76,10 @@ typedef struct {
     char username[USERS_MAX_USERNAME_LENGTH + 1];
     char password[USERS_MAX_PASSWORD_LENGTH + 1];
     TUserPrivilegeLevel privilegeLevel;
+    /** The maximum amount of bytes per second all of the user's sessions together may relay, or 0 for no limit. */
+    size_t rateLimit;
+    /** The bucket that enforces rateLimit. */
+    TRateBucket* rateBucket;
 } TUserData;
 
 /**
@@ -120,6 +144,30 @@ TUserStatus usersDelete(const char* username);
  */
 TUserStatus usersFinalize();
 
+/**
+ * @brief Sets the rate limit of a user, or the default one for sessions that didn't authenticate.
+ * Sessions already relaying data pick up the new limit too.
+ * @param username The username of the user, or NULL to set the limit for unauthenticated sessions.
+ * @param rateLimit The maximum amount of bytes per second all of the user's sessions (or all of the
+ * unauthenticated ones) may relay together, counting both directions, or 0 for no limit.
+ * @returns A value from TUserStatus. Either OK or WRONGUSERNAME.
+ */
+TUserStatus usersSetRateLimit(const char* username, size_t rateLimit);
+
+/**
+ * @brief Gets a reference to the rate bucket of a user, or to the one shared by all the sessions
+ * that didn't authenticate. Release it with usersReleaseRateBucket.
+ * @param username The username of the user, or NULL for unauthenticated sessions.
+ * @returns The bucket, or NULL if the user doesn't exist. A bucket whose user is deleted stops
+ * limiting.
+ */
+TRateBucket* usersAcquireRateBucket(const char* username);
+
+/**
+ * @brief Releases a reference obtained with usersAcquireRateBucket.
+ */
+void usersReleaseRateBucket(TRateBucket* bucket);
+
 /**
  * @brief Returns a const string with a human-readable representation of a given user privilige level.
  */
@@ -131,7 +179,8 @@ const char* usersPrivilegeToString(TUserPrivilegeLevel privilege);
 bool userExists(const char* username);
 
 /**
- * @brief Gets the internal users array.
+ * @brief Gets the internal users array. The users are only modified from the management
+ * server's thread, so the returned array must not be used from any other thread.
  * @param length A pointer to a variable where the length of the array will be written to.
  */
 const TUserData* getUsersInternalArray(unsigned int* length);
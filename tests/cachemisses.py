@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+# Mide los cache misses del servidor por evento retransmitido. SESSIONS (1000)
+# sesiones hacen ping-pong de mensajes de 64 bytes con un origen de eco, cada
+# una con un mensaje en vuelo, y mientras tanto `perf stat' cuenta los cache
+# misses y las referencias del proceso del servidor durante DURATION (10)
+# segundos. Los eventos son las invocaciones de los handlers de las sesiones
+# que cuentan los histogramas HSOCKS5US y HOTHERUS (completions de io_uring)
+# de STATISTICS, tomados antes y después de la medición.
+#
+# Necesita perf(1) y contadores de hardware (en una VM suelen no estar). Los
+# argumentos se pasan al servidor, y SOCKS5V=<binario> mide otra versión.
+
+import multiprocessing
+import os
+import selectors
+import subprocess
+import sys
+import time
+
+from common import EchoOrigin, Server, socks_connect
+
+SESSIONS = int(os.environ.get('SESSIONS', '1000'))
+DURATION = int(os.environ.get('DURATION', '10'))
+EVENTS = ('cache-misses', 'cache-references')
+MESSAGE = b'x' * 64
+
+
+def workload(proxyPort, originPort, ready, stop):
+    sel = selectors.DefaultSelector()
+    for _ in range(SESSIONS):
+        s, reply = socks_connect(proxyPort, '127.0.0.1', originPort)
+        if reply != 0:
+            sys.exit('SOCKS request failed: %s' % reply)
+        s.setblocking(False)
+        sel.register(s, selectors.EVENT_READ)
+        s.send(MESSAGE)
+    ready.set()
+    pending = {}
+    while not stop.is_set():
+        for key, _ in sel.select(0.1):
+            s = key.fileobj
+            got = pending.get(s, 0) + len(s.recv(4096))
+            # cada mensaje completo se manda de nuevo
+            while got >= len(MESSAGE):
+                got -= len(MESSAGE)
+                s.send(MESSAGE)
+            pending[s] = got
+
+
+def handlerEvents(server):
+    """invocaciones de handlers de sesiones hasta ahora, según STATISTICS"""
+    total = 0
+    for line in server.management('STATISTICS').split('\n'):
+        if line.startswith(('HSOCKS5US:', 'HOTHERUS:')):
+            total += sum(int(n) for n in line.split(':')[1].split())
+    return total
+
+
+origin = EchoOrigin()
+server = Server(*sys.argv[1:])
+ready, stop = multiprocessing.Event(), multiprocessing.Event()
+client = multiprocessing.Process(target=workload, args=(server.port, origin.port, ready, stop))
+client.start()
+try:
+    if not ready.wait(120):
+        sys.exit('sessions did not open')
+    time.sleep(1)
+
+    before, start = handlerEvents(server), time.time()
+    try:
+        perf = subprocess.run(['perf', 'stat', '-x', ',', '-e', ','.join(EVENTS), '-p', str(server.proc.pid), '--', 'sleep', str(DURATION)],
+                              capture_output=True, text=True)
+    except FileNotFoundError:
+        # igual se mide la carga, para comparar contra otra máquina
+        perf = None
+        time.sleep(DURATION)
+    events, elapsed = handlerEvents(server) - before, time.time() - start
+
+    print('%d sessions, %d handler events in %.1fs (%.0f/s)' % (SESSIONS, events, elapsed, events / elapsed))
+    counts = {}
+    for line in perf.stderr.split('\n') if perf is not None else []:
+        fields = line.split(',')
+        if len(fields) > 2 and fields[2] in EVENTS and fields[0].isdigit():
+            counts[fields[2]] = int(fields[0])
+    if perf is None or len(counts) != len(EVENTS) or events == 0:
+        print('no hardware counters: perf(1) is not installed or cannot count %s here' % ' and '.join(EVENTS))
+        if perf is not None:
+            print(perf.stderr.strip())
+        sys.exit(2)
+    for name in EVENTS:
+        print('%-16s %12d  %8.2f per event' % (name, counts[name], counts[name] / events))
+finally:
+    stop.set()
+    client.join()
+    server.stop()
@@ -0,0 +1,167 @@
+# Utilidades compartidas por las pruebas y benchmarks de tests/: levantan
+# bin/socks5v en un directorio temporal, un origen de eco en el mismo proceso
+# y hacen el handshake SOCKS5 con usuario y contraseña.
+
+import os
+import random
+import selectors
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+# SOCKS5V permite comparar contra el binario de otra versión
+SERVER = os.environ.get('SOCKS5V', os.path.join(ROOT, 'bin', 'socks5v'))
+USER, PASSWORD = b'user', b'pass'
+
+
+def free_port():
+    """un puerto libre debajo del rango efímero, así no lo ocupan las
+    conexiones en TIME_WAIT de una corrida anterior"""
+    while True:
+        port = random.randint(10000, 30000)
+        s = socket.socket(socket.AF_INET6, socket.SOCK_STREAM)
+        try:
+            s.bind(('::', port))
+            return port
+        except OSError:
+            continue
+        finally:
+            s.close()
+
+
+class EchoOrigin:
+    """Origen que devuelve todo lo que recibe, con un selector en un hilo
+    propio para aguantar decenas de miles de conexiones. Escucha en `ports'
+    puertos, porque cada destino admite tantas conexiones como puertos
+    efímeros haya. Con `dualStack' atiende tanto 127.0.0.1 como ::1."""
+
+    def __init__(self, ports=1, dualStack=False):
+        self.sel = selectors.DefaultSelector()
+        self.ports = []
+        for _ in range(ports):
+            ls = socket.socket(socket.AF_INET6 if dualStack else socket.AF_INET)
+            ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            if dualStack:
+                ls.setsockopt(socket.IPPROTO_IPV6, socket.IPV6_V6ONLY, 0)
+            ls.bind(('::' if dualStack else '127.0.0.1', 0))
+            ls.listen(4096)
+            ls.setblocking(False)
+            self.sel.register(ls, selectors.EVENT_READ, None)
+            self.ports.append(ls.getsockname()[1])
+        self.port = self.ports[0]
+        threading.Thread(target=self._loop, daemon=True).start()
+
+    def _loop(self):
+        while True:
+            for key, _ in self.sel.select():
+                if key.data is None:
+                    try:
+                        c, _ = key.fileobj.accept()
+                    except BlockingIOError:
+                        continue
+                    c.setblocking(False)
+                    c.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+                    self.sel.register(c, selectors.EVENT_READ, True)
+                    continue
+                c = key.fileobj
+                try:
+                    data = c.recv(65536)
+                except (BlockingIOError, ConnectionError):
+                    data = None
+                if not data:
+                    self.sel.unregister(c)
+                    c.close()
+                    continue
+                # los mensajes de las pruebas son chicos: entran enteros
+                c.setblocking(True)
+                c.sendall(data)
+                c.setblocking(False)
+
+
+class Server:
+    """bin/socks5v con el usuario de las pruebas, en puertos libres. Con
+    `leaks' el log incluye el reporte de LeakSanitizer al terminar."""
+
+    def __init__(self, *args, leaks=False):
+        if not os.path.exists(SERVER):
+            sys.exit('%s not found, run make first' % SERVER)
+        self.dir = tempfile.mkdtemp(prefix='socks5v-test-')
+        self.port = free_port()
+        self.mgmtPort = free_port()
+        self.log = os.path.join(self.dir, 'server.log')
+        environ = dict(os.environ, ASAN_OPTIONS='detect_leaks=%d' % leaks)
+        self.proc = subprocess.Popen([SERVER, '-p', str(self.port), '-P', str(self.mgmtPort), '-u', '%s:%s' % (USER.decode(), PASSWORD.decode())] + list(args),
+                                     cwd=self.dir, stdout=open(self.log, 'w'), stderr=subprocess.STDOUT, env=environ)
+        deadline = time.time() + 10
+        while True:
+            try:
+                socket.create_connection(('127.0.0.1', self.port), timeout=1).close()
+                break
+            except OSError:
+                if self.proc.poll() is not None or time.time() > deadline:
+                    sys.exit('server did not start, see %s' % self.log)
+                time.sleep(0.05)
+
+    def management(self, *command):
+        """corre bin/client con el admin que se crea al no haber archivo de usuarios"""
+        client = os.path.join(ROOT, 'bin', 'client')
+        env = dict(os.environ, TOKEN='admin:admin')
+        return subprocess.run([client, '127.0.0.1', str(self.mgmtPort)] + list(command), env=env, capture_output=True, text=True).stdout
+
+    def stop(self):
+        """termina el servidor y retorna su log"""
+        self.proc.terminate()
+        self.proc.wait(60)
+        with open(self.log) as f:
+            return f.read()
+
+
+def recvn(s, n):
+    out = bytearray()
+    while len(out) < n:
+        d = s.recv(n - len(out))
+        if not d:
+            break
+        out += d
+    return bytes(out)
+
+
+def socks_connect(proxyPort, host, port, source=None, timeout=30):
+    """abre una sesión autenticada hacia host:port, que puede ser una IPv4 o
+    un nombre. Retorna el socket y el código de la respuesta al pedido."""
+    s = socket.socket()
+    s.settimeout(timeout)
+    if source is not None:
+        s.bind((source, 0))
+    s.connect(('127.0.0.1', proxyPort))
+    s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    s.sendall(b'\x05\x01\x02')
+    if recvn(s, 2) != b'\x05\x02':
+        s.close()
+        return None, 'negotiation'
+    s.sendall(b'\x01' + bytes([len(USER)]) + USER + bytes([len(PASSWORD)]) + PASSWORD)
+    if recvn(s, 2) != b'\x01\x00':
+        s.close()
+        return None, 'auth'
+    try:
+        address = b'\x01' + socket.inet_aton(host)
+    except OSError:
+        address = b'\x03' + bytes([len(host)]) + host.encode()
+    s.sendall(b'\x05\x01\x00' + address + struct.pack('!H', port))
+    reply = recvn(s, 4)
+    if len(reply) < 4:
+        s.close()
+        return None, 'closed'
+    # el resto de la respuesta depende del tipo de dirección
+    recvn(s, {1: 4, 4: 16}.get(reply[3], 0) + 2)
+    return s, reply[1]
+
+
+def percentile(values, p):
+    """`values' tiene que estar ordenado"""
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+# Prueba el resolver DNS de los workers (src/dns.c) contra dnsstub.py.
+#
+# El resolver lee /etc/resolv.conf y consulta el puerto 53, así que la prueba
+# se vuelve a ejecutar con unshare(1) en namespaces de usuario, red y montajes
+# propios: ahí puede escuchar en 127.0.0.1:53 y montar su propio resolv.conf
+# sin tocar los del sistema. El primer nameserver no existe, así que cada
+# intento pasa también por el ECONNREFUSED del siguiente.
+
+import os
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+NAMESPACE = 'SOCKS5V_TEST_DNS_NAMESPACE'
+RESOLV_CONF = 'nameserver 127.0.0.2\nnameserver 127.0.0.1\noptions timeout:1 attempts:2\n'
+TIMEOUT, ATTEMPTS = 1, 2
+
+if os.environ.get(NAMESPACE) is None:
+    try:
+        os.execvpe('unshare', ['unshare', '-rmn', sys.executable, os.path.abspath(__file__)] + sys.argv[1:], dict(os.environ, **{NAMESPACE: '1'}))
+    except OSError as e:
+        sys.exit('FAIL: could not run unshare(1): %s' % e)
+
+subprocess.run(['ip', 'link', 'set', 'lo', 'up'], check=True)
+with tempfile.NamedTemporaryFile('w', suffix='.conf', delete=False) as f:
+    f.write(RESOLV_CONF)
+subprocess.run(['mount', '--bind', f.name, '/etc/resolv.conf'], check=True)
+
+from common import EchoOrigin, Server, recvn, socks_connect  # noqa: E402
+from dnsstub import TYPE_A, TYPE_AAAA, DnsStub  # noqa: E402
+
+stub = DnsStub()
+origin = EchoOrigin(dualStack=True)
+server = Server(*sys.argv[1:], leaks=True)
+ok = True
+
+
+def request(name):
+    """retorna el código de la respuesta al pedido y cuánto tardó, o
+    'closed' si la sesión se cerró sin responder o no retransmite"""
+    start = time.time()
+    s, reply = socks_connect(server.port, name, origin.port)
+    elapsed = time.time() - start
+    if s is not None:
+        if reply == 0:
+            s.sendall(b'ping')
+            if recvn(s, 4) != b'ping':
+                reply = 'closed'
+        s.close()
+    return reply, elapsed
+
+
+def check(label, result, reply, fast=None, slow=None):
+    global ok
+    good = result[0] == reply and (fast is None or result[1] < fast) and (slow is None or result[1] > slow)
+    ok &= good
+    print('%-8s reply %-6s %.2fs %s' % (label, result[0], result[1], 'ok' if good else 'FAIL'))
+
+
+try:
+    check('cname', request('a.both.test'), 0, fast=0.5)
+    check('v4', request('a.v4.test'), 0, fast=0.5)
+    check('v6', request('a.v6.test'), 0, fast=0.5)
+    check('nx', request('a.nx.test'), 4, fast=0.5)
+    # si aceptara la respuesta con otro ID intentaría conectarse a 10.255.255.1
+    check('wrongid', request('a.wrongid.test'), 0, fast=0.5)
+
+    # la primera consulta se pierde: responde el reintento, luego del timeout
+    stub.clear()
+    check('retry', request('a.drop.test'), 0, slow=TIMEOUT * 0.9, fast=TIMEOUT * 2)
+    print('          queries', stub.queries())
+    ok &= stub.queries() == {('a.drop.test', TYPE_A): 2, ('a.drop.test', TYPE_AAAA): 2}
+
+    # sin respuesta se agotan los intentos contra cada nameserver
+    stub.clear()
+    check('timeout', request('a.slow.test'), 4, slow=TIMEOUT * ATTEMPTS * 0.9, fast=TIMEOUT * ATTEMPTS + 1.5)
+    print('          queries', stub.queries())
+    ok &= stub.queries() == {('a.slow.test', TYPE_A): ATTEMPTS, ('a.slow.test', TYPE_AAAA): ATTEMPTS}
+
+    # el cache no vuelve a consultar hasta que vence la TTL, pero cada worker
+    # tiene el suyo y las sesiones se reparten entre ellos
+    workers = int(sys.argv[sys.argv.index('-w') + 1]) if '-w' in sys.argv else 1
+    for name in ('again.both.test', 'again.nx.test', 'a.short.test'):
+        stub.clear()
+        replies = {request(name)[0] for _ in range(workers + 2)}
+        cached = all(n <= workers for n in stub.queries().values())
+        print('cache    %s replies %s queries %s %s' % (name, replies, stub.queries(), 'ok' if cached else 'FAIL'))
+        ok &= len(replies) == 1 and cached
+    time.sleep(1.5)
+    stub.clear()
+    request('a.short.test')
+    expired = len(stub.queries()) == 2
+    print('expired  queries %s %s' % (stub.queries(), 'ok' if expired else 'FAIL'))
+    ok &= expired
+
+    # muchas resoluciones en paralelo
+    results = []
+    threads = [threading.Thread(target=lambda i=i: results.append(request('h%d.both.test' % i)[0])) for i in range(200)]
+    [t.start() for t in threads]
+    [t.join() for t in threads]
+    parallel = results.count(0) == len(threads)
+    print('parallel %d of %d %s' % (results.count(0), len(threads), 'ok' if parallel else 'FAIL'))
+    ok &= parallel
+
+    # resoluciones en curso al terminar el servidor
+    for i in range(20):
+        threading.Thread(target=request, args=('p%d.slow.test' % i,), daemon=True).start()
+    time.sleep(0.3)
+finally:
+    log = server.stop()
+
+sanitizer = log.count('Sanitizer')
+print('sanitizer reports', sanitizer)
+ok &= sanitizer == 0
+print('DNS', 'PASS' if ok else 'FAIL')
+sys.exit(0 if ok else 1)
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# Servidor DNS de mentira para probar el resolver de src/dns.c. Responde por
+# UDP según el dominio del nombre consultado:
+#
+#   *.both.test    cadena de dos CNAME, con compresión, hasta 127.0.0.1 y ::1
+#   *.v4.test      solo A (127.0.0.1); AAAA sin registros
+#   *.v6.test      solo AAAA (::1); A sin registros
+#   *.nx.test      NXDOMAIN
+#   *.wrongid.test como v4.test, pero antes de la respuesta de A manda otra con
+#                  un ID distinto y una dirección que no sirve (10.255.255.1)
+#   *.drop.test    descarta la primera consulta de cada tipo, que se responde
+#                  recién cuando el cliente la reintenta
+#   *.slow.test    nunca responde
+#   *.short.test   como both.test pero con TTL de 1 segundo
+#
+# Corrido solo, escucha en 127.0.0.1:53 (o el puerto que se le pase).
+
+import socket
+import struct
+import sys
+import threading
+from collections import Counter
+
+TYPE_A, TYPE_CNAME, TYPE_AAAA = 1, 5, 28
+
+
+def rr(owner, rtype, ttl, rdata):
+    return owner + struct.pack('!HHIH', rtype, 1, ttl, len(rdata)) + rdata
+
+
+def pointer(offset):
+    return struct.pack('!H', 0xc000 | offset)
+
+
+class DnsStub:
+    def __init__(self, address='127.0.0.1', port=53):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind((address, port))
+        # consultas recibidas por (nombre, tipo)
+        self.seen = Counter()
+        self.lock = threading.Lock()
+        threading.Thread(target=self._loop, daemon=True).start()
+
+    def queries(self):
+        with self.lock:
+            return dict(self.seen)
+
+    def clear(self):
+        with self.lock:
+            self.seen.clear()
+
+    def _loop(self):
+        while True:
+            query, client = self.sock.recvfrom(512)
+            try:
+                self._answer(query, client)
+            except (IndexError, struct.error):
+                pass
+
+    def _answer(self, query, client):
+        labels, i = [], 12
+        while query[i]:
+            labels.append(query[i + 1:i + 1 + query[i]].decode().lower())
+            i += 1 + query[i]
+        name = '.'.join(labels)
+        qtype, = struct.unpack('!H', query[i + 1:i + 3])
+        question = query[12:i + 5]
+        with self.lock:
+            self.seen[(name, qtype)] += 1
+            times = self.seen[(name, qtype)]
+
+        qid, = struct.unpack('!H', query[:2])
+        if name.endswith('slow.test') or (name.endswith('drop.test') and times == 1):
+            return
+        if name.endswith('nx.test'):
+            self._send(client, qid, 3, question, [])
+            return
+        if name.endswith('wrongid.test') and qtype == TYPE_A:
+            bogus = rr(pointer(12), TYPE_A, 60, socket.inet_aton('10.255.255.1'))
+            self._send(client, (qid + 1) & 0xffff, 0, question, [bogus])
+
+        ttl = 1 if name.endswith('short.test') else 60
+        if name.endswith(('v4.test', 'wrongid.test')):
+            answers = [rr(pointer(12), TYPE_A, ttl, socket.inet_aton('127.0.0.1'))] if qtype == TYPE_A else []
+        elif name.endswith('v6.test'):
+            answers = [rr(pointer(12), TYPE_AAAA, ttl, socket.inet_pton(socket.AF_INET6, '::1'))] if qtype == TYPE_AAAA else []
+        else:
+            # name -> canon1.name -> canon2.name -> dirección, cada nombre
+            # nuevo comprimido contra el de la pregunta
+            first = 12 + len(question)
+            canon1 = b'\x06canon1' + pointer(12)
+            answer1 = rr(pointer(12), TYPE_CNAME, 60, canon1)
+            canon1At = first + len(answer1) - len(canon1)
+            canon2 = b'\x06canon2' + pointer(12)
+            answer2 = rr(pointer(canon1At), TYPE_CNAME, 60, canon2)
+            canon2At = first + len(answer1) + len(answer2) - len(canon2)
+            if qtype == TYPE_A:
+                address = rr(pointer(canon2At), TYPE_A, ttl, socket.inet_aton('127.0.0.1'))
+            else:
+                address = rr(pointer(canon2At), TYPE_AAAA, ttl, socket.inet_pton(socket.AF_INET6, '::1'))
+            answers = [answer1, answer2, address]
+        self._send(client, qid, 0, question, answers)
+
+    def _send(self, client, qid, rcode, question, answers):
+        header = struct.pack('!HHHHHH', qid, 0x8180 | rcode, 1, len(answers), 0, 0)
+        self.sock.sendto(header + question + b''.join(answers), client)
+
+
+if __name__ == '__main__':
+    stub = DnsStub(port=int(sys.argv[1]) if len(sys.argv) > 1 else 53)
+    print('DNS stand-in listening on 127.0.0.1:%d' % stub.sock.getsockname()[1])
+    threading.Event().wait()
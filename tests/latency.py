@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+# Mide la latencia de ida y vuelta de mensajes chicos a través del proxy, como
+# la de una sesión interactiva (SSH): cada sesión manda SIZE bytes (64) y
+# espera el eco del origen antes de mandar los siguientes, ROUNDS veces
+# (20000). Con SESSIONS (1) mayor a uno, las sesiones corren a la vez en
+# procesos separados. Reporta p50, p99 y p99.9 a través del proxy y, como
+# referencia, directo al origen.
+#
+# Los argumentos se pasan al servidor, por ejemplo `-w 4' o `-U'.
+
+import multiprocessing
+import os
+import socket
+import sys
+import time
+
+from common import EchoOrigin, Server, percentile, recvn, socks_connect
+
+ROUNDS = int(os.environ.get('ROUNDS', '20000'))
+SIZE = int(os.environ.get('SIZE', '64'))
+SESSIONS = int(os.environ.get('SESSIONS', '1'))
+WARMUP = 200
+
+
+def pingpong(args):
+    proxyPort, originPort = args
+    if proxyPort is None:
+        s = socket.create_connection(('127.0.0.1', originPort))
+        s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    else:
+        s, reply = socks_connect(proxyPort, '127.0.0.1', originPort)
+        if reply != 0:
+            sys.exit('SOCKS request failed: %s' % reply)
+    message = b'x' * SIZE
+    rtts = []
+    for i in range(WARMUP + ROUNDS):
+        start = time.perf_counter()
+        s.sendall(message)
+        if len(recvn(s, SIZE)) != SIZE:
+            sys.exit('session closed')
+        if i >= WARMUP:
+            rtts.append(time.perf_counter() - start)
+    s.close()
+    return rtts
+
+
+def measure(label, proxyPort, originPort):
+    with multiprocessing.Pool(SESSIONS) as pool:
+        rtts = sorted(r for session in pool.map(pingpong, [(proxyPort, originPort)] * SESSIONS) for r in session)
+    print('%-7s p50 %7.1fus  p99 %7.1fus  p99.9 %7.1fus  (%d round trips of %d bytes, %d sessions)' % (
+        label, percentile(rtts, 50) * 1e6, percentile(rtts, 99) * 1e6, percentile(rtts, 99.9) * 1e6, len(rtts), SIZE, SESSIONS))
+
+
+origin = EchoOrigin()
+server = Server(*sys.argv[1:])
+try:
+    measure('direct', None, origin.port)
+    measure('proxy', server.port, origin.port)
+finally:
+    server.stop()
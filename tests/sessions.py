@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# Abre SESSIONS (por defecto 50000) sesiones SOCKS5 por loopback, las mantiene
+# abiertas a la vez y verifica que todas sigan retransmitiendo.
+#
+# Cada sesión usa dos fds en el servidor y dos en esta prueba, así que se sube
+# RLIMIT_NOFILE (el límite duro requiere root o CAP_SYS_RESOURCE). Como cada
+# destino admite tantas conexiones como puertos efímeros haya, los clientes
+# salen de varias direcciones 127.0.0.x y el origen escucha en varios puertos.
+
+import os
+import resource
+import sys
+import time
+
+from common import EchoOrigin, Server, socks_connect
+
+PER_ADDRESS = 20000
+
+sessions = int(os.environ.get('SESSIONS', '50000'))
+groups = (sessions + PER_ADDRESS - 1) // PER_ADDRESS
+
+nofile = 2 * sessions + 1024
+try:
+    hard = resource.getrlimit(resource.RLIMIT_NOFILE)[1]
+    resource.setrlimit(resource.RLIMIT_NOFILE, (nofile, max(nofile, hard) if hard != resource.RLIM_INFINITY else hard))
+except (ValueError, OSError) as e:
+    sys.exit('FAIL: could not raise RLIMIT_NOFILE to %d (%s); run as root or lower SESSIONS' % (nofile, e))
+
+origin = EchoOrigin(ports=groups)
+# el slab por defecto no alcanza para tantas sesiones en un solo worker
+server = Server('-s', str(1 << 28), *sys.argv[1:])
+
+ok = True
+open_ = []
+start = time.time()
+try:
+    for i in range(sessions):
+        group = i // PER_ADDRESS
+        s, reply = socks_connect(server.port, '127.0.0.1', origin.ports[group], source='127.0.0.%d' % (2 + group))
+        if reply != 0:
+            print('session %d failed: %s' % (i, reply))
+            ok = False
+            break
+        open_.append(s)
+        if (i + 1) % 10000 == 0:
+            print('%d sessions open after %.1fs' % (i + 1, time.time() - start))
+    print('%d sessions open in %.1fs' % (len(open_), time.time() - start))
+
+    # todas a la vez: cada una tiene que seguir viva y retransmitir en ambos sentidos
+    for i, s in enumerate(open_):
+        s.sendall(b'%08d' % i)
+    broken = sum(1 for i, s in enumerate(open_) if s.recv(8) != b'%08d' % i)
+    print('%d of %d sessions echoed' % (len(open_) - broken, len(open_)))
+    ok &= broken == 0 and len(open_) == sessions
+finally:
+    for s in open_:
+        s.close()
+    server.stop()
+
+print('SESSIONS', 'PASS' if ok else 'FAIL')
+sys.exit(0 if ok else 1)